@@ -5,12 +5,5 @@ set -e
 
 filename="${1%.*}"
 
-#Write out .ll file from .src file
-./bin/compiler $1 
-
-#Compile/link the .ll file and runtime
-clang "${filename}.ll" ./src/runtime/runtime.c -o "${filename##*/}.out" -g -O3
-
-#Remove intermediates
-rm "${filename}.ll"
-
+#Compile the .src file and link it with the runtime (bin/runtime.o)
+./bin/compiler -O3 -o "${filename##*/}.out" $1
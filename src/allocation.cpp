@@ -0,0 +1,54 @@
+#include "allocation.h"
+
+using namespace llvm;
+
+AllocationManager::AllocationManager(IRBuilder<>& builder) : Builder(builder) {}
+
+AllocaInst* AllocationManager::entry_alloca(Function* F, 
+                                            Type* type, const std::string& name)
+{
+    // Allocas stay grouped at the start of the entry block, 
+    //  in the order they were made
+    BasicBlock& entry = F->getEntryBlock();
+    BasicBlock::iterator it = entry.begin();
+    while (it != entry.end() && isa<AllocaInst>(*it)) it++;
+
+    IRBuilder<> entry_builder(&entry, it);
+    return entry_builder.CreateAlloca(type, nullptr, name);
+}
+
+AllocaInst* AllocationManager::temp_slot(Function* F, Type* type)
+{
+    AllocaInst* slot;
+
+    std::vector<AllocaInst*>& free = free_slots[F][type];
+    if (free.empty())
+    {
+        slot = entry_alloca(F, type, "tmp");
+    }
+    else
+    {
+        slot = free.back();
+        free.pop_back();
+    }
+
+    Builder.CreateLifetimeStart(slot);
+    live_slots.push_back({F, slot});
+    return slot;
+}
+
+void AllocationManager::release_temps()
+{
+    for (auto& live : live_slots)
+    {
+        AllocaInst* slot = live.second;
+        Builder.CreateLifetimeEnd(slot);
+        free_slots[live.first][slot->getAllocatedType()].push_back(slot);
+    }
+    live_slots.clear();
+}
+
+void AllocationManager::forget(Function* F)
+{
+    free_slots.erase(F);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Type.h"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Places every alloca in its function's entry block, so the stack 
+//  doesn't grow when code runs more than once (e.g. in a loop), 
+//  and hands out reusable slots for temporaries.
+class AllocationManager
+{
+public:
+    AllocationManager(llvm::IRBuilder<>& builder);
+
+    // Space for the whole call of F, allocated after F's other allocas
+    llvm::AllocaInst* entry_alloca(llvm::Function* F, 
+        llvm::Type* type, const std::string& name="");
+
+    // A temporary slot in F, live from here until release_temps().
+    // Slots are reused by later statements that need the same type; 
+    //  lifetime markers tell llvm when each use begins and ends.
+    llvm::AllocaInst* temp_slot(llvm::Function* F, llvm::Type* type);
+
+    // End the lifetimes of the live temporaries (at the end of a statement)
+    void release_temps();
+
+    // Drop F's free slots (its body is gone)
+    void forget(llvm::Function* F);
+
+private:
+    llvm::IRBuilder<>& Builder;
+
+    // Temporary slots not in use, per function and type
+    std::unordered_map<llvm::Function*, 
+        std::unordered_map<llvm::Type*, 
+            std::vector<llvm::AllocaInst*>>> free_slots;
+    // Temporary slots in use by the current statement
+    std::vector<std::pair<llvm::Function*, llvm::AllocaInst*>> live_slots;
+};
@@ -0,0 +1,167 @@
+#include "codegen.h"
+#include "llvm_helper.h"
+#include "optimizer.h"
+#include "trace.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+using namespace llvm;
+
+typedef std::chrono::steady_clock Clock;
+
+// Write module to object, with machine
+static bool write_object_file(Module& module, TargetMachine& machine,
+    const std::string& object, std::string& error)
+{
+    std::error_code EC;
+    raw_fd_ostream dest(object, EC, sys::fs::F_None);
+    if (EC)
+    {
+        error = "Couldn't open " + object + ": " + EC.message();
+        return false;
+    }
+    if (!write_object(module, machine, dest))
+    {
+        error = "Can't emit an object file for this target";
+        return false;
+    }
+    dest.flush();
+    if (dest.has_error())
+    {
+        dest.clear_error();
+        error = "Couldn't write " + object;
+        return false;
+    }
+    return true;
+}
+
+// Compile one partition (bitcode, so each thread has its own context: 
+//  an LLVMContext can only be used by one thread at a time)
+static void compile_partition(const SmallVector<char, 0>& bitcode, 
+    int partition, const CompilerOptions& options, const std::string& object, 
+    std::string& error)
+{
+    Clock::time_point start = Clock::now();
+    LLVMContext context;
+    Expected<std::unique_ptr<Module>> module = parseBitcodeFile(
+        MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), object), 
+        context);
+    if (!module)
+    {
+        error = toString(module.takeError());
+        return;
+    }
+    // (its attributes are set already, and multiversioned functions' 
+    //  aren't the options')
+    std::unique_ptr<TargetMachine> machine = create_target_machine(options, 
+        error);
+    if (!machine || !write_object_file(**module, *machine, object, error)) 
+        return;
+
+    if (trace_categories & TRACE_PASSES)
+    {
+        size_t definitions = 0;
+        for (Function& F : **module) definitions += !F.isDeclaration();
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2) << "codegen partition " 
+            << partition << ": " << definitions << " functions, "
+            << std::chrono::duration<double, std::milli>(
+                Clock::now() - start).count() << "ms";
+        trace_line(out.str());
+    }
+}
+
+void remove_files(const std::vector<std::string>& files)
+{
+    for (const std::string& file : files) sys::fs::remove(file);
+}
+
+bool compile_to_objects(Module& M, const CompilerOptions& options,
+    std::vector<std::string>& objects, std::string& error)
+{
+    std::unique_ptr<TargetMachine> machine = host_target(M, options, error);
+    if (!machine) return false;
+    if (!optimize_module(M, *machine, options, error)) return false;
+
+    int partitions = options.codegen_threads;
+    for (int k = 0; k < partitions; k++)
+    {
+        SmallString<128> object;
+        std::error_code EC = sys::fs::createTemporaryFile(
+            "partition-" + std::to_string(k), "o", object);
+        if (EC)
+        {
+            remove_files(objects);
+            objects.clear();
+            error = "Couldn't create a temporary file: " + EC.message();
+            return false;
+        }
+        objects.push_back(object.str().str());
+    }
+
+    if (partitions == 1)
+    {
+        bool written = write_object_file(M, *machine, objects[0], error);
+        if (!written) remove_files(objects);
+        return written;
+    }
+
+    // Split on this thread (it's M's context), then compile the 
+    //  partitions at the same time
+    Clock::time_point start = Clock::now();
+    std::vector<SmallVector<char, 0>> bitcode;
+#if LLVM_VERSION_MAJOR >= 13
+    SplitModule(M, partitions, 
+#else
+    SplitModule(clone_module(M), partitions, 
+#endif
+        [&bitcode](std::unique_ptr<Module> partition)
+        {
+            bitcode.emplace_back();
+            raw_svector_ostream out(bitcode.back());
+            write_bitcode(*partition, out);
+        });
+    if (trace_categories & TRACE_PASSES)
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2) << "codegen split into " 
+            << bitcode.size() << " partitions: " 
+            << std::chrono::duration<double, std::milli>(
+                Clock::now() - start).count() << "ms";
+        trace_line(out.str());
+    }
+
+    std::vector<std::string> errors(bitcode.size());
+    std::vector<std::thread> threads;
+    for (size_t k = 0; k < bitcode.size(); k++)
+    {
+        threads.push_back(std::thread(compile_partition, std::cref(bitcode[k]),
+            (int)k, std::cref(options), std::cref(objects[k]), 
+            std::ref(errors[k])));
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    for (const std::string& partition_error : errors)
+    {
+        if (partition_error.empty()) continue;
+        error = partition_error;
+        remove_files(objects);
+        objects.clear();
+        return false;
+    }
+    return true;
+}
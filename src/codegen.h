@@ -0,0 +1,25 @@
+#pragma once
+
+#include "options.h"
+
+#include "llvm/IR/Module.h"
+
+#include <string>
+#include <vector>
+
+// Compile M to objects for the machine we're running on (see 
+//  host_target), after running the options' passes. With 
+//  codegen_threads above 1, the optimized module is split into that 
+//  many partitions (llvm's SplitModule: each function and global goes 
+//  to one chosen by its name, and internal ones become hidden so the 
+//  others can refer to them), and each partition is compiled in its 
+//  own context on its own thread. The same program and thread count 
+//  always give the same objects.
+// The objects are temporary files, in partition order, which the 
+//  caller links and removes. False, with error set, if one couldn't be 
+//  compiled (any that were written are removed then).
+bool compile_to_objects(llvm::Module& M, const CompilerOptions& options,
+    std::vector<std::string>& objects, std::string& error);
+
+// Remove temporary files (after they're linked)
+void remove_files(const std::vector<std::string>& files);
@@ -0,0 +1,105 @@
+#include "compiler.h"
+#include "incremental.h"
+#include "llvm_helper.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "scanner.h"
+#include "symboltable.h"
+
+#include "llvm/ADT/SmallVector.h"
+
+std::unique_ptr<llvm::Module> parse_program(
+    std::shared_ptr<const std::string> source, ErrHandler* err_handler,
+    llvm::LLVMContext& context, const CompilerOptions& options,
+    ProcedureCache* cache, ModuleStreamer* streamer, 
+    const std::string& filename)
+{
+    SymbolTableManager sym_manager(err_handler);
+    Scanner scanner(err_handler, &sym_manager);
+    scanner.init(source);
+
+    Parser parser(err_handler, &sym_manager, &scanner, filename, context, 
+        options);
+    parser.set_procedure_cache(cache);
+    parser.set_streamer(streamer);
+    return parser.parse();
+}
+
+// Parse with every diagnostic held for the result, then run the 
+//  options' passes (which set the module up for the host)
+static std::unique_ptr<llvm::Module> parse_source(const std::string& source,
+    llvm::LLVMContext& context, const CompilerOptions& options,
+    CompileResult& result)
+{
+    ErrHandler err_handler;
+    err_handler.set_buffered(true);
+    std::unique_ptr<llvm::Module> module = parse_program(
+        std::make_shared<const std::string>(source), &err_handler,
+        context, options);
+
+    err_handler.flush(&result.diagnostics);
+    result.errors = err_handler.errors;
+    result.warnings = err_handler.warnings;
+    if (result.errors) module.reset();
+
+    if (module && !pass_pipeline(options).empty())
+    {
+        std::string error;
+        std::unique_ptr<llvm::TargetMachine> machine 
+            = host_target(*module, options, error);
+        if (!machine || !optimize_module(*module, *machine, options, error))
+        {
+            result.diagnostics.push_back({true, error, -1, nullptr});
+            result.errors++;
+            module.reset();
+        }
+    }
+    return module;
+}
+
+CompileResult compile_module(const std::string& source,
+    llvm::LLVMContext& context, const CompilerOptions& options)
+{
+    CompileResult result;
+    result.module = parse_source(source, context, options, result);
+    return result;
+}
+
+CompileResult compile_bitcode(const std::string& source,
+    const CompilerOptions& options)
+{
+    CompileResult result;
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> module
+        = parse_source(source, context, options, result);
+    if (!module) return result;
+
+    llvm::raw_string_ostream stream(result.buffer);
+    write_bitcode(*module, stream);
+    return result;
+}
+
+CompileResult compile_object(const std::string& source,
+    const CompilerOptions& options)
+{
+    CompileResult result;
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> module
+        = parse_source(source, context, options, result);
+    if (!module) return result;
+
+    std::string error;
+    std::unique_ptr<llvm::TargetMachine> machine = host_target(*module, 
+        options, error);
+    llvm::SmallVector<char, 0> object;
+    llvm::raw_svector_ostream stream(object);
+    if (!machine || !write_object(*module, *machine, stream))
+    {
+        if (error.empty()) error = "Can't emit an object file for this target";
+        result.diagnostics.push_back({true, error, -1, nullptr});
+        result.errors++;
+        return result;
+    }
+    result.buffer.assign(object.begin(), object.end());
+    return result;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "errhandler.h"
+#include "options.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class ModuleStreamer;
+class ProcedureCache;
+
+// The library interface (libcompiler.a): compiles a program's source text
+//  in memory. Nothing is read from or written to files, stdout or stderr;
+//  diagnostics come back in the result instead. Compiles are independent,
+//  so these can be called over and over in one process, and on several
+//  threads at once as long as each thread has its own LLVMContext.
+
+// What a compile produced
+struct CompileResult
+{
+    // Errors and warnings, in the order the command line would print them
+    //  (deferred is always null)
+    std::vector<Diagnostic> diagnostics;
+    int errors = 0;
+    int warnings = 0;
+
+    // compile_module: the program's module, if there were no errors
+    std::unique_ptr<llvm::Module> module;
+    // compile_bitcode, compile_object: the file's contents,
+    //  if there were no errors
+    std::string buffer;
+
+    bool succeeded() const { return errors == 0; }
+};
+
+// The program as a module in context (optimized for the host if the
+//  options ask for it: -O, --passes)
+CompileResult compile_module(const std::string& source,
+    llvm::LLVMContext& context, const CompilerOptions& options=CompilerOptions());
+
+// The program as a bitcode file (as llvm-dis or lli would read)
+CompileResult compile_bitcode(const std::string& source,
+    const CompilerOptions& options=CompilerOptions());
+
+// The program as an object file for the machine this is running on,
+//  to be linked with the runtime
+CompileResult compile_object(const std::string& source,
+    const CompilerOptions& options=CompilerOptions());
+
+// Parse a program into a module, reporting to err_handler as it goes.
+//  What the functions above and the command line share.
+// cache - procedures kept from the last compile (see --watch);
+//  context has to be the cache's then
+// streamer - where to write procedures as they're finished (see --stream);
+//  the module's what's left, for streamer->finish
+// filename - the source's file, for debug info (-g)
+std::unique_ptr<llvm::Module> parse_program(
+    std::shared_ptr<const std::string> source, ErrHandler* err_handler,
+    llvm::LLVMContext& context, const CompilerOptions& options,
+    ProcedureCache* cache=nullptr, ModuleStreamer* streamer=nullptr,
+    const std::string& filename="");
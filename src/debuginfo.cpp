@@ -0,0 +1,230 @@
+#include "debuginfo.h"
+
+#include "llvm/BinaryFormat/Dwarf.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+using namespace llvm;
+
+DebugInfo::DebugInfo(Module& module, IRBuilder<>& builder,
+    const std::string& filename, const CompilerOptions& options)
+    : module(module), Builder(builder), di(module)
+{
+    // The name as it was given, relative to where the compiler ran
+    SmallString<256> directory;
+    sys::fs::current_path(directory);
+    file = di.createFile(filename.empty() ? "<source>" : filename, 
+        directory);
+    bool optimized = options.opt_level != '0' || !options.passes.empty();
+    // (the closest language DWARF has a code for)
+    unit = di.createCompileUnit(dwarf::DW_LANG_Pascal83, file, 
+        "Compiler-Project", optimized, "", 0);
+    value_expression = di.createExpression();
+
+    if (!module.getModuleFlag("Debug Info Version"))
+    {
+        module.addModuleFlag(Module::Warning, "Debug Info Version", 
+            DEBUG_METADATA_VERSION);
+        module.addModuleFlag(Module::Warning, "Dwarf Version", 4);
+    }
+}
+
+const DILocation* DebugInfo::location()
+{
+    if (scopes.empty() || line < 0) return nullptr;
+    if ((size_t)line >= locations.size()) locations.resize(line + 1);
+    const DILocation*& cached = locations[line];
+    if (!cached) 
+        cached = DILocation::get(module.getContext(), line, 0, scopes.back());
+    return cached;
+}
+
+void DebugInfo::set_line(int new_line)
+{
+    if (new_line == line) return;
+    line = new_line;
+    if (!scopes.empty()) Builder.SetCurrentDebugLocation(location());
+}
+
+DIType* DebugInfo::scalar_type(SymbolType type)
+{
+    if (type <= S_UNDEFINED || type >= S_PROCEDURE) return nullptr;
+    DIType*& cached = scalar_types[type];
+    if (cached) return cached;
+
+    switch (type)
+    {
+    case S_STRING:
+        cached = di.createPointerType(scalar_type(S_CHAR), 
+            module.getDataLayout().getPointerSizeInBits(), 0, None, "string");
+        break;
+    case S_CHAR:
+        cached = di.createBasicType("char", 8, dwarf::DW_ATE_signed_char);
+        break;
+    case S_INTEGER:
+        cached = di.createBasicType("integer", 32, dwarf::DW_ATE_signed);
+        break;
+    case S_FLOAT:
+        cached = di.createBasicType("float", 32, dwarf::DW_ATE_float);
+        break;
+    case S_BOOL:
+        cached = di.createBasicType("bool", 8, dwarf::DW_ATE_boolean);
+        break;
+    default:
+        break;
+    }
+    return cached;
+}
+
+DIType* DebugInfo::type(const SymTableEntry* entry)
+{
+    DIType* element = scalar_type(entry->sym_type);
+    if (!entry->is_arr || element == nullptr) return element;
+
+    // Indexed from the declared lower bound
+    Metadata* range = di.getOrCreateSubrange(entry->lower_b, entry->arr_size);
+    return di.createArrayType(element->getSizeInBits() * entry->arr_size, 0,
+        element, di.getOrCreateArray(range));
+}
+
+void DebugInfo::begin_procedure(Function* F, const std::string& name, 
+    int line, const std::vector<SymTableEntry*>& params)
+{
+    // No return type; OUT results are parameters like the rest
+    std::vector<Metadata*> types = {nullptr};
+    for (SymTableEntry* param : params) types.push_back(type(param));
+    DISubroutineType* signature = di.createSubroutineType(
+        di.getOrCreateTypeArray(types));
+
+    // Nested procedures are only visible in this file
+    bool local = F->hasLocalLinkage();
+#if LLVM_VERSION_MAJOR >= 8
+    DISubprogram* procedure = di.createFunction(file, name, "", file, line, 
+        signature, line, DINode::FlagPrototyped, 
+        DISubprogram::SPFlagDefinition 
+            | (local ? DISubprogram::SPFlagLocalToUnit : DISubprogram::SPFlagZero));
+#else
+    DISubprogram* procedure = di.createFunction(file, name, "", file, line, 
+        signature, local, true, line, DINode::FlagPrototyped);
+#endif
+    F->setSubprogram(procedure);
+
+    scopes.push_back(procedure);
+    locations.clear();
+    this->line = line;
+    Builder.SetCurrentDebugLocation(location());
+}
+
+void DebugInfo::end_procedure()
+{
+    scopes.pop_back();
+    locations.clear();
+    // Back to the enclosing procedure's code (if any)
+    Builder.SetCurrentDebugLocation(location());
+}
+
+void DebugInfo::local_variable(SymTableEntry* entry, int line, unsigned arg)
+{
+    if (scopes.empty()) return;
+    DIType* variable_type = type(entry);
+    if (variable_type == nullptr) return;
+
+    // (kept even if nothing's assigned, so a debugger can list it)
+    if (arg > 0)
+    {
+        entry->debug_variable = di.createParameterVariable(scopes.back(), 
+            entry->id, arg, file, line, variable_type, true);
+    }
+    else
+    {
+        entry->debug_variable = di.createAutoVariable(scopes.back(), 
+            entry->id, file, line, variable_type, true);
+    }
+}
+
+void DebugInfo::set_value(SymTableEntry* entry, Value* value)
+{
+    const DILocation* at = location();
+    if (entry->debug_variable == nullptr || at == nullptr) return;
+
+    BasicBlock* block = Builder.GetInsertBlock();
+    if (Builder.GetInsertPoint() == block->end())
+    {
+        di.insertDbgValueIntrinsic(value, entry->debug_variable, 
+            value_expression, at, block);
+    }
+    else
+    {
+        di.insertDbgValueIntrinsic(value, entry->debug_variable, 
+            value_expression, at, &*Builder.GetInsertPoint());
+    }
+}
+
+void DebugInfo::set_phi_value(SymTableEntry* entry, PHINode* phi)
+{
+    const DILocation* at = location();
+    if (entry->debug_variable == nullptr || at == nullptr) return;
+
+    // After the block's phis
+    BasicBlock* block = phi->getParent();
+    if (Instruction* first = block->getFirstNonPHI())
+    {
+        di.insertDbgValueIntrinsic(phi, entry->debug_variable, 
+            value_expression, at, first);
+    }
+    else
+    {
+        di.insertDbgValueIntrinsic(phi, entry->debug_variable, 
+            value_expression, at, block);
+    }
+}
+
+void DebugInfo::declare(SymTableEntry* entry, Value* storage)
+{
+    const DILocation* at = location();
+    if (entry->debug_variable == nullptr || at == nullptr) return;
+
+    // Right after an alloca (the allocas stay at the start of the 
+    //  entry block), or where a parameter's pointer arrives
+    Instruction* alloca = dyn_cast<Instruction>(storage);
+    BasicBlock* block = alloca ? alloca->getParent() : Builder.GetInsertBlock();
+    Instruction* next = alloca ? alloca->getNextNode() : nullptr;
+    if (!alloca && Builder.GetInsertPoint() != block->end()) 
+        next = &*Builder.GetInsertPoint();
+    if (next)
+    {
+        di.insertDeclare(storage, entry->debug_variable, 
+            value_expression, at, next);
+    }
+    else
+    {
+        di.insertDeclare(storage, entry->debug_variable, 
+            value_expression, at, block);
+    }
+}
+
+void DebugInfo::global_variable(SymTableEntry* entry, GlobalVariable* global, 
+    int line)
+{
+    DIType* variable_type = type(entry);
+    if (variable_type == nullptr) return;
+    global->addDebugInfo(di.createGlobalVariableExpression(unit, entry->id, 
+        entry->id, file, line, variable_type, false));
+}
+
+void DebugInfo::finish()
+{
+    for (Function& F : module)
+    {
+        DISubprogram* procedure = F.getSubprogram();
+        if (procedure && procedure->getUnit() != unit) 
+            procedure->replaceUnit(unit);
+    }
+    NamedMDNode* units = module.getOrInsertNamedMetadata("llvm.dbg.cu");
+    units->clearOperands();
+    units->addOperand(unit);
+
+    di.finalize();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "options.h"
+#include "symboltable.h"
+
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+#include <string>
+#include <vector>
+
+// Debug info for one module (-g): the line each instruction came from 
+//  (DILocations, from the tokens' lines), each procedure 
+//  (DISubprogram) and each variable (DILocalVariable, DIGlobalVariable), 
+//  so the code generator writes DWARF that debuggers and profilers can 
+//  map back to the .src file.
+// Scalar locals are SSA values (see Parser::read_variable), so they're 
+//  described by llvm.dbg.value at each assignment and at each phi that 
+//  merges values; arrays have memory, described once by llvm.dbg.declare.
+class DebugInfo
+{
+public:
+    // filename - the source file, as it was given ("" for source text 
+    //  from the library)
+    DebugInfo(llvm::Module& module, llvm::IRBuilder<>& builder,
+        const std::string& filename, const CompilerOptions& options);
+
+    // What the builder makes from here on came from line
+    void set_line(int line);
+
+    // Code for F, the procedure name declared on line (with params), 
+    //  follows until end_procedure. Nested procedures can be started 
+    //  and ended inside it.
+    void begin_procedure(llvm::Function* F, const std::string& name, 
+        int line, const std::vector<SymTableEntry*>& params);
+    void end_procedure();
+
+    // Describe a local (arg 0) or the arg'th parameter (from 1) of the 
+    //  current procedure, declared on line. Sets entry->debug_variable.
+    void local_variable(SymTableEntry* entry, int line, unsigned arg=0);
+
+    // The variable is value from the builder's insert point on
+    void set_value(SymTableEntry* entry, llvm::Value* value);
+    // The variable is phi from the start of phi's block on
+    void set_phi_value(SymTableEntry* entry, llvm::PHINode* phi);
+    // The variable (an array) is in storage's memory
+    void declare(SymTableEntry* entry, llvm::Value* storage);
+
+    // Describe a global variable declared on line
+    void global_variable(SymTableEntry* entry, llvm::GlobalVariable* global, 
+        int line);
+
+    // Once the module is complete. Procedures linked in from other 
+    //  modules (parsed in parallel, or reused by --watch) have compile 
+    //  units of their own, for the same file; they're moved to this one.
+    void finish();
+
+private:
+    llvm::Module& module;
+    llvm::IRBuilder<>& Builder;
+    llvm::DIBuilder di;
+    llvm::DIFile* file;
+    llvm::DICompileUnit* unit;
+
+    // The procedures being generated, innermost last
+    std::vector<llvm::DISubprogram*> scopes;
+    int line = 0;
+    // The innermost procedure's location for each line (so far)
+    std::vector<const llvm::DILocation*> locations;
+    // The variables' values are the values themselves (made once)
+    llvm::DIExpression* value_expression;
+
+    // type is the variable's element type if it's an array
+    llvm::DIType* type(const SymTableEntry* entry);
+    llvm::DIType* scalar_type(SymbolType type);
+    llvm::DIType* scalar_types[S_PROCEDURE] = {};
+
+    // Where the builder's instructions go now (null before a procedure)
+    const llvm::DILocation* location();
+};
@@ -2,25 +2,93 @@
 
 void ErrHandler::reportError(std::string message)
 {
-    std::cerr << "\033[31mError\033[0m: " <<  message << '\n';
-    errors++;
+    report(true, message, -1);
 }
 
 void ErrHandler::reportError(std::string message, int line_num)
 {
-    std::cerr << "\033[31mError\033[0m (line " << line_num << "): " <<  message << '\n';
-    errors++;
+    report(true, message, line_num);
 }
 
 void ErrHandler::reportWarning(std::string message)
 {
-    std::cerr << "\033[33mWarning\033[0m: " << message << '\n';
-    warnings++;
+    report(false, message, -1);
 }
 
 void ErrHandler::reportWarning(std::string message, int line_num)
 {
-    std::cerr << "\033[33mWarning\033[0m (line " << line_num << "): " << message << '\n';
-    warnings++;
+    report(false, message, line_num);
 }
 
+void ErrHandler::report(bool is_error, std::string message, int line_num)
+{
+    if (muted) return;
+
+    if (is_error) errors++;
+    else warnings++;
+
+    Diagnostic diag = {is_error, message, line_num, nullptr};
+    if (recorder) recorder->held.push_back(diag);
+    if (buffered) held.push_back(diag);
+    else print(diag);
+}
+
+void ErrHandler::print(const Diagnostic& diag)
+{
+    if (diag.is_error) std::cerr << "\033[31mError\033[0m";
+    else std::cerr << "\033[33mWarning\033[0m";
+
+    if (diag.line >= 0) std::cerr << " (line " << diag.line << ")";
+    std::cerr << ": " << diag.message << '\n';
+}
+
+void ErrHandler::set_buffered(bool buffered)
+{
+    this->buffered = buffered;
+}
+
+bool ErrHandler::is_buffered() const
+{
+    return buffered;
+}
+
+void ErrHandler::set_muted(bool muted)
+{
+    this->muted = muted;
+}
+
+void ErrHandler::set_recorder(ErrHandler* recorder)
+{
+    this->recorder = recorder;
+}
+
+void ErrHandler::report_copies(const ErrHandler& other, int line_delta)
+{
+    for (const Diagnostic& diag : other.held)
+    {
+        report(diag.is_error, diag.message, 
+            diag.line >= 0 ? diag.line + line_delta : -1);
+    }
+}
+
+void ErrHandler::defer_to(ErrHandler* other)
+{
+    held.push_back({false, "", -1, other});
+}
+
+void ErrHandler::flush(std::vector<Diagnostic>* into)
+{
+    for (const Diagnostic& diag : held)
+    {
+        if (diag.deferred)
+        {
+            diag.deferred->flush(into);
+            errors += diag.deferred->errors;
+            warnings += diag.deferred->warnings;
+        }
+        else if (into) into->push_back(diag);
+        else print(diag);
+    }
+    held.clear();
+    buffered = false;
+}
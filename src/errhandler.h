@@ -1,6 +1,22 @@
 #pragma once
 #include <string>
 #include <iostream>
+#include <vector>
+
+class ErrHandler;
+
+// A reported error or warning. line is -1 if the message has no line.
+// Held by an ErrHandler in buffered mode until it is flushed.
+struct Diagnostic
+{
+    bool is_error;
+    std::string message;
+    int line;
+
+    // If set, this entry is a placeholder for all of another handler's
+    //  diagnostics (see defer_to)
+    ErrHandler* deferred;
+};
 
 class ErrHandler
 {
@@ -11,5 +27,35 @@ public:
     void reportWarning(std::string message, int line_num);
     int errors = 0;
     int warnings = 0;
-};
 
+    // In buffered mode diagnostics are held instead of printed right away
+    void set_buffered(bool buffered);
+    bool is_buffered() const;
+    // Reserve the current position for another (buffered) handler's 
+    //  diagnostics. They are printed here, and counted here, on flush().
+    //  Lets diagnostics from parts of the source handled elsewhere 
+    //  (e.g. on another thread) come out in source order.
+    void defer_to(ErrHandler* other);
+    // Print held diagnostics (or add them to into, instead) 
+    //  and leave buffered mode
+    void flush(std::vector<Diagnostic>* into=nullptr);
+
+    // While muted, reports are dropped (and not counted)
+    void set_muted(bool muted);
+
+    // While set, everything reported here is also held by recorder 
+    //  (which should be buffered and never flushed)
+    void set_recorder(ErrHandler* recorder);
+    // Report again everything another handler holds, 
+    //  with the lines moved by line_delta
+    void report_copies(const ErrHandler& other, int line_delta);
+
+private:
+    bool buffered = false;
+    bool muted = false;
+    ErrHandler* recorder = nullptr;
+    std::vector<Diagnostic> held;
+
+    void report(bool is_error, std::string message, int line_num);
+    void print(const Diagnostic& diag);
+};
@@ -0,0 +1,366 @@
+#include "evaluator.h"
+
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Intrinsics.h"
+
+using namespace llvm;
+
+// Calls nested deeper than this give up (recursion in the program
+//  is recursion here)
+const int MAX_EVAL_DEPTH = 256;
+
+ConstantEvaluator::ConstantEvaluator(int step_budget)
+    : step_budget(step_budget) {}
+
+bool ConstantEvaluator::evaluate(Function* F, const std::vector<Value*>& args,
+    Constant*& result)
+{
+    if (step_budget <= 0 || F->isDeclaration() || args.size() != F->arg_size())
+        return false;
+
+    // Every argument has to be a value (not an array)
+    Frame frame;
+    std::vector<Constant*> in_args;
+    auto param = F->arg_begin();
+    for (Value* arg : args)
+    {
+        Constant* value = dyn_cast<Constant>(arg);
+        if (value == nullptr || !is_known(value)) return false;
+        frame.values[&*param++] = value;
+        in_args.push_back(value);
+    }
+
+    // The same call always does the same thing
+    auto key = std::make_pair(F, in_args);
+    auto outcome = outcomes.find(key);
+    if (outcome != outcomes.end())
+    {
+        result = outcome->second.second;
+        return outcome->second.first;
+    }
+
+    steps = 0;
+    bool finished = run(F, frame, 0) && returned_known(frame.returned);
+    objects.clear();
+
+    result = finished ? frame.returned : nullptr;
+    outcomes[key] = {finished, result};
+    return finished;
+}
+
+void ConstantEvaluator::forget(Function* F)
+{
+    auto begin = outcomes.lower_bound({F, {}});
+    auto end = begin;
+    while (end != outcomes.end() && end->first.first == F) ++end;
+    outcomes.erase(begin, end);
+}
+
+bool ConstantEvaluator::run(Function* F, Frame& frame, int depth)
+{
+    if (F->isDeclaration() || depth > MAX_EVAL_DEPTH) return false;
+
+    BasicBlock* from = nullptr;
+    BasicBlock* block = &F->getEntryBlock();
+    while (block)
+    {
+        // No terminator means F is still being parsed
+        //  (e.g. a procedure calling itself)
+        Instruction* terminator = block->getTerminator();
+        if (terminator == nullptr) return false;
+        if (!enter_block(block, from, frame)) return false;
+
+        for (Instruction& I : *block)
+        {
+            if (isa<PHINode>(I)) continue;
+            if (++steps > step_budget) return false;
+            if (&I == terminator) break;
+            if (!execute(I, frame, depth)) return false;
+        }
+
+        from = block;
+        if (!branch(terminator, frame, block)) return false;
+    }
+    return true;
+}
+
+bool ConstantEvaluator::enter_block(BasicBlock* block, BasicBlock* from,
+    Frame& frame)
+{
+    // Every phi takes its value from before any of them change
+    std::vector<std::pair<PHINode*, Constant*>> incoming;
+    for (Instruction& I : *block)
+    {
+        PHINode* phi = dyn_cast<PHINode>(&I);
+        if (phi == nullptr) break;
+
+        int k = from ? phi->getBasicBlockIndex(from) : -1;
+        Constant* value;
+        if (k < 0 || !constant(frame, phi->getIncomingValue(k), value))
+            return false;
+        incoming.push_back({phi, value});
+    }
+
+    for (auto& phi : incoming)
+    {
+        frame.values[phi.first] = phi.second;
+    }
+    return true;
+}
+
+bool ConstantEvaluator::branch(Instruction* terminator, Frame& frame,
+    BasicBlock*& next)
+{
+    if (BranchInst* br = dyn_cast<BranchInst>(terminator))
+    {
+        if (br->isUnconditional())
+        {
+            next = br->getSuccessor(0);
+            return true;
+        }
+        Constant* condition;
+        if (!constant(frame, br->getCondition(), condition)) return false;
+        ConstantInt* taken = dyn_cast<ConstantInt>(condition);
+        if (taken == nullptr) return false;
+        next = br->getSuccessor(taken->isOne() ? 0 : 1);
+        return true;
+    }
+    else if (SwitchInst* sw = dyn_cast<SwitchInst>(terminator))
+    {
+        Constant* condition;
+        if (!constant(frame, sw->getCondition(), condition)) return false;
+        ConstantInt* selector = dyn_cast<ConstantInt>(condition);
+        if (selector == nullptr) return false;
+        next = sw->findCaseValue(selector)->getCaseSuccessor();
+        return true;
+    }
+    else if (ReturnInst* ret = dyn_cast<ReturnInst>(terminator))
+    {
+        next = nullptr;
+        if (ret->getReturnValue() == nullptr) return true;
+        return constant(frame, ret->getReturnValue(), frame.returned);
+    }
+    return false;
+}
+
+bool ConstantEvaluator::execute(Instruction& I, Frame& frame, int depth)
+{
+    Constant* result = nullptr;
+
+    if (AllocaInst* alloca = dyn_cast<AllocaInst>(&I))
+    {
+        Object* object = allocate(alloca->getAllocatedType());
+        if (object == nullptr) return false;
+        frame.pointers[&I] = {object, 0};
+        return true;
+    }
+    else if (LoadInst* load = dyn_cast<LoadInst>(&I))
+    {
+        Pointer address;
+        if (!pointer(frame, load->getPointerOperand(), address)) return false;
+        result = address.object->cells[address.index];
+        // Never set (or the whole array)
+        if (result == nullptr || result->getType() != I.getType()) return false;
+    }
+    else if (StoreInst* store = dyn_cast<StoreInst>(&I))
+    {
+        Pointer address;
+        Constant* value;
+        if (!pointer(frame, store->getPointerOperand(), address)
+            || !constant(frame, store->getValueOperand(), value))
+            return false;
+        address.object->cells[address.index] = value;
+        return true;
+    }
+    else if (GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(&I))
+    {
+        // Only array indexing: [0, index] into the start of an array
+        Pointer address;
+        Constant* index;
+        if (gep->getNumIndices() != 2
+            || !isa<ArrayType>(gep->getSourceElementType())
+            || !pointer(frame, gep->getPointerOperand(), address)
+            || address.index != 0)
+            return false;
+        ConstantInt* first = dyn_cast<ConstantInt>(gep->getOperand(1));
+        if (first == nullptr || !first->isZero()) return false;
+        if (!constant(frame, gep->getOperand(2), index)) return false;
+        ConstantInt* offset = dyn_cast<ConstantInt>(index);
+        if (offset == nullptr || offset->isNegative()
+            || offset->getZExtValue() >= address.object->cells.size())
+            return false;
+        frame.pointers[&I] = {address.object, offset->getZExtValue()};
+        return true;
+    }
+    else if (CallInst* call_inst = dyn_cast<CallInst>(&I))
+    {
+        return call(call_inst, frame, depth);
+    }
+    else if (InsertValueInst* insert = dyn_cast<InsertValueInst>(&I))
+    {
+        // Building a struct of results, starting from undef
+        Constant* aggregate = dyn_cast<UndefValue>(insert->getAggregateOperand());
+        Constant* value;
+        if ((aggregate == nullptr 
+                && !constant(frame, insert->getAggregateOperand(), aggregate))
+            || !constant(frame, insert->getInsertedValueOperand(), value))
+            return false;
+        frame.values[&I] = ConstantExpr::getInsertValue(aggregate, value, 
+            insert->getIndices());
+        return true;
+    }
+    else if (ExtractValueInst* extract = dyn_cast<ExtractValueInst>(&I))
+    {
+        Constant* aggregate;
+        if (!constant(frame, extract->getAggregateOperand(), aggregate))
+            return false;
+        result = ConstantExpr::getExtractValue(aggregate, extract->getIndices());
+    }
+    else if (CastInst* cast = dyn_cast<CastInst>(&I))
+    {
+        // Pointer casts are only for lifetime markers
+        Pointer address;
+        if (cast->getType()->isPointerTy())
+        {
+            if (!pointer(frame, cast->getOperand(0), address)) return false;
+            frame.pointers[&I] = address;
+            return true;
+        }
+        Constant* value;
+        if (!constant(frame, cast->getOperand(0), value)) return false;
+        result = ConstantExpr::getCast(cast->getOpcode(), value, I.getType());
+    }
+    else if (BinaryOperator* binary = dyn_cast<BinaryOperator>(&I))
+    {
+        Constant* lhs;
+        Constant* rhs;
+        if (!constant(frame, binary->getOperand(0), lhs)
+            || !constant(frame, binary->getOperand(1), rhs))
+            return false;
+
+        // Undefined at runtime; leave it to the program
+        unsigned opcode = binary->getOpcode();
+        if (opcode == Instruction::SDiv || opcode == Instruction::SRem
+            || opcode == Instruction::UDiv || opcode == Instruction::URem)
+        {
+            ConstantInt* divisor = dyn_cast<ConstantInt>(rhs);
+            ConstantInt* dividend = dyn_cast<ConstantInt>(lhs);
+            if (divisor == nullptr || dividend == nullptr || divisor->isZero())
+                return false;
+            if ((opcode == Instruction::SDiv || opcode == Instruction::SRem)
+                && divisor->isMinusOne() && dividend->isMinValue(true))
+                return false;
+        }
+        result = ConstantExpr::get(opcode, lhs, rhs);
+    }
+    else if (CmpInst* cmp = dyn_cast<CmpInst>(&I))
+    {
+        Constant* lhs;
+        Constant* rhs;
+        if (!constant(frame, cmp->getOperand(0), lhs)
+            || !constant(frame, cmp->getOperand(1), rhs))
+            return false;
+        result = ConstantExpr::getCompare(cmp->getPredicate(), lhs, rhs);
+    }
+
+    // Anything else (or a result llvm couldn't fold)
+    if (result == nullptr || !is_known(result)) return false;
+    frame.values[&I] = result;
+    return true;
+}
+
+bool ConstantEvaluator::call(CallInst* call, Frame& frame, int depth)
+{
+    Function* callee = call->getCalledFunction();
+    if (callee == nullptr) return false;
+
+    // Lifetime markers and debug info (-g) don't change anything
+    Intrinsic::ID intrinsic = callee->getIntrinsicID();
+    if (intrinsic == Intrinsic::lifetime_start
+        || intrinsic == Intrinsic::lifetime_end
+        || isa<DbgInfoIntrinsic>(call))
+        return true;
+
+    // Builtins, or procedures parsed somewhere else
+    if (callee->isDeclaration()) return false;
+
+    Frame inner;
+    unsigned k = 0;
+    for (Argument& parameter : callee->args())
+    {
+        Value* arg = call->getArgOperand(k++);
+        if (parameter.getType()->isPointerTy())
+        {
+            Pointer address;
+            if (!pointer(frame, arg, address)) return false;
+            inner.pointers[&parameter] = address;
+        }
+        else
+        {
+            Constant* value;
+            if (!constant(frame, arg, value)) return false;
+            inner.values[&parameter] = value;
+        }
+    }
+    if (!run(callee, inner, depth + 1)) return false;
+    if (inner.returned) frame.values[call] = inner.returned;
+    return true;
+}
+
+ConstantEvaluator::Object* ConstantEvaluator::allocate(Type* type)
+{
+    uint64_t count = 1;
+    if (ArrayType* array = dyn_cast<ArrayType>(type))
+    {
+        count = array->getNumElements();
+        type = array->getElementType();
+    }
+    if (!type->isIntegerTy() && !type->isFloatTy()) return nullptr;
+
+    // Setting up the cells counts as work too
+    if (steps >= step_budget || count > (uint64_t)(step_budget - steps)) 
+        return nullptr;
+    steps += count;
+
+    objects.push_back(std::unique_ptr<Object>(new Object()));
+    objects.back()->cells.assign(count, nullptr);
+    return objects.back().get();
+}
+
+bool ConstantEvaluator::constant(Frame& frame, Value* value, Constant*& result)
+{
+    if (Constant* known = dyn_cast<Constant>(value))
+    {
+        result = known;
+        return is_known(known);
+    }
+    auto it = frame.values.find(value);
+    if (it == frame.values.end()) return false;
+    result = it->second;
+    return true;
+}
+
+bool ConstantEvaluator::pointer(Frame& frame, Value* value, Pointer& result)
+{
+    auto it = frame.pointers.find(value);
+    if (it == frame.pointers.end()) return false;
+    result = it->second;
+    return true;
+}
+
+bool ConstantEvaluator::is_known(Constant* value)
+{
+    return isa<ConstantInt>(value) || isa<ConstantFP>(value);
+}
+
+bool ConstantEvaluator::returned_known(Constant* value)
+{
+    if (value == nullptr || !value->getType()->isStructTy()) 
+        return value == nullptr || is_known(value);
+    for (unsigned k = 0; k < value->getType()->getStructNumElements(); k++)
+    {
+        if (!is_known(value->getAggregateElement(k))) return false;
+    }
+    return true;
+}
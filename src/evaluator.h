@@ -0,0 +1,87 @@
+#pragma once
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Value.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Runs calls to finished procedures at compile time, by interpreting
+//  their IR, when every argument passed in (IN and INOUT) is a constant.
+// Only procedures that don't touch anything outside of their own
+//  locals and parameters can be run: a call to a builtin (GET*/PUT*),
+//  a global variable, a string, array parameters, or anything else the
+//  interpreter doesn't know gives up on the call, as does going over the
+//  step budget or anything that would be undefined at runtime (dividing
+//  by zero, indexing outside of an array, reading a variable that was
+//  never set, or returning an OUT parameter that was never set).
+class ConstantEvaluator
+{
+public:
+    // step_budget - instructions a call may run before it's given up on
+    //  (0 never runs anything)
+    ConstantEvaluator(int step_budget);
+
+    // Run F with args (as they would be passed to the call).
+    // On success, result is what F returned: its OUT and INOUT values
+    //  (null if it returns nothing).
+    bool evaluate(llvm::Function* F, const std::vector<llvm::Value*>& args,
+        llvm::Constant*& result);
+
+    // Drop what's remembered about calls to F (it's about to be freed)
+    void forget(llvm::Function* F);
+
+private:
+    // A local (alloca) or an argument's memory, one cell per element
+    struct Object
+    {
+        std::vector<llvm::Constant*> cells;
+    };
+    struct Pointer
+    {
+        Object* object;
+        uint64_t index;
+    };
+    // The values of one call's instructions and arguments, 
+    //  and what it returned
+    struct Frame
+    {
+        std::unordered_map<const llvm::Value*, llvm::Constant*> values;
+        std::unordered_map<const llvm::Value*, Pointer> pointers;
+        llvm::Constant* returned = nullptr;
+    };
+
+    int step_budget;
+    int steps = 0;
+    std::vector<std::unique_ptr<Object>> objects;
+
+    // Earlier calls' outcomes: F and its arguments,
+    //  to whether it could be run and its result
+    std::map<std::pair<llvm::Function*, std::vector<llvm::Constant*>>,
+        std::pair<bool, llvm::Constant*>> outcomes;
+
+    bool run(llvm::Function* F, Frame& frame, int depth);
+    bool execute(llvm::Instruction& I, Frame& frame, int depth);
+    bool call(llvm::CallInst* call, Frame& frame, int depth);
+    // The next block, or null when F returns
+    bool branch(llvm::Instruction* terminator, Frame& frame,
+        llvm::BasicBlock*& next);
+    bool enter_block(llvm::BasicBlock* block, llvm::BasicBlock* from,
+        Frame& frame);
+
+    Object* allocate(llvm::Type* type);
+    bool constant(Frame& frame, llvm::Value* value, llvm::Constant*& result);
+    bool pointer(Frame& frame, llvm::Value* value, Pointer& result);
+    // A constant the interpreter can compute with (not undef, an
+    //  expression, or a pointer)
+    static bool is_known(llvm::Constant* value);
+    // Nothing, or a known value (or struct of them)
+    static bool returned_known(llvm::Constant* value);
+};
@@ -0,0 +1,190 @@
+#include "incremental.h"
+
+#include "llvm/IR/GlobalVariable.h"
+
+using namespace llvm;
+
+static void combine_hash(size_t& seed, size_t value)
+{
+    seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+ProcedureCache::ProcedureCache() : context(new LLVMContext()) {}
+
+LLVMContext& ProcedureCache::get_context()
+{
+    return *context;
+}
+
+size_t ProcedureCache::signature(const SymTableEntry* entry)
+{
+    size_t seed = 1;
+    combine_hash(seed, entry->type);
+    combine_hash(seed, entry->sym_type);
+    combine_hash(seed, entry->is_arr);
+    combine_hash(seed, entry->arr_size);
+    combine_hash(seed, entry->lower_b);
+    combine_hash(seed, entry->upper_b);
+    combine_hash(seed, entry->param_type);
+    for (const SymTableEntry* param : entry->parameters)
+    {
+        combine_hash(seed, signature(param));
+    }
+    return seed;
+}
+
+size_t ProcedureCache::signature(const std::string& id, SymbolTableManager& symbols)
+{
+    SymTableEntry* entry = symbols.find_global(id);
+    if (entry == nullptr) return 0;
+    return signature(entry);
+}
+
+void ProcedureCache::start_compile()
+{
+    hits = 0;
+    misses = 0;
+}
+
+CachedProcedure* ProcedureCache::find(const std::string& text, 
+    SymbolTableManager& symbols, int line)
+{
+    auto it = entries.find(text);
+    // Identical procedures can't share one entry's code
+    if (it == entries.end() || it->second.used 
+        || (line && it->second.line != line)) 
+    {
+        misses++;
+        return nullptr;
+    }
+
+    for (auto& dependency : it->second.dependencies)
+    {
+        if (signature(dependency.first, symbols) != dependency.second)
+        {
+            misses++;
+            return nullptr;
+        }
+    }
+
+    hits++;
+    it->second.used = true;
+    return &it->second;
+}
+
+Function* ProcedureCache::reuse(CachedProcedure* cached, Function* declaration, 
+    Module& module)
+{
+    // The procedure's own function is always first
+    Function* F = cast<Function>(cached->globals[0]);
+    for (GlobalValue* global : cached->globals)
+    {
+        // Names that are taken in module get a new one (only private and 
+        //  internal ones can be, apart from F's)
+        global->removeFromParent();
+        if (Function* function = dyn_cast<Function>(global))
+            module.getFunctionList().push_back(function);
+        else
+            module.getGlobalList().push_back(cast<GlobalVariable>(global));
+    }
+
+    std::string name = declaration->getName().str();
+    declaration->replaceAllUsesWith(F);
+    declaration->eraseFromParent();
+    F->setName(name);
+    return F;
+}
+
+bool ProcedureCache::store(const std::string& text, CachedProcedure procedure, 
+    const std::vector<std::string>& lookups, SymbolTableManager& symbols)
+{
+    // Builtins are declared by whichever procedure calls them first; 
+    //  finish_parse declares them again if nothing else does
+    std::vector<GlobalValue*> globals;
+    for (size_t k = 0; k < procedure.globals.size(); k++)
+    {
+        GlobalValue* global = procedure.globals[k];
+        if (k > 0 && global->isDeclaration()) continue;
+        // Reusing it wouldn't declare the symbol again
+        if (k > 0 && !global->hasLocalLinkage()) return false;
+        globals.push_back(global);
+    }
+    procedure.globals = std::move(globals);
+
+    std::unordered_map<std::string, size_t> dependencies;
+    for (const std::string& id : lookups)
+    {
+        dependencies.insert({id, signature(id, symbols)});
+    }
+    procedure.dependencies.assign(dependencies.begin(), dependencies.end());
+    procedure.used = true;
+
+    entries[text] = std::move(procedure);
+    return true;
+}
+
+void ProcedureCache::finish_parse(Module& module)
+{
+    if (previous)
+    {
+        // What's left of the last module is dead, except that reused code 
+        //  still refers to its global variables, builtins and other 
+        //  procedures; use module's instead
+        for (Function& F : *previous)
+        {
+            F.deleteBody();
+        }
+
+        std::vector<GlobalValue*> referenced;
+        for (Function& F : *previous)
+        {
+            F.removeDeadConstantUsers();
+            if (!F.use_empty()) referenced.push_back(&F);
+        }
+        for (GlobalVariable& GV : previous->globals())
+        {
+            GV.removeDeadConstantUsers();
+            if (!GV.use_empty()) referenced.push_back(&GV);
+        }
+
+        for (GlobalValue* old : referenced)
+        {
+            GlobalValue* replacement = module.getNamedValue(old->getName());
+            if (replacement == nullptr || replacement->getType() != old->getType())
+            {
+                // A builtin only reused code calls, or else the 
+                //  dependencies missed something (a declaration at 
+                //  least keeps the module valid)
+                if (Function* F = dyn_cast<Function>(old))
+                {
+                    replacement = Function::Create(F->getFunctionType(), 
+                        GlobalValue::ExternalLinkage, old->getName(), &module);
+                }
+                else
+                {
+                    replacement = new GlobalVariable(module, old->getValueType(), 
+                        false, GlobalValue::ExternalLinkage, nullptr, old->getName());
+                }
+            }
+            old->replaceAllUsesWith(replacement);
+        }
+        previous.reset();
+    }
+
+    // Anything not reused was in the last module
+    for (auto it = entries.begin(); it != entries.end(); )
+    {
+        if (!it->second.used)
+        {
+            it = entries.erase(it);
+            continue;
+        }
+        it->second.used = false;
+        ++it;
+    }
+}
+
+void ProcedureCache::keep_module(std::unique_ptr<Module> module)
+{
+    previous = std::move(module);
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include "errhandler.h"
+#include "symboltable.h"
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A top-level procedure from an earlier compile
+struct CachedProcedure
+{
+    // First line of the procedure when it was parsed
+    //  (its diagnostics are moved if it's now somewhere else)
+    int line = 0;
+
+    // Each global symbol the procedure looked up, and the signature 
+    //  it had then (0 if it wasn't defined)
+    std::vector<std::pair<std::string, size_t>> dependencies;
+
+    // What parsing the procedure added to the module: its function, 
+    //  its nested procedures' functions and its string constants
+    std::vector<llvm::GlobalValue*> globals;
+
+    // Everything reported while parsing it (held, never flushed)
+    ErrHandler diagnostics;
+
+    // Whether the current compile has used it
+    bool used = false;
+};
+
+// Keeps the top-level procedures of a file between compiles (for --watch) 
+//  so that only the ones that changed are parsed again.
+// A procedure is reused if its source text is the same and none of the 
+//  global symbols it looked up were added, removed or changed type.
+//  Its code is moved out of the last compile's module, not copied, so 
+//  every compile using the cache has to use the cache's LLVMContext.
+class ProcedureCache
+{
+public:
+    ProcedureCache();
+
+    llvm::LLVMContext& get_context();
+
+    void start_compile();
+
+    // The cached procedure with this source text, if it can be reused.
+    //  line - where the procedure is now, if it has to be where it was 
+    //  (its code has line numbers with -g); 0 if it can move.
+    CachedProcedure* find(const std::string& text, SymbolTableManager& symbols,
+        int line=0);
+
+    // Move a cached procedure's code into module, in place of its 
+    //  declaration there. Returns the procedure's function.
+    llvm::Function* reuse(CachedProcedure* cached, llvm::Function* declaration, 
+        llvm::Module& module);
+
+    // Cache a procedure that was just parsed, given the global symbols it 
+    //  looked up and what it added to the module. Returns false if it 
+    //  can't be cached (it declared global symbols of its own).
+    bool store(const std::string& text, CachedProcedure procedure, 
+        const std::vector<std::string>& lookups, SymbolTableManager& symbols);
+
+    // Once module is complete: point the reused code's references to the 
+    //  last compile's globals at module's, and drop the last module 
+    //  (along with the procedures this compile didn't use).
+    void finish_parse(llvm::Module& module);
+
+    // Keep the module that was compiled, to reuse code from next time
+    void keep_module(std::unique_ptr<llvm::Module> module);
+
+    // Procedures reused / parsed in the current compile
+    int hits = 0;
+    int misses = 0;
+
+private:
+    // Declared before previous so it's destroyed after it
+    std::unique_ptr<llvm::LLVMContext> context;
+    std::unique_ptr<llvm::Module> previous;
+
+    // Keyed by the procedure's source text
+    std::unordered_map<std::string, CachedProcedure> entries;
+
+    // Hash of the parts of a symbol that code using it depends on
+    static size_t signature(const SymTableEntry* entry);
+    static size_t signature(const std::string& id, SymbolTableManager& symbols);
+};
@@ -0,0 +1,144 @@
+#include "jit.h"
+#include "llvm_helper.h"
+#include "optimizer.h"
+#include "runtime.h"
+
+#include "llvm/Config/llvm-config.h"
+
+#if LLVM_VERSION_MAJOR >= 11
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include <cstdio>
+#include <mutex>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// How hard the code generator works for each -O level
+static CodeGenOpt::Level codegen_level(char opt_level)
+{
+    switch (opt_level)
+    {
+    case '0': return CodeGenOpt::None;
+    case '1': return CodeGenOpt::Less;
+    case '3': return CodeGenOpt::Aggressive;
+    default: return CodeGenOpt::Default;
+    }
+}
+
+// error, from an llvm Error (if there was one)
+static bool failed(Error err, std::string& error)
+{
+    if (!err) return false;
+    error = toString(std::move(err));
+    return true;
+}
+
+int run_module(std::unique_ptr<LLVMContext> context,
+    std::unique_ptr<Module> module, const CompilerOptions& options,
+    std::string& error)
+{
+    static std::once_flag initialized;
+    std::call_once(initialized, []
+    {
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+        InitializeNativeTargetAsmParser();
+    });
+
+    Expected<JITTargetMachineBuilder> builder
+        = JITTargetMachineBuilder::detectHost();
+    if (failed(builder.takeError(), error)) return -1;
+    builder->setCodeGenOptLevel(codegen_level(options.opt_level));
+    // The host's CPU and features, unless others are given (-mattr's 
+    //  are added to the host's)
+    if (!options.cpu.empty())
+    {
+        builder->setCPU(target_cpu(options));
+        builder->setFeatures(target_features(options));
+    }
+    else if (!options.features.empty())
+    {
+        builder->addFeatures({options.features});
+    }
+
+    // Optimized for the same machine the JIT compiles for
+    Expected<std::unique_ptr<TargetMachine>> machine
+        = builder->createTargetMachine();
+    if (failed(machine.takeError(), error)) return -1;
+    module->setDataLayout((*machine)->createDataLayout());
+    module->setTargetTriple((*machine)->getTargetTriple().str());
+    if (!options.cpu.empty() || !options.features.empty())
+    {
+        for (Function& F : *module)
+        {
+            if (!F.isDeclaration()) set_target_attributes(F, 
+                builder->getCPU(), builder->getFeatures().getString());
+        }
+    }
+    if (!optimize_module(*module, **machine, options, error)) return -1;
+
+    Expected<std::unique_ptr<LLJIT>> jit = LLJITBuilder()
+        .setJITTargetMachineBuilder(std::move(*builder)).create();
+    if (failed(jit.takeError(), error)) return -1;
+    JITDylib& program = (*jit)->getMainJITDylib();
+
+    // The runtime, then anything else (e.g. memcpy) from this process
+    SymbolMap runtime;
+#define BUILTIN(name, sym_type, param_type, c_type) \
+    runtime[(*jit)->mangleAndIntern(#name)] = JITEvaluatedSymbol( \
+        pointerToJITTargetAddress(&name), JITSymbolFlags::Exported);
+#include "builtins.def"
+    runtime[(*jit)->mangleAndIntern("MEMOIZE_REGISTER")] = JITEvaluatedSymbol(
+        pointerToJITTargetAddress(&MEMOIZE_REGISTER), JITSymbolFlags::Exported);
+    runtime[(*jit)->mangleAndIntern("CPU_LEVEL")] = JITEvaluatedSymbol(
+        pointerToJITTargetAddress(&CPU_LEVEL), JITSymbolFlags::Exported);
+    if (failed(program.define(absoluteSymbols(std::move(runtime))), error))
+        return -1;
+    auto process = DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        (*jit)->getDataLayout().getGlobalPrefix());
+    if (failed(process.takeError(), error)) return -1;
+    program.addGenerator(std::move(*process));
+
+    if (failed((*jit)->addIRModule(
+        ThreadSafeModule(std::move(module), std::move(context))), error))
+        return -1;
+
+    // Compiled here, on the first lookup
+    auto main = (*jit)->lookup("main");
+    if (failed(main.takeError(), error)) return -1;
+#if LLVM_VERSION_MAJOR >= 15
+    int (*program_main)() = main->toPtr<int (*)()>();
+#else
+    int (*program_main)() = jitTargetAddressToFunction<int (*)()>(
+        main->getAddress());
+#endif
+
+    int result = program_main();
+    // (before anything the compiler prints after it)
+    std::fflush(stdout);
+
+    // Kept until the compiler exits, like a linked program's code: what 
+    //  the program registered with atexit (e.g. MEMOIZE_REGISTER's 
+    //  stats, which point at its constants) runs then
+    jit->release();
+    return result;
+}
+
+#else
+
+int run_module(std::unique_ptr<llvm::LLVMContext> context,
+    std::unique_ptr<llvm::Module> module, const CompilerOptions& options,
+    std::string& error)
+{
+    error = "--run needs llvm 11 or later (LLJIT)";
+    return -1;
+}
+
+#endif
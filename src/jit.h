@@ -0,0 +1,20 @@
+#pragma once
+
+#include "options.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <memory>
+#include <string>
+
+// Compile a program's module in this process with ORC's LLJIT and run
+//  its main (--run), for the host's CPU unless the options give one. 
+//  The builtins (GET*, PUT*), MEMOIZE_REGISTER and CPU_LEVEL are the 
+//  runtime's, linked into the compiler. The options' passes are run 
+//  first, and the -O level also sets how hard the JIT's code generator 
+//  works. Returns main's result, or -1 with error set if the program
+//  couldn't be compiled (e.g. before llvm 11, which has no LLJIT).
+int run_module(std::unique_ptr<llvm::LLVMContext> context,
+    std::unique_ptr<llvm::Module> module, const CompilerOptions& options,
+    std::string& error);
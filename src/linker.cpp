@@ -0,0 +1,224 @@
+#include "linker.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#ifdef USE_LLD
+#if LLVM_VERSION_MAJOR >= 14
+#include "lld/Common/CommonLinkerContext.h"
+#include "lld/Common/Driver.h"
+#elif LLVM_VERSION_MAJOR >= 7
+#include "lld/Common/Driver.h"
+#else
+#include "lld/Driver/Driver.h"
+#endif
+#endif
+
+#include <cstdlib>
+
+using namespace llvm;
+
+// Only its address is used, to find the executable
+static int anchor;
+
+std::string default_runtime_path(const char* argv0)
+{
+    std::string exe = sys::fs::getMainExecutable(argv0, &anchor);
+    SmallString<256> path(sys::path::parent_path(exe));
+    sys::path::append(path, "runtime.o");
+    return path.str().str();
+}
+
+// The first of dirs with file in it ("" if none do)
+static std::string find_dir(const std::vector<std::string>& dirs,
+    const std::string& file)
+{
+    for (const std::string& dir : dirs)
+    {
+        if (sys::fs::exists(dir + "/" + file)) return dir;
+    }
+    return "";
+}
+
+// gcc's directory for the newest version that targets arch
+//  (/usr/lib/gcc/<triple>/<version>, which has crtbeginS.o and libgcc)
+static std::string find_gcc_dir(StringRef arch)
+{
+    std::string best;
+    int best_version = -1;
+    std::error_code EC;
+    for (sys::fs::directory_iterator triple("/usr/lib/gcc", EC), end;
+        triple != end && !EC; triple.increment(EC))
+    {
+        if (!sys::path::filename(triple->path()).startswith(arch)) continue;
+
+        std::error_code version_EC;
+        for (sys::fs::directory_iterator dir(triple->path(), version_EC);
+            dir != end && !version_EC; dir.increment(version_EC))
+        {
+            std::string version = sys::path::filename(dir->path()).str();
+            int major = std::atoi(version.c_str());
+            if (major > best_version
+                && sys::fs::exists(dir->path() + "/crtbeginS.o"))
+            {
+                best = dir->path();
+                best_version = major;
+            }
+        }
+    }
+    return best;
+}
+
+std::vector<std::string> elf_link_args(const std::vector<std::string>& objects,
+    const std::string& output, std::string& error)
+{
+    Triple triple(sys::getDefaultTargetTriple());
+    std::string emulation;
+    std::string loader;
+    std::string multiarch;
+    switch (triple.getArch())
+    {
+    case Triple::x86_64:
+        emulation = "elf_x86_64";
+        loader = "/lib64/ld-linux-x86-64.so.2";
+        multiarch = "x86_64-linux-gnu";
+        break;
+    case Triple::aarch64:
+        emulation = "aarch64linux";
+        loader = "/lib/ld-linux-aarch64.so.1";
+        multiarch = "aarch64-linux-gnu";
+        break;
+    default:
+        break;
+    }
+    if (!triple.isOSLinux() || emulation.empty())
+    {
+        error = "Can't link programs for " + triple.str() + " (use -c)";
+        return {};
+    }
+
+    // The C startup files and libc
+    std::string crt_dir = find_dir(
+        {"/usr/lib/" + multiarch, "/usr/lib64", "/usr/lib"}, "Scrt1.o");
+    std::string gcc_dir = find_gcc_dir(triple.getArchName());
+    if (crt_dir.empty() || gcc_dir.empty())
+    {
+        error = "Couldn't find the C startup files (Scrt1.o, crtbeginS.o) "
+            "to link with (use -c)";
+        return {};
+    }
+
+    std::vector<std::string> args = {
+        "-pie", "--eh-frame-hdr", "-m", emulation,
+        "-dynamic-linker", loader, "-o", output,
+        crt_dir + "/Scrt1.o", crt_dir + "/crti.o", gcc_dir + "/crtbeginS.o",
+        "-L" + gcc_dir, "-L" + crt_dir, "-L/lib/" + multiarch, "-L/usr/lib"
+    };
+    args.insert(args.end(), objects.begin(), objects.end());
+    args.insert(args.end(), {
+        "-lc", "-lgcc", "--as-needed", "-lgcc_s", "--no-as-needed",
+        gcc_dir + "/crtendS.o", crt_dir + "/crtn.o"
+    });
+    return args;
+}
+
+#ifdef USE_LLD
+
+// Run lld with args (after the program name)
+static bool run_lld(const std::vector<std::string>& args,
+    const std::string& output, std::string& error)
+{
+    std::vector<const char*> argv = {"ld.lld"};
+    for (const std::string& arg : args) argv.push_back(arg.c_str());
+
+    // lld's messages are the error (it doesn't print anything otherwise)
+    std::string messages;
+    raw_string_ostream diagnostics(messages);
+#if LLVM_VERSION_MAJOR >= 14
+    bool linked = lld::elf::link(argv, diagnostics, diagnostics, false, false);
+    lld::CommonLinkerContext::destroy();
+#elif LLVM_VERSION_MAJOR >= 10
+    bool linked = lld::elf::link(argv, false, diagnostics, diagnostics);
+#else
+    bool linked = lld::elf::link(argv, false, diagnostics);
+#endif
+    if (!linked) error = "Linking " + output + " failed:\n" + diagnostics.str();
+    return linked;
+}
+
+bool link_program(const std::vector<std::string>& objects,
+    const std::string& output, std::string& error)
+{
+    std::vector<std::string> args = elf_link_args(objects, output, error);
+    if (args.empty()) return false;
+    return run_lld(args, output, error);
+}
+
+bool link_objects(const std::vector<std::string>& objects,
+    const std::string& output, std::string& error)
+{
+    std::vector<std::string> args = {"-r", "-o", output};
+    args.insert(args.end(), objects.begin(), objects.end());
+    return run_lld(args, output, error);
+}
+
+#else
+
+// Run cc with args (after the program name)
+static bool run_cc(const std::vector<std::string>& args,
+    const std::string& output, std::string& error)
+{
+    ErrorOr<std::string> cc = sys::findProgramByName("cc");
+    if (!cc)
+    {
+        error = "Couldn't find cc to link " + output
+            + " with (install lld's libraries and rebuild, or use -c)";
+        return false;
+    }
+
+    std::vector<std::string> argv_strings = {"cc"};
+    argv_strings.insert(argv_strings.end(), args.begin(), args.end());
+
+    std::string message;
+#if LLVM_VERSION_MAJOR >= 7
+    std::vector<StringRef> argv(argv_strings.begin(), argv_strings.end());
+    int status = sys::ExecuteAndWait(*cc, argv, None, {}, 0, 0, &message);
+#else
+    std::vector<const char*> argv;
+    for (const std::string& arg : argv_strings) argv.push_back(arg.c_str());
+    argv.push_back(nullptr);
+    int status = sys::ExecuteAndWait(*cc, argv.data(), nullptr, nullptr,
+        0, 0, &message);
+#endif
+    if (status != 0)
+    {
+        error = "Linking " + output + " failed"
+            + (message.empty() ? "" : ": " + message);
+        return false;
+    }
+    return true;
+}
+
+bool link_program(const std::vector<std::string>& objects,
+    const std::string& output, std::string& error)
+{
+    std::vector<std::string> args = {"-o", output};
+    args.insert(args.end(), objects.begin(), objects.end());
+    return run_cc(args, output, error);
+}
+
+bool link_objects(const std::vector<std::string>& objects,
+    const std::string& output, std::string& error)
+{
+    std::vector<std::string> args = {"-r", "-nostdlib", "-o", output};
+    args.insert(args.end(), objects.begin(), objects.end());
+    return run_cc(args, output, error);
+}
+
+#endif
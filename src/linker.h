@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Where the precompiled runtime (runtime.c, built by make as runtime.o)
+//  is expected by default: next to the compiler's executable
+std::string default_runtime_path(const char* argv0);
+
+// The command line (after the program name) for linking objects into a
+//  position independent executable with an ELF linker, for the machine
+//  we're running on: the C startup files and libc are found where gcc
+//  installs them. Empty, with error set, if they can't be found.
+std::vector<std::string> elf_link_args(const std::vector<std::string>& objects,
+    const std::string& output, std::string& error);
+
+// Link objects (the program's and the runtime) into the executable output.
+//  Built with USE_LLD (make does where lld's libraries are installed), 
+//  it's done in this process by lld; otherwise the system's cc is run. 
+//  False, with error set, if it failed.
+bool link_program(const std::vector<std::string>& objects,
+    const std::string& output, std::string& error);
+
+// Link objects into one relocatable object, output (ld -r), by lld or 
+//  cc like link_program. False, with error set, if it failed.
+bool link_objects(const std::vector<std::string>& objects,
+    const std::string& output, std::string& error);
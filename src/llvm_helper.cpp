@@ -1,111 +1,249 @@
 #include "llvm_helper.h"
+#include "codegen.h"
+#include "linker.h"
+#include "optimizer.h"
 
-int compile_to_file(std::unique_ptr<llvm::Module> TheModule, std::string filename)
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+void write_bitcode(const llvm::Module& module, llvm::raw_ostream& out)
 {
-    // Applies only to this scope
-    using namespace llvm;
-    using namespace llvm::sys;
+#if LLVM_VERSION_MAJOR >= 7
+    llvm::WriteBitcodeToFile(module, out);
+#else
+    llvm::WriteBitcodeToFile(&module, out);
+#endif
+    out.flush();
+}
 
-    // Initialize the target registry etc.
-    InitializeAllTargetInfos();
-    InitializeAllTargets();
-    InitializeAllTargetMCs();
-    InitializeAllAsmParsers();
-    InitializeAllAsmPrinters();
+// Initialize the target registry etc.
+static void initialize_targets()
+{
+    using namespace llvm;
 
-    auto TargetTriple = sys::getDefaultTargetTriple();
-    TheModule->setTargetTriple(TargetTriple);
+    static std::once_flag initialized;
+    std::call_once(initialized, []
+    {
+        InitializeAllTargetInfos();
+        InitializeAllTargets();
+        InitializeAllTargetMCs();
+        InitializeAllAsmParsers();
+        InitializeAllAsmPrinters();
+    });
+}
 
-    std::string Error;
-    auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
+std::string target_cpu(const CompilerOptions& options)
+{
+    if (options.cpu.empty()) return "generic";
+    if (options.cpu == "native") return llvm::sys::getHostCPUName().str();
+    return options.cpu;
+}
 
-    // Print an error and exit if we couldn't find the requested target.
-    // This generally occurs if we've forgotten to initialise the
-    // TargetRegistry or we have a bogus target triple.
-    if (!Target) {
-        errs() << Error;
-        return 1;
+std::string target_features(const CompilerOptions& options)
+{
+    std::vector<std::string> features;
+    llvm::StringMap<bool> host;
+    if (options.cpu == "native" && llvm::sys::getHostCPUFeatures(host))
+    {
+        for (auto& feature : host)
+        {
+            features.push_back((feature.second ? "+" : "-") 
+                + feature.first().str());
+        }
+        // (StringMap's order changes from run to run)
+        std::sort(features.begin(), features.end());
     }
+    // Later ones win
+    if (!options.features.empty()) features.push_back(options.features);
+
+    std::string list;
+    for (const std::string& feature : features)
+    {
+        if (!list.empty()) list += ",";
+        list += feature;
+    }
+    return list;
+}
 
-    auto CPU = "generic";
-    auto Features = "";
+void set_target_attributes(llvm::Function& F, const std::string& cpu, 
+    const std::string& features)
+{
+    if (cpu != "generic") F.addFnAttr("target-cpu", cpu);
+    if (!features.empty()) F.addFnAttr("target-features", features);
+}
 
-    TargetOptions opt;
-    auto RM = Optional<Reloc::Model>();
-    auto TheTargetMachine =
-        Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+bool check_target(const CompilerOptions& options, std::string& error)
+{
+    using namespace llvm;
 
-    TheModule->setDataLayout(TheTargetMachine->createDataLayout());
+    initialize_targets();
+    std::string triple = sys::getDefaultTargetTriple();
+    const Target* target = TargetRegistry::lookupTarget(triple, error);
+    if (!target) return false;
+
+    std::string cpu = target_cpu(options);
+    std::unique_ptr<MCSubtargetInfo> subtarget(
+        target->createMCSubtargetInfo(triple, "", ""));
+#if LLVM_VERSION_MAJOR >= 7
+    if (cpu != "generic" && !subtarget->isCPUStringValid(cpu))
+    {
+        error = "Unknown CPU for " + triple + ": " + cpu;
+        return false;
+    }
+#endif
+    return true;
+}
 
+std::unique_ptr<llvm::TargetMachine> create_target_machine(
+    const CompilerOptions& options, std::string& error)
+{
+    // Applies only to this scope
+    using namespace llvm;
+    using namespace llvm::sys;
 
-    std::error_code EC;
-    raw_fd_ostream dest(filename, EC, sys::fs::F_None);
+    initialize_targets();
 
-    TheModule->print(dest, nullptr);
+    auto TargetTriple = sys::getDefaultTargetTriple();
+    auto Target = TargetRegistry::lookupTarget(TargetTriple, error);
 
-    dest.flush();
+    // This generally occurs if we've forgotten to initialise the
+    // TargetRegistry or we have a bogus target triple.
+    if (!Target) return nullptr;
 
-    return 0;
+    std::string CPU = target_cpu(options);
+    std::string Features = target_features(options);
 
+    // Position independent, so the object links into a PIE
+    TargetOptions opt;
+    auto RM = Optional<Reloc::Model>(Reloc::PIC_);
+    return std::unique_ptr<TargetMachine>(
+        Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM));
+}
 
-    // Don't compile to machine code becuase linking to runtime 
-    //  only works with .ll files for some reason
+std::unique_ptr<llvm::TargetMachine> host_target(llvm::Module& TheModule, 
+    const CompilerOptions& options, std::string& error)
+{
+    std::unique_ptr<llvm::TargetMachine> TheTargetMachine 
+        = create_target_machine(options, error);
+    if (!TheTargetMachine) return nullptr;
+
+    TheModule.setTargetTriple(TheTargetMachine->getTargetTriple().str());
+    TheModule.setDataLayout(TheTargetMachine->createDataLayout());
+    std::string CPU = target_cpu(options);
+    std::string Features = target_features(options);
+    for (llvm::Function& F : TheModule)
+    {
+        if (!F.isDeclaration()) set_target_attributes(F, CPU, Features);
+    }
+    return TheTargetMachine;
+}
 
+bool write_object(llvm::Module& TheModule, llvm::TargetMachine& machine, 
+    llvm::raw_pwrite_stream& out)
+{
+    using namespace llvm;
 
-    /*
-    // Initialize the target registry etc.
-    InitializeAllTargetInfos();
-    InitializeAllTargets();
-    InitializeAllTargetMCs();
-    InitializeAllAsmParsers();
-    InitializeAllAsmPrinters();
+    legacy::PassManager pass;
+#if LLVM_VERSION_MAJOR >= 10
+    auto FileType = CGFT_ObjectFile;
+    if (machine.addPassesToEmitFile(pass, out, nullptr, FileType)) return false;
+#elif LLVM_VERSION_MAJOR >= 7
+    auto FileType = TargetMachine::CGFT_ObjectFile;
+    if (machine.addPassesToEmitFile(pass, out, nullptr, FileType)) return false;
+#else
+    auto FileType = TargetMachine::CGFT_ObjectFile;
+    if (machine.addPassesToEmitFile(pass, out, FileType)) return false;
+#endif
 
-    auto TargetTriple = sys::getDefaultTargetTriple();
-    TheModule->setTargetTriple(TargetTriple);
+    pass.run(TheModule);
+    return true;
+}
 
-    std::string Error;
-    auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
+bool set_bitcode_flush_threshold(int mb)
+{
+#if LLVM_VERSION_MAJOR >= 12
+    // It's an llvm command line option (-bitcode-flush-threshold)
+    llvm::StringMap<llvm::cl::Option*>& registered 
+        = llvm::cl::getRegisteredOptions();
+    auto option = registered.find("bitcode-flush-threshold");
+    if (option == registered.end()) return false;
+    return !option->second->addOccurrence(0, "bitcode-flush-threshold", 
+        std::to_string(mb));
+#else
+    return false;
+#endif
+}
 
-    // Print an error and exit if we couldn't find the requested target.
-    // This generally occurs if we've forgotten to initialise the
-    // TargetRegistry or we have a bogus target triple.
-    if (!Target) {
-        errs() << Error;
-        return 1;
-    }
+std::unique_ptr<llvm::Module> clone_module(const llvm::Module& module)
+{
+#if LLVM_VERSION_MAJOR >= 7
+    return llvm::CloneModule(module);
+#else
+    return llvm::CloneModule(&module);
+#endif
+}
 
-    auto CPU = "generic";
-    auto Features = "";
+bool compile_to_file(llvm::Module& TheModule, const std::string& filename, 
+    const CompilerOptions& options, std::string& error)
+{
+    // Applies only to this scope
+    using namespace llvm;
+    using namespace llvm::sys;
 
-    TargetOptions opt;
-    auto RM = Optional<Reloc::Model>();
-    auto TheTargetMachine =
-        Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+    if (options.format == OUTPUT_OBJECT && options.codegen_threads > 1)
+    {
+        // One object for each partition, combined into the output
+        std::vector<std::string> objects;
+        bool written = compile_to_objects(TheModule, options, objects, error)
+            && link_objects(objects, filename, error);
+        remove_files(objects);
+        return written;
+    }
 
-    TheModule->setDataLayout(TheTargetMachine->createDataLayout());
+    // Give up if we couldn't find the requested target.
+    std::unique_ptr<TargetMachine> machine = host_target(TheModule, options, 
+        error);
+    if (!machine) return false;
+    if (!optimize_module(TheModule, *machine, options, error)) return false;
 
     std::error_code EC;
-    raw_fd_ostream dest(filename, EC, sys::fs::F_None);
-
-    if (EC) {
-        errs() << "Could not open file: " << EC.message();
-        return 1;
+    std::unique_ptr<raw_fd_ostream> stream;
+#if LLVM_VERSION_MAJOR >= 12
+    // The bitcode writer only writes as it goes to a stream it can seek 
+    //  back in (to fill in block sizes); that needs a regular file
+    if (options.format == OUTPUT_BITCODE && options.bitcode_flush > 0)
+        stream.reset(new raw_fd_stream(filename, EC));
+    else
+#endif
+    stream.reset(new raw_fd_ostream(filename, EC, sys::fs::F_None));
+    raw_fd_ostream& dest = *stream;
+    if (EC)
+    {
+        error = "Couldn't open " + filename + ": " + EC.message();
+        if (EC == std::errc::invalid_argument && options.bitcode_flush > 0)
+            error += " (--bitcode-flush needs a regular file)";
+        return false;
     }
 
-    legacy::PassManager pass;
-    auto FileType = TargetMachine::CGFT_ObjectFile;
-
-    if (TheTargetMachine->addPassesToEmitFile(pass, dest, FileType)) {
-        errs() << "TheTargetMachine can't emit a file of this type";
-        return 1;
+    if (options.format == OUTPUT_OBJECT)
+    {
+        if (!write_object(TheModule, *machine, dest))
+        {
+            error = "Can't emit an object file for this target";
+            return false;
+        }
     }
-
-    pass.run(*TheModule);
+    else if (options.format == OUTPUT_BITCODE) write_bitcode(TheModule, dest);
+    else TheModule.print(dest, nullptr);
 
     dest.flush();
+    if (dest.has_error())
+    {
+        // (raw_fd_ostream aborts on an error nobody cleared)
+        dest.clear_error();
+        error = "Couldn't write " + filename;
+        return false;
+    }
 
-    //outs() << "Wrote " << Filename << "\n";
-    return 0;
-    */
+    return true;
 }
-
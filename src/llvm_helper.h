@@ -1,8 +1,11 @@
 #pragma once
 
+#include "options.h"
+
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -14,6 +17,7 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/MC/MCSubtargetInfo.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
@@ -21,6 +25,7 @@
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
+#include "llvm/Config/llvm-config.h"
 
 #include <algorithm>
 #include <cassert>
@@ -29,10 +34,71 @@
 #include <cstdlib>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <system_error>
 #include <utility>
 #include <vector>
 
-int compile_to_file(std::unique_ptr<llvm::Module>, std::string);
+// Write a module to filename in the options' format (IR text, bitcode or 
+//  an object file), after setting it up for the host and running the 
+//  options' passes (-O, --passes) over it.
+//  False, with error set, if the file couldn't be written.
+bool compile_to_file(llvm::Module&, const std::string& filename, 
+    const CompilerOptions& options, std::string& error);
+
+// A copy of a module, in the same context
+std::unique_ptr<llvm::Module> clone_module(const llvm::Module&);
+
+// A TargetMachine for the machine we're running on, for the options' CPU 
+//  and features, after setting the module's triple and data layout to 
+//  match it and its functions' target attributes (see 
+//  set_target_attributes). Null, with error set, if llvm can't target 
+//  it or doesn't know the CPU.
+std::unique_ptr<llvm::TargetMachine> host_target(llvm::Module&, 
+    const CompilerOptions& options, std::string& error);
+
+// The TargetMachine host_target uses, without changing a module (for 
+//  one that's set up already)
+std::unique_ptr<llvm::TargetMachine> create_target_machine(
+    const CompilerOptions& options, std::string& error);
+
+// False, with error set, if llvm doesn't know the options' CPU for the 
+//  machine we're running on (checked before anything's compiled)
+bool check_target(const CompilerOptions& options, std::string& error);
+
+// The CPU to compile for: the options', with "native" replaced by the 
+//  host's name ("generic" if none was given)
+std::string target_cpu(const CompilerOptions& options);
+
+// The target features to compile with: every feature the host has (or 
+//  doesn't) for -march=native, then the options' -mattr list
+std::string target_features(const CompilerOptions& options);
+
+// Set F's "target-cpu" and "target-features" attributes, which the 
+//  optimizer and code generator go by for F rather than the 
+//  TargetMachine's. Nothing is set for "generic" and no features.
+void set_target_attributes(llvm::Function& F, const std::string& cpu, 
+    const std::string& features);
+
+// Compile a module to an object file; false if the target can't
+bool write_object(llvm::Module&, llvm::TargetMachine&, llvm::raw_pwrite_stream&);
+
+// Write a module as bitcode (e.g. to send it to another LLVMContext)
+void write_bitcode(const llvm::Module&, llvm::raw_ostream&);
+
+// Have the bitcode writer write to its file every mb megabytes while it 
+//  writes function blocks, rather than once the whole module's in memory 
+//  (see compile_to_file). False if this llvm can't (before 12).
+bool set_bitcode_flush_threshold(int mb);
+
+// The IR text of a value, type, function, etc.
+template <typename T>
+std::string ir_string(const T& ir)
+{
+    std::string str;
+    llvm::raw_string_ostream stream(str);
+    ir.print(stream);
+    return stream.str();
+}
 
@@ -1,18 +1,115 @@
-#include "token.h"
 #include "errhandler.h"
-#include "symboltable.h"
-#include "scanner.h"
-#include "parser.h"
+#include "options.h"
+#include "trace.h"
+#include "incremental.h"
+#include "codegen.h"
+#include "compiler.h"
+#include "jit.h"
+#include "linker.h"
+#include "llvm_helper.h"
+#include "optimizer.h"
+#include "streaming.h"
+#include "vm.h"
+#include "writer.h"
 
+#include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
 
+#include <sys/stat.h>
+
+#include <chrono>
+#include <fstream>
 #include <iostream>
 #include <cstdint>
 #include <cstring>
+#include <thread>
 #include <vector>
 
 
-bool compile(char* filename, ErrHandler* err_handler)
+// Compile a module to temporary object files (one for each codegen 
+//  thread), then link those with the runtime into the program output 
+//  (-o without -c)
+static void build_program(llvm::Module& module, const std::string& output, 
+    ErrHandler* err_handler, const CompilerOptions& options)
+{
+    std::vector<std::string> objects;
+    std::string error;
+    if (!compile_to_objects(module, options, objects, error))
+    {
+        err_handler->reportError(error);
+        return;
+    }
+    std::vector<std::string> inputs = objects;
+    inputs.push_back(options.runtime);
+    if (!link_program(inputs, output, error))
+        err_handler->reportError(error);
+    remove_files(objects);
+}
+
+// The whole file, read up front (the scanner works out of memory); 
+//  null if it can't be read
+static std::shared_ptr<const std::string> read_source(char* filename, 
+    ErrHandler* err_handler)
+{
+    // TODO: make sure file isn't a dir
+    std::ifstream input_file(filename, std::ifstream::in | std::ifstream::binary);
+    if (!input_file.is_open() || input_file.bad())
+    {
+        err_handler->reportError("Scanner initialization failed. Ensure the input file is valid.");
+        return nullptr;
+    }
+    // (straight into one string: big inputs shouldn't be copied around)
+    std::string contents;
+    input_file.seekg(0, std::ios::end);
+    contents.resize(input_file.tellg());
+    input_file.seekg(0, std::ios::beg);
+    input_file.read(&contents[0], contents.size());
+    return std::make_shared<const std::string>(std::move(contents));
+}
+
+// Compile the file and run it in this process (--run, or --vm in the 
+//  bytecode VM), instead of writing anything. Returns the program's 
+//  exit code, or 2 if it couldn't be compiled (or the VM couldn't 
+//  finish running it).
+int run(char* filename, ErrHandler* err_handler, CompilerOptions options)
+{
+    auto source = read_source(filename, err_handler);
+    if (!source) return 2;
+
+    std::unique_ptr<llvm::LLVMContext> context(new llvm::LLVMContext());
+    std::unique_ptr<llvm::Module> TheModule = parse_program(
+        source, err_handler, *context, options, nullptr, nullptr, filename);
+    if (err_handler->errors) return 2;
+
+    std::string error;
+    int result;
+    if (options.vm)
+    {
+        // Static: what the program registers with atexit once it runs 
+        //  (MEMOIZE_REGISTER's stats, which point into the VM's static 
+        //  memory) is then called before the VM is destroyed
+        static BytecodeVM vm;
+        result = vm.load(*TheModule, error) ? vm.run(error) : -1;
+    }
+    else
+    {
+        result = run_module(std::move(context), std::move(TheModule), 
+            options, error);
+    }
+    if (!error.empty())
+    {
+        err_handler->reportError(error);
+        return 2;
+    }
+    return result;
+}
+
+// writer - writes the output in the background (not with a cache, 
+//  which keeps the module)
+bool compile(char* filename, ErrHandler* err_handler, CompilerOptions options,
+    ProcedureCache* cache=nullptr, OutputWriter* writer=nullptr)
 {
     // Remove extension from input filename
     std::string filenamestr(filename);
@@ -22,50 +119,393 @@ bool compile(char* filename, ErrHandler* err_handler)
 
     std::cout << "Compiling: " << filenamestr << '\n';
 
-    SymbolTableManager* sym_manager = new SymbolTableManager(err_handler);
+    auto source = read_source(filename, err_handler);
+    if (!source) return false;
+    if (!options.output.empty()) filenamestr = options.output;
+    else if (options.format == OUTPUT_BITCODE) filenamestr.append(".bc");
+    else if (options.format == OUTPUT_OBJECT) filenamestr.append(".o");
+    else filenamestr.append(".ll");
+    bool link = options.format == OUTPUT_PROGRAM;
 
-    Scanner* scanner = new Scanner(err_handler, sym_manager);
-    if (!scanner->init(filename))
+    if (options.stream)
     {
-        err_handler->reportError("Scanner initialization failed. Ensure the input file is valid.");
-        return false;
+        // Procedures are written to the file as they're parsed; 
+        //  the rest of the module follows at the end
+        std::error_code EC;
+        llvm::raw_fd_ostream dest(filenamestr, EC, llvm::sys::fs::F_None);
+        if (EC)
+        {
+            err_handler->reportError("Couldn't open " + filenamestr + ": " + EC.message());
+            return false;
+        }
+        llvm::LLVMContext context;
+        ModuleStreamer streamer(dest);
+        std::unique_ptr<llvm::Module> TheModule = parse_program(
+            source, err_handler, context, options, nullptr, &streamer, 
+            filename);
+        streamer.finish(*TheModule);
+        if (dest.has_error())
+        {
+            dest.clear_error();
+            err_handler->reportError("Couldn't write " + filenamestr);
+        }
+        return true;
     }
 
-
     // Parse the tokens
-    Parser* parser = new Parser(err_handler, sym_manager, scanner, filenamestr);
-    std::unique_ptr<llvm::Module> TheModule = parser->parse();
+    // (code reused from the cache has to stay in the cache's context)
+    std::unique_ptr<llvm::LLVMContext> local_context;
+    if (!cache) local_context.reset(new llvm::LLVMContext());
+    llvm::LLVMContext& context = cache ? cache->get_context() : *local_context;
+    std::unique_ptr<llvm::Module> TheModule = parse_program(
+        source, err_handler, context, options, cache, nullptr, filename);
 
-    // Compile the IR to a file
-    filenamestr.append(".ll");
-    compile_to_file(std::move(TheModule), filenamestr);
+    if (writer && !link)
+    {
+        // Printed and written while the next file is parsed
+        writer->add(std::move(local_context), std::move(TheModule), filenamestr);
+        return true;
+    }
 
-    // Delete instances
-    delete sym_manager;
-    delete scanner;
-    delete parser;
+    // Compile the IR to a file
+    // (optimizing changes the module, and the cache needs it as parsed)
+    std::unique_ptr<llvm::Module> optimized;
+    if (cache && !pass_pipeline(options).empty())
+        optimized = clone_module(*TheModule);
+    llvm::Module& output = optimized ? *optimized : *TheModule;
+    std::string error;
+    if (link)
+    {
+        // (a program with errors isn't worth linking)
+        if (!err_handler->errors) 
+            build_program(output, filenamestr, err_handler, options);
+    }
+    else if (!compile_to_file(output, filenamestr, options, error))
+        err_handler->reportError(error);
+    if (cache) cache->keep_module(std::move(TheModule));
 
     return true;
 }
 
+// Changes when the file is saved
+static std::pair<time_t, off_t> file_stamp(const char* filename)
+{
+    struct stat info;
+    if (stat(filename, &info) != 0) return {0, 0};
+    return {info.st_mtime, info.st_size};
+}
+
+// Compile the files, then compile each one again whenever it changes.
+// Runs until the process is killed. Top-level procedures are cached 
+//  between compiles, so only the ones that changed are parsed again.
+void watch(std::vector<char*>& filenames, CompilerOptions options)
+{
+    std::vector<ProcedureCache> caches(filenames.size());
+    std::vector<std::pair<time_t, off_t>> stamps(filenames.size());
+
+    while (true)
+    {
+        for (size_t k = 0; k < filenames.size(); k++)
+        {
+            std::pair<time_t, off_t> stamp = file_stamp(filenames[k]);
+            if (stamp == stamps[k]) continue;
+            stamps[k] = stamp;
+
+            auto start = std::chrono::steady_clock::now();
+            ErrHandler err_handler;
+            compile(filenames[k], &err_handler, options, &caches[k]);
+            auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+
+            if (err_handler.warnings)
+                std::cerr << err_handler.warnings << " warning(s) reported\n";
+            if (err_handler.errors)
+                std::cerr << err_handler.errors << " error(s) reported\n";
+            std::cout << "Parsed " << caches[k].misses << " of " 
+                << caches[k].hits + caches[k].misses << " procedure(s) in " 
+                << time.count() << "ms" << std::endl;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
+
 /*
+Options
+--parse-threads=N - parse top-level procedures on N threads 
+    (1 disables it; by default it's only done for large files)
+--trace=LIST - print debug output to stderr for each category in the 
+    comma separated LIST: lexer, parser, codegen, passes, vm (or all)
+--eval-steps=N - instructions a procedure call with constant arguments 
+    may run when it's evaluated at compile time (default 100000; 
+    0 disables it)
+--watch - keep running and recompile whenever an input file changes, 
+    only parsing the top-level procedures that changed
+--stream - write each procedure to the .ll file as soon as it's parsed 
+    and free its code, so memory use depends on the largest procedure 
+    rather than the whole program (parses on one thread)
+-O0, -O1, -O2, -O3, -Os - run llvm's standard optimization pipeline for 
+    that level before writing the output (default -O0: none)
+--passes=PIPELINE - run a custom new pass manager pipeline instead 
+    (e.g. --passes='function(mem2reg,instcombine)')
+-c - write an object file (.o) for this machine instead of a .ll file
+--emit=FORMAT - what to write: ll (IR text, the default), bc (bitcode) 
+    or obj (the same as -c)
+--bitcode-flush=MB - with --emit=bc, write to the file every MB megabytes 
+    while the procedures are written, instead of all at the end 
+    (llvm 12 and up)
+-o FILE - write the output to FILE (only one input file); without -c 
+    or --emit, the program is linked with the runtime into the 
+    executable FILE
+--run FILE [ARGS] - compile FILE in memory and run it, instead of 
+    writing anything; the rest of the command line is the program's. 
+    -O also sets the JIT's code generation level. Returns the 
+    program's exit code.
+--vm FILE [ARGS] - like --run, but the program is lowered to bytecode 
+    and interpreted, without starting llvm's code generator (can't be 
+    used with -O1 and up or --passes)
+-march=CPU, -mcpu=CPU - compile for CPU (e.g. skylake, or native for 
+    this machine's CPU and features) instead of a generic one
+-mattr=FEATURES - target features to add or take away, e.g. +avx2,-fma 
+    (may be given more than once)
+--multiversion - compile each procedure with a loop for x86-64-v3 
+    (AVX2) and x86-64-v4 (AVX-512) too, and pick the best one the 
+    machine running the program has when it's called (needs -O1 and up 
+    or --passes)
+--codegen-threads=N - split the optimized module into N partitions and 
+    generate machine code for them on N threads, then link them 
+    together (with -c, or -o without --emit; default 1)
+--runtime=FILE - the runtime object to link with 
+    (default: runtime.o next to the compiler)
+-g - describe the source lines, procedures and variables the code came 
+    from in DWARF debug info, for debuggers and profilers
+
 Return codes
 1 - No filename given
 2 - Some errors reported by err_handler
+Otherwise 0, or with --run or --vm, what the program's main returned
 */
 int main(int argc, char** argv)
 {
     ErrHandler* err_handler = new ErrHandler();
 
-    if (argc < 2) 
+    CompilerOptions options;
+    std::vector<char*> filenames;
+    // -c or --emit
+    bool format_given = false;
+
+    for (int k = 1; k < argc; k++)
+    {
+        std::string arg(argv[k]);
+        if (arg.compare(0, 16, "--parse-threads=") == 0)
+        {
+            options.parse_threads = atoi(arg.c_str() + 16);
+            if (options.parse_threads < 1)
+                err_handler->reportError("--parse-threads must be at least 1");
+        }
+        else if (arg.compare(0, 8, "--trace=") == 0)
+        {
+            if (!enable_tracing(arg.substr(8)))
+                err_handler->reportError("Unknown trace category in " + arg);
+        }
+        else if (arg.compare(0, 13, "--eval-steps=") == 0)
+        {
+            options.eval_steps = atoi(arg.c_str() + 13);
+            if (options.eval_steps < 0)
+                err_handler->reportError("--eval-steps can't be negative");
+        }
+        else if (arg == "--watch")
+        {
+            options.watch = true;
+        }
+        else if (arg == "--stream")
+        {
+            options.stream = true;
+        }
+        else if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 
+            && std::strchr("0123s", arg[2]))
+        {
+            options.opt_level = arg[2];
+        }
+        else if (arg == "-c" || arg == "--emit=obj")
+        {
+            options.format = OUTPUT_OBJECT;
+            format_given = true;
+        }
+        else if (arg == "--emit=ll" || arg == "--emit=bc")
+        {
+            options.format = arg == "--emit=bc" ? OUTPUT_BITCODE : OUTPUT_IR;
+            format_given = true;
+        }
+        else if (arg.compare(0, 16, "--bitcode-flush=") == 0)
+        {
+            options.bitcode_flush = atoi(arg.c_str() + 16);
+            if (options.bitcode_flush < 1)
+                err_handler->reportError("--bitcode-flush must be at least 1");
+            else if (!set_bitcode_flush_threshold(options.bitcode_flush))
+                err_handler->reportError("--bitcode-flush needs llvm 12 or later");
+        }
+        else if (arg == "-o")
+        {
+            if (k + 1 < argc) options.output = argv[++k];
+            else err_handler->reportError("-o needs a filename");
+        }
+        else if (arg == "--run" || arg == "--vm")
+        {
+            options.run = true;
+            options.vm = arg == "--vm";
+        }
+        else if (arg.compare(0, 10, "--runtime=") == 0)
+        {
+            options.runtime = arg.substr(10);
+        }
+        else if (arg.compare(0, 7, "-march=") == 0 
+            || arg.compare(0, 6, "-mcpu=") == 0)
+        {
+            options.cpu = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg.compare(0, 7, "-mattr=") == 0)
+        {
+            if (!options.features.empty()) options.features += ",";
+            options.features += arg.substr(7);
+        }
+        else if (arg == "--multiversion")
+        {
+            options.multiversion = true;
+        }
+        else if (arg.compare(0, 18, "--codegen-threads=") == 0)
+        {
+            options.codegen_threads = atoi(arg.c_str() + 18);
+            if (options.codegen_threads < 1)
+                err_handler->reportError("--codegen-threads must be at least 1");
+        }
+        else if (arg == "-g")
+        {
+            options.debug_info = true;
+        }
+        else if (arg.compare(0, 9, "--passes=") == 0)
+        {
+            options.passes = arg.substr(9);
+            std::string error;
+            if (!check_pass_pipeline(options.passes, error))
+                err_handler->reportError(error);
+        }
+        else if (arg[0] == '-')
+        {
+            err_handler->reportError("Unknown option: " + arg);
+        }
+        else 
+        {
+            filenames.push_back(argv[k]);
+            // The rest are the program's (ignored, as by a linked program)
+            if (options.run) break;
+        }
+    }
+
+    if (filenames.empty()) 
     {
         err_handler->reportError("No filename provided.");
         return 1;
     }
 
-    for (int k = 1; k < argc; k++)
+    if (options.stream && options.watch)
+    {
+        // The cache keeps every procedure's code, which is 
+        //  what streaming is there to avoid
+        err_handler->reportError("--stream can't be used with --watch");
+    }
+    if (options.stream && !pass_pipeline(options).empty())
+    {
+        // Procedures are written before the rest of the program exists
+        err_handler->reportError("--stream can't be used with -O1 and up or --passes");
+    }
+    bool target_given = !options.cpu.empty() || !options.features.empty();
+    if (options.stream && target_given)
+    {
+        // Attributes can't be added to procedures that are written already
+        err_handler->reportError("--stream can't be used with -march, -mcpu or -mattr");
+    }
+    if (options.stream && options.debug_info)
+    {
+        // Procedures' debug info is only complete once the module is
+        err_handler->reportError("--stream can't be used with -g");
+    }
+    if (options.multiversion && pass_pipeline(options).empty())
+    {
+        // The copies are only different once they're optimized
+        err_handler->reportError("--multiversion needs -O1 and up or --passes");
+    }
+    std::string target_error;
+    if (!options.cpu.empty() && !check_target(options, target_error))
+        err_handler->reportError(target_error);
+    if (!options.output.empty() && filenames.size() > 1)
+    {
+        err_handler->reportError("-o can only be used with one input file");
+    }
+    // -o alone builds a program
+    if (!options.output.empty() && !format_given) 
+        options.format = OUTPUT_PROGRAM;
+    if (options.stream && options.format != OUTPUT_IR)
+    {
+        err_handler->reportError("--stream can only write IR text "
+            "(not with -c, --emit=bc, or -o without --emit=ll)");
+    }
+    if (options.codegen_threads > 1 && options.format != OUTPUT_OBJECT 
+        && options.format != OUTPUT_PROGRAM)
+    {
+        // (--run's JIT compiles each function as it's first called)
+        err_handler->reportError("--codegen-threads only applies to "
+            "objects and programs (-c, or -o without --emit)");
+    }
+    if (options.format == OUTPUT_PROGRAM)
+    {
+        if (options.runtime.empty()) 
+            options.runtime = default_runtime_path(argv[0]);
+        if (!llvm::sys::fs::exists(options.runtime))
+        {
+            err_handler->reportError("Couldn't find the runtime object " 
+                + options.runtime + " (make builds it, or use --runtime)");
+        }
+    }
+
+    if (options.run && (options.watch || options.stream 
+        || format_given || !options.output.empty()))
+    {
+        err_handler->reportError("--run doesn't write output, so it can't be "
+            "used with --watch, --stream, -c, --emit or -o");
+    }
+    if (options.vm && !pass_pipeline(options).empty())
+    {
+        // The VM runs the module as it was parsed
+        err_handler->reportError("--vm can't be used with -O1 and up or --passes");
+    }
+    if (options.vm && target_given)
+    {
+        err_handler->reportError("--vm doesn't compile to machine code, so it "
+            "can't be used with -march, -mcpu or -mattr");
+    }
+
+    if (err_handler->errors == 0 && options.watch)
+    {
+        watch(filenames, options);
+    }
+
+    int result = 0;
+    if (err_handler->errors == 0 && options.run)
+    {
+        result = run(filenames[0], err_handler, options);
+    }
+    else if (err_handler->errors == 0)
     {
-        compile(argv[k], err_handler);
+        OutputWriter writer(options);
+        for (char* filename : filenames)
+        {
+            compile(filename, err_handler, options, nullptr, &writer);
+        }
+        // The files that couldn't be written count as errors too
+        for (const std::string& error : writer.finish())
+        {
+            err_handler->reportError(error);
+        }
     }
 
     if (err_handler->warnings)
@@ -78,6 +518,6 @@ int main(int argc, char** argv)
         return 2;
     }   
 
-    return 0;
+    return result;
 }
 
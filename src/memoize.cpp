@@ -0,0 +1,215 @@
+#include "memoize.h"
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+
+#include <unordered_set>
+#include <vector>
+
+using namespace llvm;
+
+// An argument's bits, for hashing and comparing
+//  (floats by their bits, so a NaN finds itself)
+static Value* key_bits(IRBuilder<>& Builder, Value* value)
+{
+    Type* i32 = Builder.getInt32Ty();
+    if (value->getType()->isFloatTy()) return Builder.CreateBitCast(value, i32);
+    if (value->getType() != i32) return Builder.CreateZExt(value, i32);
+    return value;
+}
+
+Function* memoize_procedure(Function* F)
+{
+    Module* M = F->getParent();
+    LLVMContext& context = F->getContext();
+    std::string name = F->getName().str();
+
+    // Move the body into F.impl
+    Function* impl = Function::Create(F->getFunctionType(),
+        Function::InternalLinkage, name + ".impl", M);
+    impl->getBasicBlockList().splice(impl->end(), F->getBasicBlockList());
+    // (-g: the body's lines are in the procedure's subprogram)
+    impl->setSubprogram(F->getSubprogram());
+    F->setSubprogram(nullptr);
+    auto impl_arg = impl->arg_begin();
+    for (Argument& arg : F->args())
+    {
+        impl_arg->setName(arg.getName());
+        arg.replaceAllUsesWith(&*impl_arg);
+        ++impl_arg;
+    }
+
+    // Entry: {valid, arguments..., returned value}
+    std::vector<Argument*> ins;
+    std::vector<Type*> fields {Type::getInt8Ty(context)};
+    for (Argument& arg : F->args())
+    {
+        ins.push_back(&arg);
+        fields.push_back(arg.getType());
+    }
+    Type* return_ty = F->getReturnType();
+    bool returns = !return_ty->isVoidTy();
+    if (returns) fields.push_back(return_ty);
+    StructType* entry_ty = StructType::get(context, fields);
+    ArrayType* table_ty = ArrayType::get(entry_ty, MEMO_TABLE_ENTRIES);
+    GlobalVariable* table = new GlobalVariable(*M, table_ty, false,
+        GlobalValue::InternalLinkage, ConstantAggregateZero::get(table_ty),
+        name + ".memo");
+    // {hits, misses}
+    ArrayType* stats_ty = ArrayType::get(Type::getInt64Ty(context), 2);
+    GlobalVariable* stats = new GlobalVariable(*M, stats_ty, false,
+        GlobalValue::InternalLinkage, ConstantAggregateZero::get(stats_ty),
+        name + ".memo_stats");
+
+    BasicBlock* entry = BasicBlock::Create(context, "entry", F);
+    BasicBlock* compare = BasicBlock::Create(context, "memo_compare", F);
+    BasicBlock* hit = BasicBlock::Create(context, "memo_hit", F);
+    BasicBlock* miss = BasicBlock::Create(context, "memo_miss", F);
+    BasicBlock* first = BasicBlock::Create(context, "memo_register", F);
+    BasicBlock* call = BasicBlock::Create(context, "memo_call", F);
+    IRBuilder<> Builder(entry);
+
+    auto field = [&](Value* slot, unsigned k)
+    {
+        return Builder.CreateGEP(slot, {Builder.getInt32(0), Builder.getInt32(k)});
+    };
+    auto counter = [&](unsigned k)
+    {
+        return Builder.CreateGEP(stats, {Builder.getInt64(0), Builder.getInt64(k)});
+    };
+
+    // Find the slot from a hash of the arguments
+    Value* hash = Builder.getInt32(2166136261u);
+    for (Argument* arg : ins)
+    {
+        hash = Builder.CreateXor(hash, key_bits(Builder, arg));
+        hash = Builder.CreateMul(hash, Builder.getInt32(0x9E3779B1u));
+    }
+    hash = Builder.CreateXor(hash, Builder.CreateLShr(hash, 16));
+    Value* index = Builder.CreateAnd(hash, MEMO_TABLE_ENTRIES - 1);
+    Value* slot = Builder.CreateGEP(table,
+        {Builder.getInt64(0), Builder.CreateZExt(index, Builder.getInt64Ty())});
+    Value* valid = Builder.CreateLoad(field(slot, 0));
+    Builder.CreateCondBr(Builder.CreateICmpNE(valid, Builder.getInt8(0)),
+        compare, miss);
+
+    // A hit if every argument matches
+    Builder.SetInsertPoint(compare);
+    Value* match = Builder.getTrue();
+    for (size_t k = 0; k < ins.size(); k++)
+    {
+        Value* saved = Builder.CreateLoad(field(slot, 1 + k));
+        Value* equal = Builder.CreateICmpEQ(
+            key_bits(Builder, saved), key_bits(Builder, ins[k]));
+        match = k == 0 ? equal : Builder.CreateAnd(match, equal);
+    }
+    Builder.CreateCondBr(match, hit, miss);
+
+    Builder.SetInsertPoint(hit);
+    Value* hits = counter(0);
+    Builder.CreateStore(
+        Builder.CreateAdd(Builder.CreateLoad(hits), Builder.getInt64(1)), hits);
+    if (returns) 
+        Builder.CreateRet(Builder.CreateLoad(field(slot, 1 + ins.size())));
+    else Builder.CreateRetVoid();
+
+    // The first miss is the first call: tell the runtime about the counters
+    Builder.SetInsertPoint(miss);
+    Value* misses = counter(1);
+    Value* missed = Builder.CreateLoad(misses);
+    Builder.CreateStore(Builder.CreateAdd(missed, Builder.getInt64(1)), misses);
+    Builder.CreateCondBr(Builder.CreateICmpEQ(missed, Builder.getInt64(0)),
+        first, call);
+
+    Builder.SetInsertPoint(first);
+    Type* i64_ptr = Type::getInt64PtrTy(context);
+    FunctionType* register_ty = FunctionType::get(Type::getVoidTy(context),
+        {Type::getInt8PtrTy(context), i64_ptr}, false);
+    Function* register_fn = M->getFunction("MEMOIZE_REGISTER");
+    if (register_fn == nullptr)
+    {
+        register_fn = Function::Create(register_ty, Function::ExternalLinkage,
+            "MEMOIZE_REGISTER", M);
+    }
+    Builder.CreateCall(register_fn,
+        {Builder.CreateGlobalStringPtr(name, name + ".name"), counter(0)});
+    Builder.CreateBr(call);
+
+    // Run the body, then save its result over whatever was in the slot
+    Builder.SetInsertPoint(call);
+    std::vector<Value*> args(ins.begin(), ins.end());
+    Value* result = Builder.CreateCall(impl, args);
+    for (size_t k = 0; k < ins.size(); k++)
+    {
+        Builder.CreateStore(ins[k], field(slot, 1 + k));
+    }
+    if (returns) Builder.CreateStore(result, field(slot, 1 + ins.size()));
+    Builder.CreateStore(Builder.getInt8(1), field(slot, 0));
+    if (returns) Builder.CreateRet(result);
+    else Builder.CreateRetVoid();
+
+    return impl;
+}
+
+// The global variable a pointer points into, if any
+static GlobalVariable* pointer_global(Value* pointer)
+{
+    while (GEPOperator* gep = dyn_cast<GEPOperator>(pointer))
+    {
+        pointer = gep->getPointerOperand();
+    }
+    return dyn_cast<GlobalVariable>(pointer);
+}
+
+static bool has_side_effects(Function* F, std::unordered_set<Function*>& seen)
+{
+    if (!seen.insert(F).second) return false;
+
+    for (BasicBlock& block : *F)
+    {
+        for (Instruction& I : block)
+        {
+            Value* pointer = nullptr;
+            if (LoadInst* load = dyn_cast<LoadInst>(&I))
+                pointer = load->getPointerOperand();
+            else if (StoreInst* store = dyn_cast<StoreInst>(&I))
+                pointer = store->getPointerOperand();
+            if (pointer)
+            {
+                // String constants are fine
+                GlobalVariable* global = pointer_global(pointer);
+                if (global && !global->isConstant()) return true;
+            }
+
+            CallInst* call = dyn_cast<CallInst>(&I);
+            if (call == nullptr || isa<DbgInfoIntrinsic>(call)) continue;
+            Function* callee = call->getCalledFunction();
+            if (callee == nullptr) return true;
+            Intrinsic::ID intrinsic = callee->getIntrinsicID();
+            if (intrinsic == Intrinsic::lifetime_start
+                || intrinsic == Intrinsic::lifetime_end)
+                continue;
+            // A memoized procedure is as pure as its body
+            Module* M = callee->getParent();
+            Function* impl = M->getFunction(callee->getName().str() + ".impl");
+            if (impl) callee = impl;
+            if (callee->isDeclaration() || has_side_effects(callee, seen))
+                return true;
+        }
+    }
+    return false;
+}
+
+bool has_side_effects(Function* F)
+{
+    std::unordered_set<Function*> seen;
+    return has_side_effects(F, seen);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "llvm/IR/Function.h"
+
+// Entries in each memoized procedure's cache (a power of 2)
+const unsigned MEMO_TABLE_ENTRIES = 1024;
+
+// Put a cache of results in front of a finished procedure F
+//  (MEMOIZE PROCEDURE). F's parameters must be scalars (not strings).
+//  F's body is moved to a new internal function, F.impl, and F becomes
+//  a lookup of its arguments in a table of MEMO_TABLE_ENTRIES entries
+//  (F.memo), which returns the saved result of a matching entry or else
+//  calls F.impl and saves what it returned.
+//  The table is direct-mapped: a new entry replaces whatever was in its
+//  slot. Hits and misses are counted in F.memo_stats, which is handed to
+//  the runtime (MEMOIZE_REGISTER) on the first call.
+// Returns F.impl.
+llvm::Function* memoize_procedure(llvm::Function* F);
+
+// Whether F, or something it calls, might do more than compute its OUT
+//  and INOUT values from the values passed in (use a builtin or a global variable),
+//  in which case memoizing it changes what the program does.
+bool has_side_effects(llvm::Function* F);
@@ -0,0 +1,144 @@
+#include "multiversion.h"
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+// The levels there are copies for, newest first, and the CPU each is 
+//  compiled for (before llvm 12, which names the levels, the first CPU 
+//  that had everything in it)
+static const std::vector<std::pair<int, std::string>>& levels()
+{
+#if LLVM_VERSION_MAJOR >= 12
+    static const std::vector<std::pair<int, std::string>> cpus = {
+        {4, "x86-64-v4"}, {3, "x86-64-v3"}};
+#else
+    static const std::vector<std::pair<int, std::string>> cpus = {
+        {4, "skylake-avx512"}, {3, "haswell"}};
+#endif
+    return cpus;
+}
+
+static bool has_loop(Function& F)
+{
+    DominatorTree dominators(F);
+    LoopInfo loops(dominators);
+    return !loops.empty();
+}
+
+// Calls in F to callee go to replacement instead
+static void redirect_calls(Function& F, Function* callee, 
+    Function* replacement)
+{
+    for (BasicBlock& BB : F)
+    {
+        for (Instruction& I : BB)
+        {
+            CallInst* call = dyn_cast<CallInst>(&I);
+            if (call && call->getCalledFunction() == callee)
+                call->setCalledFunction(replacement);
+        }
+    }
+}
+
+// Replace F's body with a call to the copy for the machine's level
+static void multiversion_procedure(Function* F, Function* cpu_level)
+{
+    Module* M = F->getParent();
+    LLVMContext& context = F->getContext();
+    std::string name = F->getName().str();
+
+    // Move the body into F.default
+    Function* original = Function::Create(F->getFunctionType(),
+        Function::InternalLinkage, name + ".default", M);
+    original->copyAttributesFrom(F);
+    original->setLinkage(Function::InternalLinkage);
+    original->getBasicBlockList().splice(original->end(), 
+        F->getBasicBlockList());
+    // (-g: the body's lines are in the procedure's subprogram; each 
+    //  copy gets its own)
+    original->setSubprogram(F->getSubprogram());
+    F->setSubprogram(nullptr);
+    auto original_arg = original->arg_begin();
+    for (Argument& arg : F->args())
+    {
+        original_arg->setName(arg.getName());
+        arg.replaceAllUsesWith(&*original_arg);
+        ++original_arg;
+    }
+
+    std::vector<std::pair<int, Function*>> copies;
+    for (auto& level : levels())
+    {
+        ValueToValueMapTy values;
+        Function* copy = CloneFunction(original, values);
+        copy->setName(name + "." + level.second);
+        copy->addFnAttr("target-cpu", level.second);
+        // (the level has the features; -mattr's are for the default)
+        copy->removeFnAttr("target-features");
+        redirect_calls(*copy, F, copy);
+        copies.push_back({level.first, copy});
+    }
+    redirect_calls(*original, F, original);
+
+    // The first copy the machine's level is at least, or the default
+    IRBuilder<> Builder(BasicBlock::Create(context, "entry", F));
+    std::vector<Value*> args;
+    for (Argument& arg : F->args()) args.push_back(&arg);
+    Value* level = Builder.CreateCall(cpu_level, {}, "level");
+    for (auto& copy : copies)
+    {
+        BasicBlock* call = BasicBlock::Create(context, copy.second->getName(), F);
+        BasicBlock* next = BasicBlock::Create(context, "next", F);
+        Builder.CreateCondBr(Builder.CreateICmpSGE(level, 
+            Builder.getInt32(copy.first)), call, next);
+
+        Builder.SetInsertPoint(call);
+        CallInst* result = Builder.CreateCall(copy.second, args);
+        result->setTailCall();
+        if (F->getReturnType()->isVoidTy()) Builder.CreateRetVoid();
+        else Builder.CreateRet(result);
+        Builder.SetInsertPoint(next);
+    }
+    CallInst* result = Builder.CreateCall(original, args);
+    result->setTailCall();
+    if (F->getReturnType()->isVoidTy()) Builder.CreateRetVoid();
+    else Builder.CreateRet(result);
+}
+
+bool multiversion_module(Module& M, const TargetMachine& machine,
+    std::string& error)
+{
+    if (machine.getTargetTriple().getArch() != Triple::x86_64)
+    {
+        error = "--multiversion only has versions for x86-64, not " 
+            + machine.getTargetTriple().str();
+        return false;
+    }
+
+    std::vector<Function*> procedures;
+    for (Function& F : M)
+    {
+        if (!F.isDeclaration() && has_loop(F)) procedures.push_back(&F);
+    }
+    if (procedures.empty()) return true;
+
+    Function* cpu_level = M.getFunction("CPU_LEVEL");
+    if (cpu_level == nullptr)
+    {
+        cpu_level = Function::Create(
+            FunctionType::get(Type::getInt32Ty(M.getContext()), false),
+            Function::ExternalLinkage, "CPU_LEVEL", &M);
+    }
+    for (Function* F : procedures) multiversion_procedure(F, cpu_level);
+    return true;
+}
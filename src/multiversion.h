@@ -0,0 +1,18 @@
+#pragma once
+
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <string>
+
+// Function multiversioning (--multiversion): each procedure with a loop 
+//  is copied once for each newer x86-64 level (v3 has AVX2, v4 AVX-512), 
+//  with "target-cpu" set to that level, and becomes a dispatcher that 
+//  calls the best copy the machine running the program supports (the 
+//  runtime's CPU_LEVEL) or else its own body, moved to F.default.
+//  Recursive calls in a copy call the copy itself.
+// Done before the optimization passes, so each copy's loops are 
+//  vectorized and scheduled for its level. False, with error set, if 
+//  machine isn't x86-64.
+bool multiversion_module(llvm::Module& M, const llvm::TargetMachine& machine,
+    std::string& error);
@@ -0,0 +1,228 @@
+#include "optimizer.h"
+#include "multiversion.h"
+#include "trace.h"
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Error.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <vector>
+
+using namespace llvm;
+
+typedef std::chrono::steady_clock Clock;
+
+std::string pass_pipeline(const CompilerOptions& options)
+{
+    if (!options.passes.empty()) return options.passes;
+    if (options.opt_level == '0') return "";
+    return std::string("default<O") + options.opt_level + ">";
+}
+
+static bool parse_pipeline(PassBuilder& builder, ModulePassManager& passes,
+    const std::string& pipeline, std::string& error)
+{
+#if LLVM_VERSION_MAJOR >= 9
+    if (Error err = builder.parsePassPipeline(passes, pipeline))
+    {
+        error = "Invalid pass pipeline '" + pipeline + "': "
+            + toString(std::move(err));
+        return false;
+    }
+#else
+    if (!builder.parsePassPipeline(passes, pipeline))
+    {
+        error = "Invalid pass pipeline '" + pipeline + "'";
+        return false;
+    }
+#endif
+    return true;
+}
+
+bool check_pass_pipeline(const std::string& pipeline, std::string& error)
+{
+    PassBuilder builder;
+    ModulePassManager passes;
+    return parse_pipeline(builder, passes, pipeline, error);
+}
+
+// Time spent in each pass, not counting the passes it ran itself
+//  (a pass manager or adaptor only gets its own overhead). Analyses
+//  count towards the pass that asked for them.
+class PassTimer
+{
+public:
+#if LLVM_VERSION_MAJOR >= 12
+    void register_callbacks(PassInstrumentationCallbacks& callbacks)
+    {
+        callbacks.registerBeforeNonSkippedPassCallback(
+            [this](StringRef name, Any) { start(name); });
+        callbacks.registerAfterPassCallback(
+            [this](StringRef, Any, const PreservedAnalyses&) { stop(); });
+        callbacks.registerAfterPassInvalidatedCallback(
+            [this](StringRef, const PreservedAnalyses&) { stop(); });
+    }
+#endif
+
+    // One line per pass, slowest first
+    void report(std::ostream& out) const
+    {
+        std::vector<std::pair<std::string, Total>> sorted(
+            totals.begin(), totals.end());
+        std::stable_sort(sorted.begin(), sorted.end(),
+            [](const std::pair<std::string, Total>& a,
+                const std::pair<std::string, Total>& b)
+            { return a.second.seconds > b.second.seconds; });
+
+        for (auto& entry : sorted)
+        {
+            out << "\n" << std::setw(9) << entry.second.seconds * 1000
+                << "ms " << std::setw(5) << entry.second.runs << "x  "
+                << entry.first;
+        }
+    }
+
+private:
+    struct Running
+    {
+        std::string name;
+        Clock::time_point start;
+        // Spent in the passes it ran
+        double nested;
+    };
+    struct Total
+    {
+        double seconds = 0;
+        int runs = 0;
+    };
+
+    std::vector<Running> running;
+    std::map<std::string, Total> totals;
+
+    void start(StringRef name)
+    {
+        running.push_back({name.str(), Clock::now(), 0});
+    }
+
+    void stop()
+    {
+        if (running.empty()) return;
+        Running pass = running.back();
+        running.pop_back();
+
+        double seconds = std::chrono::duration<double>(
+            Clock::now() - pass.start).count();
+        Total& total = totals[pass.name];
+        total.seconds += seconds - pass.nested;
+        total.runs++;
+        if (!running.empty()) running.back().nested += seconds;
+    }
+};
+
+#if LLVM_VERSION_MAJOR >= 13
+// Makes a variable optimized out where InstCombine could only describe 
+//  its value with several others (a DIArgList, for an instruction it 
+//  removed, e.g. sum's "sum + a - b"): llvm 14's Reassociate is slow to 
+//  rewrite those (array_reads.src's 1000 assignments to sum take it 
+//  0.8s, not 0.04s), and the code generator keeps few of them.
+struct DropMultiValueDebugValues : PassInfoMixin<DropMultiValueDebugValues>
+{
+    PreservedAnalyses run(Function& F, FunctionAnalysisManager&)
+    {
+        bool changed = false;
+        for (BasicBlock& block : F)
+        {
+            for (Instruction& I : block)
+            {
+                DbgValueInst* value = dyn_cast<DbgValueInst>(&I);
+                if (value == nullptr || !value->hasArgList()) continue;
+
+                value->setRawLocation(ValueAsMetadata::get(UndefValue::get(
+                    value->getVariableLocationOp(0)->getType())));
+                value->setExpression(DIExpression::get(F.getContext(), None));
+                changed = true;
+            }
+        }
+        if (!changed) return PreservedAnalyses::all();
+        PreservedAnalyses preserved;
+        preserved.preserveSet<CFGAnalyses>();
+        return preserved;
+    }
+};
+#endif
+
+bool optimize_module(Module& M, TargetMachine& machine,
+    const CompilerOptions& options, std::string& error)
+{
+    std::string pipeline = pass_pipeline(options);
+    if (pipeline.empty()) return true;
+    // (so the passes optimize each copy for its CPU)
+    if (options.multiversion && !multiversion_module(M, machine, error))
+        return false;
+
+    PassTimer timer;
+#if LLVM_VERSION_MAJOR >= 9
+    // The vectorizers are on for the levels clang turns them on for
+    //  (default<O1> leaves them out either way)
+    PipelineTuningOptions tuning;
+    tuning.LoopVectorization = options.opt_level != '1';
+    tuning.SLPVectorization = options.opt_level != '1';
+#endif
+#if LLVM_VERSION_MAJOR >= 12
+    PassInstrumentationCallbacks callbacks;
+    if (trace_categories & TRACE_PASSES) timer.register_callbacks(callbacks);
+    PassBuilder builder(&machine, tuning, None, &callbacks);
+#elif LLVM_VERSION_MAJOR >= 9
+    PassBuilder builder(&machine, tuning);
+#else
+    PassBuilder builder(&machine);
+#endif
+
+#if LLVM_VERSION_MAJOR >= 13
+    // (after each InstCombine, before Reassociate sees them)
+    if (options.debug_info)
+    {
+        builder.registerPeepholeEPCallback(
+            [](FunctionPassManager& passes, auto)
+            { passes.addPass(DropMultiValueDebugValues()); });
+    }
+#endif
+
+    LoopAnalysisManager loop_analyses;
+    FunctionAnalysisManager function_analyses;
+    CGSCCAnalysisManager cgscc_analyses;
+    ModuleAnalysisManager module_analyses;
+    builder.registerModuleAnalyses(module_analyses);
+    builder.registerCGSCCAnalyses(cgscc_analyses);
+    builder.registerFunctionAnalyses(function_analyses);
+    builder.registerLoopAnalyses(loop_analyses);
+    builder.crossRegisterProxies(loop_analyses, function_analyses,
+        cgscc_analyses, module_analyses);
+
+    ModulePassManager passes;
+    if (!parse_pipeline(builder, passes, pipeline, error)) return false;
+
+    Clock::time_point start = Clock::now();
+    passes.run(M, module_analyses);
+
+    if (trace_categories & TRACE_PASSES)
+    {
+        // The whole pipeline, then each pass
+        //  (older llvm has no callbacks to time them with)
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2) << "passes " << pipeline
+            << ": " << std::chrono::duration<double, std::milli>(
+                Clock::now() - start).count() << "ms";
+        timer.report(out);
+        trace_line(out.str());
+    }
+    return true;
+}
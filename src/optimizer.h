@@ -0,0 +1,24 @@
+#pragma once
+
+#include "options.h"
+
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <string>
+
+// The new pass manager pipeline the options ask for: --passes as given,
+//  or the standard pipeline for the -O level (e.g. "default<O2>").
+//  Empty for -O0 (nothing is run).
+std::string pass_pipeline(const CompilerOptions& options);
+
+// Whether llvm can parse a pipeline; false, with error set, if it can't
+bool check_pass_pipeline(const std::string& pipeline, std::string& error);
+
+// Run the options' pipeline over M, which has to be set up for machine
+//  already (see host_target). False, with error set, if the pipeline
+//  can't be parsed. With --multiversion, M's procedures with loops are 
+//  multiversioned first (see multiversion_module). With --trace=passes, 
+//  how long each pass took is printed afterwards.
+bool optimize_module(llvm::Module& M, llvm::TargetMachine& machine,
+    const CompilerOptions& options, std::string& error);
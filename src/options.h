@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+
+// What's written for each input file
+enum OutputFormat
+{
+    OUTPUT_IR,          // IR text, .ll (the default; --emit=ll)
+    OUTPUT_BITCODE,     // llvm bitcode, .bc (--emit=bc)
+    OUTPUT_OBJECT,      // an object file for the host, .o (-c, --emit=obj)
+    OUTPUT_PROGRAM      // an executable linked with the runtime (-o alone)
+};
+
+// Settings from the command line that affect compilation
+struct CompilerOptions
+{
+    // Threads for parsing top-level procedures in parallel.
+    //  0 = decide automatically from the file size and core count.
+    //  1 = always parse on a single thread.
+    int parse_threads = 0;
+
+    // Instructions a call may run when it's evaluated at compile time 
+    //  (0 = never evaluate calls at compile time)
+    int eval_steps = 100000;
+
+    // Keep running, and compile the files again whenever they change
+    bool watch = false;
+
+    // Write each procedure to the output as soon as it's finished, 
+    //  instead of holding the whole module until the end
+    bool stream = false;
+
+    // -O level: '0' to '3', or 's' (optimize for size). 
+    //  '0' writes the module just as it was parsed.
+    char opt_level = '0';
+
+    // A new pass manager pipeline (e.g. "function(sroa,instcombine)")
+    //  to run instead of the -O level's
+    std::string passes;
+
+    // What to write for each input file
+    OutputFormat format = OUTPUT_IR;
+
+    // The file to write (-o), instead of the input's name with .ll etc.
+    std::string output;
+
+    // With --emit=bc, write the bitcode to the file every this many MB 
+    //  as it's produced (0 = llvm's default, 512)
+    int bitcode_flush = 0;
+
+    // The precompiled runtime object programs are linked with (--runtime)
+    std::string runtime;
+
+    // The CPU to compile for (-march, -mcpu): "native" is the host's.
+    //  Empty = "generic".
+    std::string cpu;
+
+    // Target features to add or take away, e.g. "+avx2,-fma" (-mattr)
+    std::string features;
+
+    // Compile each procedure with a loop for several x86-64 levels and 
+    //  pick one when it's called (--multiversion)
+    bool multiversion = false;
+
+    // Threads to generate machine code on (--codegen-threads): the 
+    //  module is split into this many partitions, compiled to objects 
+    //  at the same time and linked together
+    int codegen_threads = 1;
+
+    // Compile the program in memory and run it instead of writing it
+    bool run = false;
+
+    // With run: lower it to the bytecode VM's instructions and interpret 
+    //  them, instead of compiling it to machine code (--vm)
+    bool vm = false;
+
+    // Describe where the code came from (lines, procedures and 
+    //  variables) in DWARF, for debuggers and profilers (-g)
+    bool debug_info = false;
+};
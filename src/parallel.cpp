@@ -0,0 +1,88 @@
+#include "parallel.h"
+#include "parser.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+ProcedurePool::ProcedurePool(CompilerOptions options, std::string filename)
+    : options(options), filename(filename), next_job(0) {}
+
+ProcedurePool::~ProcedurePool()
+{
+    wait();
+}
+
+ProcedureJob* ProcedurePool::add_job(SourceRange range)
+{
+    jobs.push_back(std::unique_ptr<ProcedureJob>(new ProcedureJob()));
+    ProcedureJob* job = jobs.back().get();
+    job->range = range;
+    job->diagnostics.set_buffered(true);
+    return job;
+}
+
+std::vector<std::unique_ptr<ProcedureJob>>& ProcedurePool::get_jobs()
+{
+    return jobs;
+}
+
+void ProcedurePool::start(int num_threads,
+    std::shared_ptr<const std::string> source, SymTable globals)
+{
+    this->source = source;
+    this->globals = globals;
+
+    int count = std::min((size_t)num_threads, jobs.size());
+    for (int k = 0; k < count; k++)
+    {
+        workers.push_back(std::thread(&ProcedurePool::work, this));
+    }
+}
+
+void ProcedurePool::wait()
+{
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void ProcedurePool::work()
+{
+    while (true)
+    {
+        size_t k = next_job++;
+        if (k >= jobs.size()) return;
+        run_job(jobs[k].get());
+    }
+}
+
+void ProcedurePool::run_job(ProcedureJob* job)
+{
+    // Everything llvm is per-thread, so each job gets its own context
+    llvm::LLVMContext context;
+
+    SymbolTableManager sym_manager(&job->diagnostics);
+    Scanner scanner(&job->diagnostics, &sym_manager);
+    scanner.init(source, job->range);
+    sym_manager.import_globals(globals);
+
+    // The procedure is parsed like any other, just on its own
+    CompilerOptions job_options = options;
+    job_options.parse_threads = 1;
+    Parser parser(&job->diagnostics, &sym_manager, &scanner, filename,
+        context, job_options);
+    std::unique_ptr<llvm::Module> module = parser.parse_procedure();
+
+    // Builtins that aren't called would only slow down linking
+    for (auto it = module->begin(); it != module->end(); )
+    {
+        llvm::Function& F = *it++;
+        if (F.isDeclaration() && F.use_empty()) F.eraseFromParent();
+    }
+
+    llvm::raw_string_ostream out(job->bitcode);
+    write_bitcode(*module, out);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "errhandler.h"
+#include "scanner.h"
+#include "symboltable.h"
+#include "options.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Files smaller than this are parsed on one thread unless 
+//  parse_threads asks for more; the startup cost isn't worth it.
+const size_t PARALLEL_PARSE_MIN_BYTES = 1 << 20;
+
+// A top-level procedure whose body is parsed and checked on a worker thread,
+//  in its own LLVMContext.
+struct ProcedureJob
+{
+    // From the PROCEDURE token through its END PROCEDURE
+    SourceRange range;
+
+    // Held until the main parser flushes its diagnostics, so they come out
+    //  where the procedure is in the source
+    ErrHandler diagnostics;
+
+    // The procedure's module, as bitcode so it can be loaded 
+    //  into the main thread's context
+    std::string bitcode;
+};
+
+// Runs ProcedureJobs on a pool of worker threads
+class ProcedurePool
+{
+public:
+    // filename - the source file, for the procedures' debug info (-g)
+    ProcedurePool(CompilerOptions options, std::string filename="");
+    ~ProcedurePool();
+
+    // Add a job. Jobs must all be added before start().
+    ProcedureJob* add_job(SourceRange range);
+    std::vector<std::unique_ptr<ProcedureJob>>& get_jobs();
+
+    // Start parsing jobs on up to num_threads threads.
+    // globals is the symbol table snapshot the procedures are checked 
+    //  against; source is shared by every job.
+    void start(int num_threads, 
+        std::shared_ptr<const std::string> source, SymTable globals);
+    // Wait for every job to finish
+    void wait();
+
+private:
+    CompilerOptions options;
+    std::string filename;
+
+    std::vector<std::unique_ptr<ProcedureJob>> jobs;
+    std::shared_ptr<const std::string> source;
+    SymTable globals;
+
+    std::vector<std::thread> workers;
+    // Index of the next job a worker should pick up
+    std::atomic<size_t> next_job;
+
+    void work();
+    void run_job(ProcedureJob* job);
+};
@@ -1,30 +1,70 @@
 #include "parser.h"
-
-#define P_DEBUG false
+#include "trace.h"
 
 // To assist in error printing 
 const char* TokenTypeStrings[] = 
 {
 ".", ";", "(", ")", ",", "[", "]", ":", "&", "|", "+", "-", "<", ">", "<=", ">=", ":=", "==", "!=", "*", "/", "FILE_END", "STRING", "CHAR", "INTEGER", "FLOAT", "BOOL", "IDENTIFIER", "UNKNOWN",
-"RS_IN", "RS_OUT", "RS_INOUT", "RS_PROGRAM", "RS_IS", "RS_BEGIN", "RS_END", "RS_GLOBAL", "RS_PROCEDURE", "RS_STRING", "RS_CHAR", "RS_INTEGER", "RS_FLOAT", "RS_BOOL", "RS_IF", "RS_THEN", "RS_ELSE", "RS_FOR", "RS_RETURN", "RS_TRUE", "RS_FALSE", "RS_NOT"
+"RS_IN", "RS_OUT", "RS_INOUT", "RS_PROGRAM", "RS_IS", "RS_BEGIN", "RS_END", "RS_GLOBAL", "RS_PROCEDURE", "RS_STRING", "RS_CHAR", "RS_INTEGER", "RS_FLOAT", "RS_BOOL", "RS_IF", "RS_THEN", "RS_ELSE", "RS_FOR", "RS_RETURN", "RS_TRUE", "RS_FALSE", "RS_NOT", "RS_CASE", "RS_WHEN", "RS_MEMOIZE"
+};
+
+// Binding level of each binary operator, indexed by TokenType. 
+// Operator tokens all come before FILE_END; every other token is OP_NONE.
+static constexpr OpLevel BinaryOpLevels[] = 
+{
+    // .  ;  (  )  ,  [  ]  :
+    OP_NONE, OP_NONE, OP_NONE, OP_NONE, OP_NONE, OP_NONE, OP_NONE, OP_NONE,
+    // &  |
+    OP_EXPRESSION, OP_EXPRESSION,
+    // +  -
+    OP_ARITH, OP_ARITH,
+    // <  >  <=  >=
+    OP_RELATION, OP_RELATION, OP_RELATION, OP_RELATION,
+    // :=
+    OP_NONE,
+    // ==  !=
+    OP_RELATION, OP_RELATION,
+    // *  /
+    OP_TERM, OP_TERM
 };
 
+static_assert(sizeof(BinaryOpLevels) / sizeof(OpLevel) == FILE_END, 
+    "BinaryOpLevels must have an entry for every token before FILE_END");
+static_assert(BinaryOpLevels[OR] == OP_EXPRESSION 
+    && BinaryOpLevels[MINUS] == OP_ARITH 
+    && BinaryOpLevels[NOTEQUAL] == OP_RELATION
+    && BinaryOpLevels[DIVISION] == OP_TERM, 
+    "BinaryOpLevels is out of sync with TokenType");
+
+static inline OpLevel binary_op_level(TokenType type)
+{
+    return type < FILE_END ? BinaryOpLevels[type] : OP_NONE;
+}
+
+// OUT and INOUT scalars (and strings) come back in a procedure's return 
+//  value rather than through a pointer
+static inline bool is_result(const SymTableEntry* param)
+{
+    return param->param_type != RS_IN && !param->is_arr;
+}
+
 // Initialize llvm stuff
 using namespace llvm;
 using namespace llvm::sys;
 
-static llvm::LLVMContext TheContext;
-static llvm::IRBuilder<> Builder(TheContext);
-static std::unique_ptr<llvm::Module> TheModule;
-
-Parser::Parser(ErrHandler* handler, SymbolTableManager* manager, Scanner* scan, std::string filename)
-    : err_handler(handler), symtable_manager(manager), scanner(scan)
+Parser::Parser(ErrHandler* handler, SymbolTableManager* manager, Scanner* scan, 
+                std::string filename, LLVMContext& context, CompilerOptions opts)
+    : TheContext(context), Builder(context), allocations(Builder), options(opts),
+        filename(filename), evaluator(opts.eval_steps), err_handler(handler), symtable_manager(manager), scanner(scan)
 { 
     // Initialize curr_token so old values aren't used 
     curr_token.type = UNKNOWN;
-    curr_token.val.sym_type = S_UNDEFINED;
+    curr_token.val.int_value = 0;
+    curr_token_valid = false;
 
     TheModule = make_unique<Module>("my IR", TheContext);
+    if (options.debug_info)
+        debug = make_unique<DebugInfo>(*TheModule, Builder, filename, options);
 }
 
 Parser::~Parser() { }
@@ -39,7 +79,8 @@ TokenType Parser::token()
     {
         curr_token_valid = true;
         curr_token = scanner->getToken();
-        if (P_DEBUG) std::cout << "\tGot: " << TokenTypeStrings[curr_token.type] << '\n';
+        // Code from here on is this token's line's
+        if (debug) debug->set_line(curr_token.line);
         return curr_token.type;
     }
     else return curr_token.type;
@@ -70,13 +111,31 @@ Token Parser::require(TokenType expected_type, bool error)
     return curr_token;
 }
 
-void Parser::decl_single_builtin(std::string name, Type* paramtype)
+// Text of an identifier (or reserved word) token.
+// Other tokens (e.g. from a failed require) give an empty string.
+const std::string& Parser::identifier_string(const Token& tok)
+{
+    static const std::string empty;
+    if (tok.type == TokenType::IDENTIFIER || tok.type >= TokenType::RS_IN)
+        return scanner->atom_string(tok.val.atom);
+    return empty;
+}
+
+void Parser::decl_single_builtin(std::string name, SymbolType param_sym_type, 
+                                    TokenType param_type)
 {
+    // IN by value, OUT through a pointer
+    Type* paramtype = llvm_type(param_sym_type);
+    if (param_type == RS_OUT) paramtype = paramtype->getPointerTo();
+
     std::vector<Type*> Params(1, paramtype);
     FunctionType *FT =
         FunctionType::get(Type::getVoidTy(TheContext), Params, false);
     Function *F =
         Function::Create(FT, Function::ExternalLinkage, name, TheModule.get());
+    // C's bool and char are extended to a register's width by the caller
+    if (paramtype->isIntegerTy(1)) F->addParamAttr(0, Attribute::ZExt);
+    else if (paramtype->isIntegerTy(8)) F->addParamAttr(0, Attribute::SExt);
 
     // Associate the LLVM function we created with its symboltable entry
     SymTableEntry* entry = symtable_manager->resolve_symbol(name, true);
@@ -85,17 +144,9 @@ void Parser::decl_single_builtin(std::string name, Type* paramtype)
 
 void Parser::decl_builtins()
 {
-    decl_single_builtin("PUTINTEGER", Type::getInt32PtrTy(TheContext));
-    decl_single_builtin("PUTFLOAT", Type::getFloatPtrTy(TheContext));
-    decl_single_builtin("PUTCHAR", Type::getInt8PtrTy(TheContext));
-    decl_single_builtin("PUTSTRING", Type::getInt8PtrTy(TheContext));
-    decl_single_builtin("PUTBOOL", Type::getInt1PtrTy(TheContext));
-
-    decl_single_builtin("GETINTEGER", Type::getInt32PtrTy(TheContext));
-    decl_single_builtin("GETFLOAT", Type::getFloatPtrTy(TheContext));
-    decl_single_builtin("GETCHAR", Type::getInt8PtrTy(TheContext));
-    decl_single_builtin("GETSTRING", Type::getInt8PtrTy(TheContext)->getPointerTo());
-    decl_single_builtin("GETBOOL", Type::getInt1PtrTy(TheContext));
+#define BUILTIN(name, sym_type, param_type, c_type) \
+    decl_single_builtin(#name, sym_type, param_type);
+#include "builtins.def"
 }
 
 Value* Parser::convert_type(Value* val, Type* required_type)
@@ -104,6 +155,9 @@ Value* Parser::convert_type(Value* val, Type* required_type)
 
     if (required_type == val->getType() || required_type == nullptr) return nullptr;
 
+    // The converted value is a new value, not the variable
+    lvalue_entry = nullptr;
+
     if (required_type == Type::getInt32Ty(TheContext)
              && val->getType() == Type::getFloatTy(TheContext))
     {
@@ -139,7 +193,8 @@ Value* Parser::convert_type(Value* val, Type* required_type)
     }
     else 
     {
-        TheModule->print(llvm::errs(), nullptr);
+        TRACE(TRACE_CODEGEN, "Conversion failed in:\n" 
+            << ir_string(*Builder.GetInsertBlock()->getParent()));
 
         std::string str;
         raw_string_ostream rso(str);
@@ -158,15 +213,326 @@ Value* Parser::convert_type(Value* val, Type* required_type)
     return retval;
 }
 
+void Parser::write_variable(SymTableEntry* var, BasicBlock* block, Value* val)
+{
+    var->ssa_defs[block] = val;
+}
+
+Value* Parser::read_variable(SymTableEntry* var, BasicBlock* block)
+{
+    auto def = var->ssa_defs.find(block);
+    if (def != var->ssa_defs.end()) return def->second;
+    return read_variable_recursive(var, block);
+}
+
+Value* Parser::read_variable_recursive(SymTableEntry* var, BasicBlock* block)
+{
+    Value* val;
+    if (sealed_blocks.count(block) == 0)
+    {
+        // Not all predecessors are known yet; 
+        //  the phi's operands are added when the block is sealed
+        PHINode* phi = new_phi(var, block);
+        incomplete_phis[block].push_back({var, phi});
+        val = phi;
+    }
+    else if (BasicBlock* pred = block->getSinglePredecessor())
+    {
+        // Only one possible value; no phi needed
+        val = read_variable(var, pred);
+    }
+    else if (pred_begin(block) == pred_end(block))
+    {
+        // Entry (or unreachable) block: the variable was never assigned
+        val = UndefValue::get(var->ssa_type);
+    }
+    else
+    {
+        // Define the phi before reading the predecessors, 
+        //  in case a loop leads back to this block
+        PHINode* phi = new_phi(var, block);
+        write_variable(var, block, phi);
+        val = add_phi_operands(var, phi);
+        // (only phis that merge values are worth describing)
+        if (debug && val == phi) debug->set_phi_value(var, phi);
+    }
+    write_variable(var, block, val);
+    return val;
+}
+
+PHINode* Parser::new_phi(SymTableEntry* var, BasicBlock* block)
+{
+    // Phis go before everything else in the block
+    if (Instruction* first = block->getFirstNonPHI())
+        return PHINode::Create(var->ssa_type, 2, var->id, first);
+    return PHINode::Create(var->ssa_type, 2, var->id, block);
+}
+
+Value* Parser::add_phi_operands(SymTableEntry* var, PHINode* phi)
+{
+    for (BasicBlock* pred : predecessors(phi->getParent()))
+    {
+        phi->addIncoming(read_variable(var, pred), pred);
+    }
+    return try_remove_trivial_phi(phi);
+}
+
+Value* Parser::try_remove_trivial_phi(PHINode* phi)
+{
+    Value* same = nullptr;
+    for (Value* op : phi->incoming_values())
+    {
+        // Unique value or self reference
+        if (op == same || op == phi) continue;
+        // The phi merges at least two values: not trivial
+        if (same != nullptr) return phi;
+        same = op;
+    }
+    // The phi is unreachable or in the entry block
+    if (same == nullptr) same = UndefValue::get(phi->getType());
+
+    // Other phis using this one might become trivial when it's removed.
+    // Value handles follow them (and same) through any replacements.
+    std::vector<WeakTrackingVH> phi_users;
+    for (User* user : phi->users())
+    {
+        if (user != phi && isa<PHINode>(user)) phi_users.push_back(user);
+    }
+    WeakTrackingVH same_handle(same);
+
+    // This also updates the variables' ssa_defs (they're value handles)
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+
+    for (WeakTrackingVH& user : phi_users)
+    {
+        if (PHINode* user_phi = dyn_cast_or_null<PHINode>(user))
+            try_remove_trivial_phi(user_phi);
+    }
+
+    return same_handle;
+}
+
+void Parser::seal_block(BasicBlock* block)
+{
+    std::vector<std::pair<SymTableEntry*, PHINode*>> phis 
+        = std::move(incomplete_phis[block]);
+    incomplete_phis.erase(block);
+
+    for (auto& incomplete : phis)
+    {
+        Value* val = add_phi_operands(incomplete.first, incomplete.second);
+        if (debug && val == incomplete.second) 
+            debug->set_phi_value(incomplete.first, incomplete.second);
+    }
+    sealed_blocks.insert(block);
+}
+
 std::unique_ptr<llvm::Module> Parser::parse() 
 {
+    if (procedure_cache) procedure_cache->start_compile();
+    std::string error;
+    if (streamer && !streamer->begin(*TheModule, options, error))
+    {
+        err_handler->reportError(error);
+        streamer = nullptr;
+    }
+    plan_parallel_parse();
     program();
+    finish_parallel_parse();
+    if (procedure_cache) procedure_cache->finish_parse(*TheModule);
+    if (debug) debug->finish();
+    return std::move(TheModule);
+}
+
+std::unique_ptr<llvm::Module> Parser::parse_procedure()
+{
+    symtable_manager->set_import_handler(
+        [this](SymTableEntry* entry) { import_symbol(entry); });
+
+    decl_builtins();
+    proc_declaration(false);
+
+    if (token() != TokenType::FILE_END)
+    {
+        std::ostringstream stream;
+        stream << "Unexpected token after procedure: " << TokenTypeStrings[token()];
+        err_handler->reportError(stream.str(), curr_token.line);
+    }
+
+    if (debug) debug->finish();
     return std::move(TheModule);
 }
 
+void Parser::set_procedure_cache(ProcedureCache* cache)
+{
+    procedure_cache = cache;
+}
+
+void Parser::set_streamer(ModuleStreamer* module_streamer)
+{
+    streamer = module_streamer;
+}
+
+void Parser::plan_parallel_parse()
+{
+    if (procedure_cache)
+    {
+        // Only the procedures that changed are parsed; 
+        //  that's done here, on this thread
+        procedure_ranges = scanner->find_top_level_procedures();
+        return;
+    }
+
+    // Procedures parsed in parallel only arrive at the end, 
+    //  so streaming parses them here as it goes
+    int threads = options.parse_threads;
+    if (threads == 1 || streamer) return;
+    if (threads <= 0)
+    {
+        if (scanner->get_source()->size() < PARALLEL_PARSE_MIN_BYTES) return;
+        threads = std::thread::hardware_concurrency();
+        if (threads < 2) return;
+    }
+
+    procedure_ranges = scanner->find_top_level_procedures();
+    if (procedure_ranges.size() < 2) return;
+
+    pool = make_unique<ProcedurePool>(options, filename);
+    pool_threads = threads;
+
+    // Diagnostics from the jobs get spliced in where their procedures are, 
+    //  so hold everything until the whole file is done
+    flush_diagnostics = !err_handler->is_buffered();
+    err_handler->set_buffered(true);
+}
+
+const SourceRange* Parser::top_level_range()
+{
+    if (procedure_ranges.empty() || symtable_manager->scope_depth() != 0) 
+        return nullptr;
+
+    // curr_token is the PROCEDURE token
+    while (next_procedure_range < procedure_ranges.size() 
+        && procedure_ranges[next_procedure_range].begin < (size_t)curr_token.offset)
+    {
+        next_procedure_range++;
+    }
+    if (next_procedure_range == procedure_ranges.size() 
+        || procedure_ranges[next_procedure_range].begin != (size_t)curr_token.offset)
+    {
+        // The pre-pass didn't find this one; just parse it here
+        return nullptr;
+    }
+
+    return &procedure_ranges[next_procedure_range++];
+}
+
+std::string Parser::procedure_text(const SourceRange& range)
+{
+    return scanner->get_source()->substr(range.begin, range.end - range.begin);
+}
+
+void Parser::start_procedure_jobs()
+{
+    if (!pool || pool_started) return;
+    pool_started = true;
+
+    // Declarations are done, so the global symbols are final
+    pool->start(pool_threads, scanner->get_source(), 
+        symtable_manager->snapshot_globals());
+}
+
+void Parser::finish_parallel_parse()
+{
+    if (!pool) return;
+
+    start_procedure_jobs();
+    pool->wait();
+
+    // One linker for every job; linkModules would set up a new one 
+    //  (which scans all of TheModule) per procedure
+    Linker linker(*TheModule);
+    for (auto& job : pool->get_jobs())
+    {
+        Expected<std::unique_ptr<Module>> module = parseBitcodeFile(
+            MemoryBufferRef(job->bitcode, "procedure"), TheContext);
+        if (!module)
+        {
+            err_handler->reportError("Couldn't load procedure module: " 
+                + toString(module.takeError()), job->range.line);
+            continue;
+        }
+
+        // Replaces the procedure's declaration with its definition
+        if (linker.linkInModule(std::move(*module)))
+        {
+            err_handler->reportError("Couldn't link procedure module", 
+                job->range.line);
+        }
+    }
+
+    if (flush_diagnostics) err_handler->flush();
+}
+
+void Parser::import_symbol(SymTableEntry* entry)
+{
+    // Only global variables get imported; declare them here
+    //  and linking the procedure's module will resolve them.
+    Type* type = llvm_type(entry->sym_type);
+    if (type == nullptr) return;
+    if (entry->is_arr) type = ArrayType::get(type, entry->arr_size);
+
+    entry->value = new GlobalVariable(*TheModule, type, false, 
+        GlobalValue::ExternalLinkage, nullptr, entry->id);
+}
+
+Type* Parser::llvm_type(SymbolType type)
+{
+    switch (type)
+    {
+    case S_STRING:
+        // Strings are char* (i8*)
+        return Type::getInt8PtrTy(TheContext);
+    case S_CHAR:
+        return Type::getInt8Ty(TheContext);
+    case S_INTEGER:
+        return Type::getInt32Ty(TheContext);
+    case S_FLOAT:
+        return Type::getFloatTy(TheContext);
+    case S_BOOL:
+        return Type::getInt1Ty(TheContext);
+    default:
+        return nullptr;
+    }
+}
+
+GlobalVariable* Parser::string_literal(int literal)
+{
+    auto it = string_literals.find(literal);
+    if (it != string_literals.end()) return it->second;
+
+    // Private and unnamed_addr: nothing outside the module can see it and
+    //  its address doesn't matter, so llvm and the linker can merge it
+    //  with other identical constants.
+    const std::string& str = scanner->literal_string(literal);
+    Constant* string_arr = ConstantDataArray::getString(TheContext, str, true);
+    GlobalVariable* string = new GlobalVariable(*TheModule,
+        string_arr->getType(),
+        true,
+        GlobalValue::PrivateLinkage,
+        string_arr,
+        ".str");
+    string->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    string->setAlignment(1);
+
+    string_literals[literal] = string;
+    return string;
+}
+
 void Parser::program()
 {
-    if (P_DEBUG) std::cout << "program" << '\n';
+    TRACE(TRACE_PARSER, "program");
 
     // Declare builtin functions in llvm file
     decl_builtins();
@@ -185,6 +551,9 @@ void Parser::program()
     // Create basic block of main
     BasicBlock *bb = BasicBlock::Create(TheContext, "entry", main);
     Builder.SetInsertPoint(bb);
+    sealed_blocks.insert(bb);
+    token();
+    if (debug) debug->begin_procedure(main, "main", curr_token.line, {});
 
     program_header(); 
     program_body(); 
@@ -193,23 +562,25 @@ void Parser::program()
     // Return 0 from the main function always
     Value *val = ConstantInt::get(TheContext, APInt(32, 0));
     Builder.CreateRet(val);
+    if (debug) debug->end_procedure();
+    TRACE(TRACE_CODEGEN, ir_string(*main));
 }
 
 void Parser::program_header()
 {
-    if (P_DEBUG) std::cout << "program header" << '\n';
+    TRACE(TRACE_PARSER, "program header");
 
     require(TokenType::RS_PROGRAM);
 
     require(TokenType::IDENTIFIER);
-    std::string program_name = curr_token.val.string_value;
+    const std::string& program_name = identifier_string(curr_token);
 
     require(TokenType::RS_IS);
 }
 
 void Parser::program_body()
 {
-    if (P_DEBUG) std::cout << "program body" << '\n';
+    TRACE(TRACE_PARSER, "program body");
 
     bool declarations = true;
     while (true)
@@ -218,6 +589,9 @@ void Parser::program_body()
         {
             advance();
             declarations = false;
+            // Top-level procedures can be parsed now that the 
+            //  global declarations are done
+            start_procedure_jobs();
             continue;
         }
         else if (token() == TokenType::RS_END)
@@ -226,6 +600,11 @@ void Parser::program_body()
             require(TokenType::RS_PROGRAM);
             return;
         }
+        else if (token() == TokenType::FILE_END)
+        {
+            err_handler->reportError("Reached end of file in program body", curr_token.line);
+            return;
+        }
         
         if (declarations) declaration();
         else statement();
@@ -236,7 +615,7 @@ void Parser::program_body()
 
 void Parser::declaration()
 {
-    if (P_DEBUG) std::cout << "declaration" << '\n';
+    TRACE(TRACE_PARSER, "declaration");
 
     bool is_global = false;
     if (token() == TokenType::RS_GLOBAL)
@@ -245,7 +624,7 @@ void Parser::declaration()
         advance();
     }
 
-    if (token() == TokenType::RS_PROCEDURE)
+    if (token() == TokenType::RS_PROCEDURE || token() == TokenType::RS_MEMOIZE)
     {
         proc_declaration(is_global);
     }
@@ -254,12 +633,15 @@ void Parser::declaration()
 
 void Parser::proc_declaration(bool is_global)
 {
-    if (P_DEBUG) std::cout << "proc decl" << '\n';
-
-    proc_header();
-    proc_body();
+    TRACE(TRACE_PARSER, "proc decl");
 
-    Builder.CreateRetVoid();
+    // Top-level procedures may be handed off to be parsed in parallel, 
+    //  or reused from an earlier compile
+    token();
+    const SourceRange* range = top_level_range();
+    if (range && pool) defer_procedure(*range);
+    else if (range && procedure_cache) cache_procedure(*range);
+    else define_procedure();
 
     // Reset to scope above this proc decl
     symtable_manager->reset_scope();
@@ -269,13 +651,167 @@ void Parser::proc_declaration(bool is_global)
     Builder.restoreIP(symtable_manager->get_insert_point());
 }
 
-void Parser::proc_header()
+void Parser::define_procedure()
+{
+    bool memoize = token() == TokenType::RS_MEMOIZE;
+    int line = curr_token.line;
+
+    proc_header();
+    proc_body();
+
+    return_results();
+    // (begun by proc_header)
+    if (debug) debug->end_procedure();
+    Function* F = symtable_manager->get_curr_proc_function();
+    Function* impl = memoize ? memoize_procedure(line) : nullptr;
+    TRACE(TRACE_CODEGEN, ir_string(*F));
+
+    if (streamer) stream_procedure(F, impl);
+}
+
+void Parser::defer_procedure(const SourceRange& range)
+{
+    ProcedureJob* job = pool->add_job(range);
+
+    // Only the header is parsed here (for the procedure's declaration). 
+    // The job reports the header's diagnostics as well as the body's
+    err_handler->defer_to(&job->diagnostics);
+    err_handler->set_muted(true);
+    proc_header(false);
+    err_handler->set_muted(false);
+
+    skip_procedure_body(range);
+}
+
+void Parser::cache_procedure(const SourceRange& range)
+{
+    std::string text = procedure_text(range);
+
+    // (debug info would put a procedure that moved on its old lines)
+    CachedProcedure* cached = procedure_cache->find(text, *symtable_manager,
+        options.debug_info ? range.line : 0);
+    if (cached)
+    {
+        // Same as the last compile: just declare it, 
+        //  then swap in the code from last time
+        err_handler->report_copies(cached->diagnostics, range.line - cached->line);
+        err_handler->set_muted(true);
+        proc_header(false);
+        err_handler->set_muted(false);
+
+        Function* F = procedure_cache->reuse(cached, 
+            symtable_manager->get_curr_proc_function(), *TheModule);
+        symtable_manager->set_curr_proc_function(F);
+
+        skip_procedure_body(range);
+        return;
+    }
+
+    // Parse it, keeping track of what it reports, what it looks up, 
+    //  and what it adds to the module
+    CachedProcedure procedure;
+    procedure.line = range.line;
+    std::vector<std::string> lookups;
+    err_handler->set_recorder(&procedure.diagnostics);
+    procedure.diagnostics.set_buffered(true);
+    symtable_manager->record_global_lookups(&lookups);
+
+    Function* last_function 
+        = TheModule->empty() ? nullptr : &TheModule->getFunctionList().back();
+    GlobalVariable* last_global 
+        = TheModule->global_empty() ? nullptr : &TheModule->getGlobalList().back();
+    // Each procedure gets its own string constants, so it can be moved alone
+    string_literals.clear();
+    evaluate_calls = false;
+
+    define_procedure();
+
+    evaluate_calls = true;
+    string_literals.clear();
+    symtable_manager->record_global_lookups(nullptr);
+    err_handler->set_recorder(nullptr);
+
+    auto function = last_function 
+        ? ++Module::iterator(last_function) : TheModule->begin();
+    for (; function != TheModule->end(); ++function)
+    {
+        procedure.globals.push_back(&*function);
+    }
+    auto global = last_global 
+        ? ++Module::global_iterator(last_global) : TheModule->global_begin();
+    for (; global != TheModule->global_end(); ++global)
+    {
+        procedure.globals.push_back(&*global);
+    }
+
+    procedure_cache->store(text, std::move(procedure), lookups, *symtable_manager);
+}
+
+Function* Parser::memoize_procedure(int line)
+{
+    for (SymTableEntry* param : symtable_manager->get_current_proc_params())
+    {
+        if (param->is_arr || param->sym_type == S_STRING)
+        {
+            err_handler->reportError("Memoized procedures can only have "
+                "parameters of scalar types (not arrays or strings)", line);
+            return nullptr;
+        }
+    }
+
+    Function* F = symtable_manager->get_curr_proc_function();
+    if (has_side_effects(F))
+    {
+        std::ostringstream stream;
+        stream << "Memoized procedure " << F->getName().str() 
+            << " uses global variables or builtins; its cached results may be wrong";
+        err_handler->reportWarning(stream.str(), line);
+    }
+    return ::memoize_procedure(F);
+}
+
+void Parser::stream_procedure(Function* F, Function* impl)
+{
+    // The evaluator (and memoize's side effect check) needs the bodies 
+    //  of procedures it could run, so those stay: only scalar 
+    //  parameters, and no builtins or globals
+    bool scalars = std::all_of(F->arg_begin(), F->arg_end(), [](Argument& arg) 
+        { return !arg.getType()->isPointerTy() && !arg.getType()->isArrayTy(); });
+    if (options.eval_steps > 0 && scalars && !has_side_effects(F)) return;
+
+    for (Function* function : {impl, F})
+    {
+        if (function == nullptr) continue;
+
+        // It's about to be freed
+        for (BasicBlock& block : *function)
+        {
+            sealed_blocks.erase(&block);
+            incomplete_phis.erase(&block);
+        }
+        allocations.forget(function);
+        evaluator.forget(function);
+        Function* declaration = streamer->emit(function);
+        if (function == F) symtable_manager->set_curr_proc_function(declaration);
+    }
+}
+
+void Parser::skip_procedure_body(const SourceRange& range)
+{
+    scanner->seek(range.end, range.end_line);
+    curr_token_valid = false;
+}
+
+void Parser::proc_header(bool define)
 {
-    if (P_DEBUG) std::cout << "proc header" << '\n';
+    TRACE(TRACE_PARSER, "proc header");
+    // Only the body cares (see memoize_procedure)
+    if (token() == TokenType::RS_MEMOIZE) advance();
+    int line = curr_token.line;
     require(TokenType::RS_PROCEDURE);
 
     // Setup symbol table so the procedure's sym table is now being used
-    std::string proc_id = require(TokenType::IDENTIFIER).val.string_value;
+    const std::string& proc_id = identifier_string(require(TokenType::IDENTIFIER));
 
     IRBuilderBase::InsertPoint ip = Builder.saveIP();
     symtable_manager->save_insert_point(ip);
@@ -293,68 +829,48 @@ void Parser::proc_header()
         = symtable_manager->get_current_proc_params();
 
     std::vector<Type*> param_type_vec;
+    std::vector<Type*> result_type_vec;
 
     for (auto param : params_vec)
     {
-        Type* param_type;
-        switch (param->sym_type)
+        Type* param_type = llvm_type(param->sym_type);
+        if (param_type == nullptr)
         {
-        case S_INTEGER:
-            // If param is type IN, pass by val
-            if (param->param_type == RS_IN)
-                param_type = Type::getInt32Ty(TheContext);
-            else
-                param_type = Type::getInt32PtrTy(TheContext);
-            break;
-        case S_FLOAT:
-            if (param->param_type == RS_IN)
-                param_type = Type::getFloatTy(TheContext);
-            else
-                param_type = Type::getFloatPtrTy(TheContext);
-            break;
-        case S_CHAR:
-            if (param->param_type == RS_IN)
-                param_type = Type::getInt8Ty(TheContext);
-            else
-                param_type = Type::getInt8PtrTy(TheContext);
-            break;
-        case S_BOOL:
-            if (param->param_type == RS_IN)
-                param_type = Type::getInt1Ty(TheContext);
-            else
-                param_type = Type::getInt1PtrTy(TheContext);
-            break;
-        case S_STRING:
-            // Strings must be i8* (char*), but if they are 
-            //  OUT or INOUT, then they are i8** because the
-            //  string that is pointed to by the variable can
-            //  be modified, not just the string itself
-            param_type = Type::getInt8PtrTy(TheContext);
-            if (param->param_type != RS_IN)
-                param_type = param_type->getPointerTo();
-            break;
-        default:
             err_handler->reportError("Invalid symbol type", curr_token.line);
-            break;
+            param_type = Type::getInt32Ty(TheContext);
         }
+
         if (param->is_arr) 
         {
-            if (PointerType* pointer_ty = dyn_cast<PointerType>(param_type))
-            {
-                param_type = pointer_ty->getElementType();
-                param_type = ArrayType::get(param_type, param->arr_size);
+            // Arrays are passed by value if they're IN, 
+            //  otherwise by reference
+            param_type = ArrayType::get(param_type, param->arr_size);
+            if (param->param_type != RS_IN)
                 param_type = param_type->getPointerTo();
-            }
-            else param_type = ArrayType::get(param_type, param->arr_size);
+        }
+        else if (param->param_type != RS_IN)
+        {
+            // OUT and INOUT values are returned (so they can stay in 
+            //  registers on both sides); only INOUT ones are passed in
+            result_type_vec.push_back(param_type);
+            if (param->param_type == RS_OUT) continue;
         }
         param_type_vec.push_back(param_type);
     }
 
+    // Nothing, the one result, or a struct of all of them
+    Type* return_type = Type::getVoidTy(TheContext);
+    if (result_type_vec.size() == 1) return_type = result_type_vec[0];
+    else if (result_type_vec.size() > 1) 
+        return_type = StructType::get(TheContext, result_type_vec);
+
     FunctionType *FT =
-        FunctionType::get(Type::getVoidTy(TheContext), param_type_vec, false);
+        FunctionType::get(return_type, param_type_vec, false);
 
+    // Nested procedures can only be called from their parent
     Function* F = Function::Create(FT, 
-        Function::ExternalLinkage, 
+        symtable_manager->scope_depth() > 1 
+            ? Function::InternalLinkage : Function::ExternalLinkage,
         proc_id, 
         TheModule.get());
 
@@ -363,36 +879,44 @@ void Parser::proc_header()
 
     symtable_manager->set_curr_proc_function(F);
 
+    // The body is being parsed somewhere else; the declaration is enough
+    if (!define) return;
+
     // Set IP to this function's basic block
     BasicBlock *bb = BasicBlock::Create(TheContext, "entry", F);
     Builder.SetInsertPoint(bb);
+    sealed_blocks.insert(bb);
+    if (debug) debug->begin_procedure(F, proc_id, line, params_vec);
 
     // Set arg names to their real ids
-    // Also, allocate pointers for pass-by-val params
-    int k = 0;
-    for (auto &arg : F->args())
+    // Scalar params are SSA variables, starting with the arg's value 
+    //  (OUT ones start out unset)
+    auto arg = F->arg_begin();
+    unsigned param_number = 0;
+    for (auto param : params_vec)
     {
-        if (isa<PointerType>(arg.getType()) || isa<ArrayType>(arg.getType()))
+        if (debug) debug->local_variable(param, line, ++param_number);
+        if (param->is_arr)
         {
-            // arg is already a pointer type
-            params_vec[k]->value = &arg;
+            param->value = &*arg;
+            if (debug && arg->getType()->isPointerTy()) 
+                debug->declare(param, &*arg);
+            else if (debug) debug->set_value(param, &*arg);
         }
         else
         {
-            // arg is a non-pointer type. 
-            // Allocate to pointer to use as a var
-            AllocaInst* ptr_arg = Builder.CreateAlloca(arg.getType());
-            // Store the argument value into the pointer
-            Builder.CreateStore(&arg, ptr_arg);
-            params_vec[k]->value = ptr_arg;
+            param->ssa_type = llvm_type(param->sym_type);
+            if (param->param_type == RS_OUT) continue;
+            write_variable(param, bb, &*arg);
+            if (debug) debug->set_value(param, &*arg);
         }
-        arg.setName(params_vec[k++]->id);
+        (arg++)->setName(param->id);
     }
 }
 
 void Parser::proc_body()
 {
-    if (P_DEBUG) std::cout << "proc body" << '\n';
+    TRACE(TRACE_PARSER, "proc body");
     bool declarations = true;
     while (true)
     {
@@ -408,6 +932,11 @@ void Parser::proc_body()
             require(TokenType::RS_PROCEDURE);
             return;
         }
+        else if (token() == TokenType::FILE_END)
+        {
+            err_handler->reportError("Reached end of file in procedure body", curr_token.line);
+            return;
+        }
         
         if (declarations) declaration();
         else statement();
@@ -418,7 +947,7 @@ void Parser::proc_body()
 
 void Parser::parameter_list()
 {
-    if (P_DEBUG) std::cout << "param list" << '\n';
+    TRACE(TRACE_PARSER, "param list");
     while (true)
     {
         parameter(); 
@@ -433,7 +962,7 @@ void Parser::parameter_list()
 
 void Parser::parameter()
 {
-    if (P_DEBUG) std::cout << "param" << '\n';
+    TRACE(TRACE_PARSER, "param");
 
     SymTableEntry* entry = var_declaration(false, false);
 
@@ -454,15 +983,21 @@ void Parser::parameter()
 //  need_alloc==false for parameter variable declarations
 SymTableEntry* Parser::var_declaration(bool is_global, bool need_alloc)
 {
-    if (P_DEBUG) std::cout << "var decl" << '\n';
+    TRACE(TRACE_PARSER, "var decl");
     // This is the only place in grammar type mark occurs 
     //  so it doesn't need its own function
     TokenType typemark = token();
     advance();
 
-    std::string id = require(TokenType::IDENTIFIER).val.string_value;
+    const std::string& id = identifier_string(require(TokenType::IDENTIFIER));
     SymTableEntry* entry = symtable_manager->resolve_symbol(id, false);
-    if (entry != NULL && entry->sym_type != S_UNDEFINED)
+    if (entry == NULL)
+    {
+        // Not seen in this scope (or globally) yet
+        symtable_manager->add_symbol(false, id, IDENTIFIER);
+        entry = symtable_manager->resolve_symbol(id, false);
+    }
+    else if (entry->sym_type != S_UNDEFINED)
     {
         std::ostringstream stream;
         stream << "Variable " << id << " may have already been defined the local or global scope.";
@@ -561,12 +1096,25 @@ SymTableEntry* Parser::var_declaration(bool is_global, bool need_alloc)
             // Initializer (all zero)
             global->setInitializer(ConstantAggregateZero::get(allocation_type));
             entry->value = global;
+            if (debug) debug->global_variable(entry, global, curr_token.line);
+        }
+        else if (!entry->is_arr)
+        {
+            // Scalar locals don't need any space; 
+            //  they're SSA values (see read_variable)
+            entry->ssa_type = allocation_type;
+            if (debug) debug->local_variable(entry, curr_token.line);
         }
         else
         {
             // Allocate space for this variable 
-            entry->value 
-                = Builder.CreateAlloca(allocation_type, nullptr, id);
+            entry->value = allocations.entry_alloca(
+                symtable_manager->get_curr_proc_function(), allocation_type, id);
+            if (debug)
+            {
+                debug->local_variable(entry, curr_token.line);
+                debug->declare(entry, entry->value);
+            }
         }
     }
     return entry;
@@ -574,7 +1122,7 @@ SymTableEntry* Parser::var_declaration(bool is_global, bool need_alloc)
 
 int Parser::lower_bound()
 {
-    if (P_DEBUG) std::cout << "lower_bound" << '\n';
+    TRACE(TRACE_PARSER, "lower_bound");
     // Minus allowed in spec now
     bool negative = false;
     if (token() == TokenType::MINUS) 
@@ -589,7 +1137,7 @@ int Parser::lower_bound()
 
 int Parser::upper_bound()
 {
-    if (P_DEBUG) std::cout << "upper_bound" << '\n';
+    TRACE(TRACE_PARSER, "upper_bound");
     // Minus allowed in spec now
     bool negative = false;
     if (token() == TokenType::MINUS) 
@@ -604,7 +1152,7 @@ int Parser::upper_bound()
 
 bool Parser::statement()
 {
-    if (P_DEBUG) std::cout << "stmnt" << '\n';
+    TRACE(TRACE_PARSER, "stmnt");
 
     if (token() == TokenType::IDENTIFIER)
         identifier_statement();
@@ -612,10 +1160,15 @@ bool Parser::statement()
         if_statement();
     else if (token() == TokenType::RS_FOR)
         loop_statement();
+    else if (token() == TokenType::RS_CASE)
+        case_statement();
     else if (token() == TokenType::RS_RETURN)
         return_statement();
     else return false;
 
+    // Temporaries only live for one statement
+    allocations.release_temps();
+
     return true;
 }
 
@@ -623,10 +1176,10 @@ bool Parser::statement()
 //  start with an identifier
 void Parser::identifier_statement()
 {
-    if (P_DEBUG) std::cout << "identifier stmnt" << '\n';
+    TRACE(TRACE_PARSER, "identifier stmnt");
     // Advance to next token; returning the current token
     //  and retrieving the identifier value
-    std::string identifier = advance().val.string_value;
+    const std::string& identifier = identifier_string(advance());
     
     if (token() == TokenType::L_PAREN)
     {
@@ -638,9 +1191,9 @@ void Parser::identifier_statement()
     }
 }
 
-void Parser::assignment_statement(std::string identifier)
+void Parser::assignment_statement(const std::string& identifier)
 {
-    if (P_DEBUG) std::cout << "assignment stmnt" << '\n';
+    TRACE(TRACE_PARSER, "assignment stmnt");
 
     // RS_OUT - we want to write to this variable
     SymTableEntry* entry = symtable_manager->resolve_symbol(identifier, true, RS_OUT); 
@@ -650,11 +1203,26 @@ void Parser::assignment_statement(std::string identifier)
     if (token() == TokenType::L_BRACKET)
     {
         advance();
-        Value* raw_idx = expression(Type::getInt32Ty(TheContext));
+        idx = expression(Type::getInt32Ty(TheContext));
         require(TokenType::R_BRACKET);
-        // Normalize index (subtract lower bound from index)
-        idx = Builder.CreateSub(raw_idx, ConstantInt::get(TheContext, 
-            APInt(32, entry->lower_b)));
+        if (!entry->is_arr)
+        {
+            err_handler->reportError("Cannot index a non-array variable", 
+                curr_token.line);
+        }
+    }
+
+    if (entry->ssa_type != nullptr)
+    {
+        require(TokenType::ASSIGNMENT);
+
+        // The variable's new value in this block
+        Value* rhs = expression(entry->ssa_type);
+        // (If rhs couldn't be converted, the error's been reported)
+        if (rhs == nullptr) return;
+        write_variable(entry, Builder.GetInsertBlock(), rhs);
+        if (debug) debug->set_value(entry, rhs);
+        return;
     }
 
     Value* lhs = entry->value;
@@ -678,6 +1246,10 @@ void Parser::assignment_statement(std::string identifier)
         }
         else
         {
+            // Normalize index (subtract lower bound from index)
+            idx = Builder.CreateSub(idx, ConstantInt::get(TheContext, 
+                APInt(32, entry->lower_b)));
+
             // Index with: [0, idx]
             const std::vector<Value*> GEPIdxs 
                 {ConstantInt::get(TheContext, APInt(64, 0)), idx};
@@ -696,9 +1268,9 @@ void Parser::assignment_statement(std::string identifier)
     Builder.CreateStore(rhs, lhs);
 }
 
-void Parser::proc_call(std::string identifier)
+void Parser::proc_call(const std::string& identifier)
 {
-    if (P_DEBUG) std::cout << "proc call" << '\n';
+    TRACE(TRACE_PARSER, "proc call");
     // already have identifier
 
     // Check symtable for the proc
@@ -715,130 +1287,205 @@ void Parser::proc_call(std::string identifier)
 
 
     std::vector<Value*> arg_list;
+    std::vector<ByRefCopy> copies;
+    std::vector<ResultTarget> targets;
     require(TokenType::L_PAREN);
     if (token() != TokenType::R_PAREN)
-        arg_list = argument_list(proc_entry);
+        arg_list = argument_list(proc_entry, copies, targets);
     require(TokenType::R_PAREN);
 
-    Builder.CreateCall(proc_entry->function, arg_list);
+    // A call that can be run now is replaced by its results
+    Value* returned;
+    Constant* result;
+    if (evaluate_calls 
+        && evaluator.evaluate(proc_entry->function, arg_list, result))
+    {
+        TRACE(TRACE_CODEGEN, "evaluated call to " << identifier);
+        returned = result;
+    }
+    else returned = Builder.CreateCall(proc_entry->function, arg_list);
+
+    // Hand the returned OUT and INOUT values to their arguments
+    for (size_t k = 0; k < targets.size(); k++)
+    {
+        Value* value = targets.size() == 1 
+            ? returned : Builder.CreateExtractValue(returned, k);
+        if (targets[k].var)
+        {
+            write_variable(targets[k].var, Builder.GetInsertBlock(), value);
+            if (debug) debug->set_value(targets[k].var, value);
+        }
+        else if (targets[k].pointer)
+            Builder.CreateStore(value, targets[k].pointer);
+    }
+
+    // Copy the results back out to the SSA variables passed by reference
+    for (auto& copy : copies)
+    {
+        Value* value = Builder.CreateLoad(copy.slot, copy.var->id);
+        write_variable(copy.var, Builder.GetInsertBlock(), value);
+        if (debug) debug->set_value(copy.var, value);
+    }
 }
 
-std::vector<Value*> Parser::argument_list(SymTableEntry* proc_entry)
+std::vector<Value*> Parser::argument_list(SymTableEntry* proc_entry, 
+                                            std::vector<ByRefCopy>& copies,
+                                            std::vector<ResultTarget>& targets)
 {
-    if (P_DEBUG) std::cout << "arg list" << '\n';
+    TRACE(TRACE_PARSER, "arg list");
 
     std::vector<Value*> vec;
 
     Function* f = proc_entry->function;
-    int parmidx = 0;
-    for (auto& parm : f->args())
+    // Builtins still take their OUT parameters by reference
+    bool returns_results = !f->getReturnType()->isVoidTy();
+    auto parm = f->arg_begin();
+    for (SymTableEntry* param : proc_entry->parameters)
     {
-        Value* param_val;
-
-        // Parse an expression for a by ref type
-        // Params need to be pointers for pass by ref (out or inout)
-        if (PointerType* ptr_ty = dyn_cast<PointerType>(parm.getType()))
+        if (returns_results && is_result(param))
+        {
+            // INOUT values are passed in too
+            if (param->param_type == RS_INOUT) ++parm;
+            targets.push_back(result_argument(param, vec));
+        }
+        else
         {
-            if (proc_entry->parameters[(parmidx)]->sym_type == S_STRING)
+            Value* param_val;
+
+            // Parse an expression for a by ref type
+            // Params need to be pointers for pass by ref (out or inout)
+            if (PointerType* ptr_ty = dyn_cast<PointerType>(parm->getType()))
             {
-                // It's a string. 
-                if (proc_entry->parameters[(parmidx)]->param_type == RS_IN)
+                if (param->sym_type == S_STRING && param->param_type == RS_IN)
                 {
-                    // Pass by value. Expect i8*
+                    // A string passed by value. Expect i8*
                     param_val = expression(ptr_ty);
                 }
-                else
+                else 
                 {
-                    // Pass by ref. Expect i8* but convert to i8**
-                    Type* real_type = ptr_ty->getElementType();
-
-                    Value* expr_result = expression(real_type);
-                    if (auto *ptr = dyn_cast<LoadInst>(expr_result))
-                    {
-                        // val is a pointer type, just use the raw pointer (pass by ref)
-                        param_val = ptr->getPointerOperand();
-                    }
-                    else
-                    {
-                        // We need to get
-                        //  a pointer to the value the expression returns then we
-                        //  can pass that into the function call
-                        param_val = Builder.CreateAlloca(real_type);
-                        // Store val into valptr
-                        Builder.CreateStore(expr_result, param_val);
-                    }
+                    // The type is a pointer to a basic variable (or an 
+                    //  array, or i8** for a string).
+                    // This case is for pass by ref 
+                    param_val = by_ref_argument(ptr_ty->getElementType(), 
+                        param->param_type, copies);
                 }
             }
             else 
             {
-                // The type is a pointer to a basic variable.
-                // This case is for pass by ref 
-                Type* real_type = ptr_ty->getElementType();
+                // Parameter is an IN type (pass by value)
+                param_val = expression(parm->getType());
+            }
 
-                Value* expr_result = expression(real_type);
-                if (auto *ptr = dyn_cast<LoadInst>(expr_result))
-                {
-                    // val is a pointer type, just use the raw pointer (pass by ref)
-                    param_val = ptr->getPointerOperand();
-                }
-                else
-                {
-                    // We need to get
-                    //  a pointer to the value the expression returns then we
-                    //  can pass that into the function call
-                    param_val = Builder.CreateAlloca(real_type);
-                    // Store val into valptr
-                    Builder.CreateStore(expr_result, param_val);
-                }
-            }
+            vec.push_back(checked_argument(parm->getType(), param_val)); 
+            ++parm;
         }
-        else if (ArrayType* arr_ty = dyn_cast<ArrayType>(parm.getType()))
-        {
-            // It's an array
-            Value* expr_result = expression(arr_ty);
-            param_val = expr_result;
-        }
-        else 
+
+        if (token() == TokenType::COMMA) 
         {
-            // Parameter is an IN type (pass by value)
-            param_val = expression(parm.getType());
+            advance();
+            continue;
         }
+        else break;
+    }
 
-        // Expression should do type conversion.
-        // If it's not the right type now, it probably can't be converted.
-        if (parm.getType() != param_val->getType())
-        {
+    return vec;
+}
 
-            std::string str;
-            raw_string_ostream rso(str);
+// Parse an OUT or INOUT argument, which gets the value the call returns 
+//  for it; an INOUT one's value is also added to args
+Parser::ResultTarget Parser::result_argument(SymTableEntry* param, 
+                                            std::vector<Value*>& args)
+{
+    Type* type = llvm_type(param->sym_type);
+    lvalue_entry = nullptr;
+    Value* expr_result = checked_argument(type, expression(type));
+    if (param->param_type == RS_INOUT) args.push_back(expr_result);
 
-            rso << "Procedure call paramater type doesn't match expected type. req'd: ";
-            parm.getType()->print(rso, false);
-            rso << " got: ";
-            param_val->getType()->print(rso, false);
+    if (lvalue_entry != nullptr && expr_result == lvalue_value)
+    {
+        // An SSA variable just takes the new value
+        return {lvalue_entry, nullptr};
+    }
+    else if (LoadInst* load = dyn_cast<LoadInst>(expr_result))
+    {
+        // A variable in memory: store to where it was loaded from 
+        //  (an OUT argument's old value isn't needed)
+        Value* pointer = load->getPointerOperand();
+        if (param->param_type == RS_OUT) load->eraseFromParent();
+        return {nullptr, pointer};
+    }
+    // Not a variable; the result is dropped
+    return {nullptr, nullptr};
+}
+
+Value* Parser::checked_argument(Type* expected, Value* arg)
+{
+    // Expression should do type conversion.
+    // If it's not the right type now, it probably can't be converted.
+    // (Null if it couldn't be; that's been reported already)
+    if (arg == nullptr) return UndefValue::get(expected);
+    if (expected == arg->getType()) return arg;
 
-            rso.flush();
+    std::string str;
+    raw_string_ostream rso(str);
 
-            err_handler->reportError(str, curr_token.line);
-        }
+    rso << "Procedure call paramater type doesn't match expected type. req'd: ";
+    expected->print(rso, false);
+    rso << " got: ";
+    arg->getType()->print(rso, false);
 
-        vec.push_back(param_val); 
-        parmidx++;
+    rso.flush();
 
-        if (token() == TokenType::COMMA) 
+    err_handler->reportError(str, curr_token.line);
+    return UndefValue::get(expected);
+}
+
+// Parse an argument passed by reference; returns the pointer to pass
+Value* Parser::by_ref_argument(Type* real_type, TokenType param_type, 
+                                std::vector<ByRefCopy>& copies)
+{
+    lvalue_entry = nullptr;
+    Value* expr_result = expression(real_type);
+
+    if (lvalue_entry != nullptr && expr_result == lvalue_value)
+    {
+        // The argument is an SSA variable. Pass a copy of it,
+        //  which is copied back to the variable after the call.
+        // The same variable passed twice shares one copy.
+        for (auto& copy : copies)
         {
-            advance();
-            continue;
+            if (copy.var == lvalue_entry) return copy.slot;
         }
-        else break;
-    }
 
-    return vec;
+        AllocaInst* slot = allocations.temp_slot(
+            symtable_manager->get_curr_proc_function(), real_type);
+        if (!isa<UndefValue>(expr_result))
+            Builder.CreateStore(expr_result, slot);
+        if (param_type != RS_IN)
+            copies.push_back({lvalue_entry, slot});
+        return slot;
+    }
+    else if (auto *ptr = dyn_cast<LoadInst>(expr_result))
+    {
+        // val is a pointer type, just use the raw pointer (pass by ref)
+        return ptr->getPointerOperand();
+    }
+    else
+    {
+        // We need to get
+        //  a pointer to the value the expression returns then we
+        //  can pass that into the function call
+        Value* param_val = allocations.temp_slot(
+            symtable_manager->get_curr_proc_function(), real_type);
+        // Store val into valptr
+        Builder.CreateStore(expr_result, param_val);
+        return param_val;
+    }
 }
 
 void Parser::if_statement()
 {
-    if (P_DEBUG) std::cout << "if" << '\n';
+    TRACE(TRACE_PARSER, "if");
     require(TokenType::RS_IF);
 
     require(TokenType::L_PAREN);
@@ -854,6 +1501,8 @@ void Parser::if_statement()
     BasicBlock* after_block = BasicBlock::Create(TheContext, "after");
 
     Builder.CreateCondBr(condition, then_block, else_block);
+    seal_block(then_block);
+    seal_block(else_block);
 
     Builder.SetInsertPoint(then_block);
 
@@ -899,6 +1548,8 @@ void Parser::if_statement()
 
     TheFunction->getBasicBlockList().push_back(after_block);
     Builder.SetInsertPoint(after_block);
+    // Both branches are done
+    seal_block(after_block);
     
     require(TokenType::RS_END);
     require(TokenType::RS_IF);
@@ -906,17 +1557,17 @@ void Parser::if_statement()
 
 void Parser::loop_statement()
 {
-    if (P_DEBUG) std::cout << "for" << '\n';
+    TRACE(TRACE_PARSER, "for");
     require(TokenType::RS_FOR);
 
     require(TokenType::L_PAREN);
     require(TokenType::IDENTIFIER);
-    assignment_statement(curr_token.val.string_value); 
+    assignment_statement(identifier_string(curr_token)); 
     require(TokenType::SEMICOLON);
 
     Function* TheFunction = symtable_manager->get_curr_proc_function();
     
-    BasicBlock* start_loop_block = BasicBlock::Create(TheContext, "start_loop", TheFunction);
+    BasicBlock* start_loop_block = BasicBlock::Create(TheContext, "start_loop");
     BasicBlock* loop_stmnts_block = BasicBlock::Create(TheContext, "loop_stmnts");
     BasicBlock* after_loop_block = BasicBlock::Create(TheContext, "after_loop");
 
@@ -933,6 +1584,8 @@ void Parser::loop_statement()
 
     // Branch to statements or after loop denepding on condition
     Builder.CreateCondBr(condition, loop_stmnts_block, after_loop_block);
+    seal_block(loop_stmnts_block);
+    seal_block(after_loop_block);
 
     // Begin for statements block
     TheFunction->getBasicBlockList().push_back(loop_stmnts_block);
@@ -948,6 +1601,8 @@ void Parser::loop_statement()
 
     // End of for statements; jmp to beginning of for (to check expr)
     Builder.CreateBr(start_loop_block);
+    // The jump back is the loop start's last predecessor
+    seal_block(start_loop_block);
     
     // Begin block after for
     TheFunction->getBasicBlockList().push_back(after_loop_block);
@@ -957,18 +1612,150 @@ void Parser::loop_statement()
     require(TokenType::RS_FOR);
 }
 
+// case <expression> is
+//   when <integer> [, <integer>]... then <statements>
+//   ...
+//   [else <statements>]
+// end case
+void Parser::case_statement()
+{
+    TRACE(TRACE_PARSER, "case");
+    require(TokenType::RS_CASE);
+
+    Value* selector = expression(Type::getInt32Ty(TheContext));
+    require(TokenType::RS_IS);
+
+    Function* TheFunction = symtable_manager->get_curr_proc_function();
+
+    BasicBlock* else_block = BasicBlock::Create(TheContext, "case_else");
+    BasicBlock* after_block = BasicBlock::Create(TheContext, "after_case");
+
+    // llvm lowers the switch to a jump table, binary search, etc.
+    SwitchInst* switch_inst = Builder.CreateSwitch(selector, else_block);
+    seal_block(else_block);
+
+    if (token() != TokenType::RS_WHEN)
+    {
+        err_handler->reportError("Expected WHEN in CASE statement", curr_token.line);
+    }
+
+    while (token() == TokenType::RS_WHEN)
+    {
+        advance();
+
+        BasicBlock* when_block = BasicBlock::Create(TheContext, "when", TheFunction);
+        while (true)
+        {
+            int line = curr_token.line;
+            ConstantInt* label = ConstantInt::get(TheContext, 
+                APInt(32, case_label(), true));
+            if (switch_inst->findCaseValue(label) != switch_inst->case_default())
+            {
+                std::ostringstream stream;
+                stream << "Duplicate case value: " << label->getSExtValue();
+                err_handler->reportError(stream.str(), line);
+            }
+            else switch_inst->addCase(label, when_block);
+
+            if (token() != TokenType::COMMA) break;
+            advance();
+        }
+        require(TokenType::RS_THEN);
+
+        // All of this block's labels are known
+        seal_block(when_block);
+        Builder.SetInsertPoint(when_block);
+        case_body();
+        Builder.CreateBr(after_block);
+    }
+
+    TheFunction->getBasicBlockList().push_back(else_block);
+    Builder.SetInsertPoint(else_block);
+    if (token() == TokenType::RS_ELSE)
+    {
+        advance();
+        case_body();
+    }
+    Builder.CreateBr(after_block);
+
+    TheFunction->getBasicBlockList().push_back(after_block);
+    Builder.SetInsertPoint(after_block);
+    seal_block(after_block);
+
+    require(TokenType::RS_END);
+    require(TokenType::RS_CASE);
+}
+
+// An integer constant, possibly negative
+int Parser::case_label()
+{
+    bool negative = false;
+    if (token() == TokenType::MINUS) 
+    {
+        negative = true;
+        advance();
+    }
+    int val = require(TokenType::INTEGER).val.int_value;
+    if (negative) val = -val;
+    return val;
+}
+
+// Statements up to the next WHEN, ELSE or END
+void Parser::case_body()
+{
+    bool first_stmnt = true;
+    while (token() != TokenType::RS_WHEN && token() != TokenType::RS_ELSE
+        && token() != TokenType::RS_END && token() != TokenType::FILE_END)
+    {
+        bool valid = statement();
+        if (!valid)
+        {
+            std::ostringstream stream;
+            stream << "Invalid statement in CASE body: " << TokenTypeStrings[token()];
+            err_handler->reportError(stream.str(), curr_token.line);
+            advance();
+            continue;
+        }
+        require(TokenType::SEMICOLON);
+        first_stmnt = false;
+    }
+    if (first_stmnt)
+    {
+        err_handler->reportError("No statement in CASE body", curr_token.line);
+    }
+}
+
 void Parser::return_statement()
 {
-    if (P_DEBUG) std::cout << "return" << '\n';
+    TRACE(TRACE_PARSER, "return");
     require(TokenType::RS_RETURN);
 
-    Builder.CreateRetVoid();
+    return_results();
 
     // If there are any statements are after the return, they are unreachable
     BasicBlock* unreachable = BasicBlock::Create(TheContext, "unreachable");
     symtable_manager->get_curr_proc_function()->getBasicBlockList()
         .push_back(unreachable);
     Builder.SetInsertPoint(unreachable);
+    // Nothing jumps here
+    seal_block(unreachable);
+}
+
+void Parser::return_results()
+{
+    Function* F = symtable_manager->get_curr_proc_function();
+    std::vector<Value*> results;
+    for (SymTableEntry* param : symtable_manager->get_current_proc_params())
+    {
+        if (is_result(param)) 
+            results.push_back(read_variable(param, Builder.GetInsertBlock()));
+    }
+
+    if (F->getReturnType()->isVoidTy()) Builder.CreateRetVoid();
+    // The program body (main)
+    else if (results.empty()) Builder.CreateRet(Builder.getInt32(0));
+    else if (results.size() == 1) Builder.CreateRet(results[0]);
+    else Builder.CreateAggregateRet(results.data(), results.size());
 }
 
 // hintType - the expected type (e.g. if this is an assignment)
@@ -976,20 +1763,20 @@ void Parser::return_statement()
 //  (if type conversion is needed)
 Value* Parser::expression(Type* hintType)
 {
-    if (P_DEBUG) std::cout << "expr" << '\n';
+    TRACE(TRACE_PARSER, "expr");
 
     Value* retval;
 
-    // arith_op is required and defined as:
-    //  relation, arith_op_pr
-    // expression_pr is completely optional; defined as:
-    //  either & or |, arith_op, expression_pr
+    // expression is a chain of arith_ops joined by & or |; 
+    //  arith_op, relation and term are the tighter binding levels below it.
+    // All of them are parsed by binary_expression using the level table.
 
     if (token() == TokenType::RS_NOT)
     {
         // not <arith_op>
         advance();
-        Value* val = arith_op(hintType);
+        Value* val = binary_expression(OP_ARITH, hintType);
+        lvalue_entry = nullptr;
         if (val->getType()->isIntegerTy(32))
         {
             retval = Builder.CreateXor(val, ConstantInt::get(TheContext, APInt(32, -1)));
@@ -1008,14 +1795,7 @@ Value* Parser::expression(Type* hintType)
     }
     else 
     {
-        // Because arith_op is required to result in something, take its value
-        //  and give it to expression_pr. expression_pr will return that value,
-        //  either modified with its operation (& or |) and another arith_op, 
-        //  (and optionally another expression_pr, and so on...)
-        //  OR, expression_pr(val) will just return val unmodified 
-        //  if there is no operator & or | as the first token.
-        Value* val = arith_op(hintType); 
-        retval = expression_pr(val, hintType);
+        retval = binary_expression(OP_EXPRESSION, hintType);
     }
 
     // Type conversion to expected type before returning from expression.
@@ -1027,306 +1807,363 @@ Value* Parser::expression(Type* hintType)
     return retval;
 }
 
-// lhs - left hand side of this operation. 
-Value* Parser::expression_pr(Value* lhs, Type* hintType)
+// Parses a chain of binary operators that bind at least as tightly as 
+//  min_level (precedence climbing). All operators are left associative.
+// Left operands waiting on a tighter binding right side are kept on 
+//  pending_ops rather than the call stack, so long chains of operators 
+//  are parsed in constant stack space. 
+// Code for each operator is emitted in the same order the recursive 
+//  descent grammar would emit it.
+Value* Parser::binary_expression(OpLevel min_level, Type* hintType)
 {
-    if (P_DEBUG) std::cout << "expr prime" << '\n';
+    TRACE(TRACE_PARSER, "binary expr");
 
+    // Nested expressions (parentheses, array indexes) share pending_ops;
+    //  this call only touches entries above base.
+    size_t base = pending_ops.size();
 
-    if (token() == TokenType::AND
-        || token() == TokenType::OR)
+    Value* rhs = factor(hintType);
+    while (true)
     {
-        TokenType op = advance().type;
+        OpLevel level = binary_op_level(token());
+        if (level < min_level) level = OP_NONE;
 
-        Value* rhs = arith_op(hintType);
-
-        // If one is a bool and one an int, convert
-        if (lhs->getType() == Type::getInt1Ty(TheContext) 
-            && rhs->getType() == Type::getInt32Ty(TheContext))
-        {
-            if (hintType == Type::getInt1Ty(TheContext))
-                rhs = convert_type(rhs, Type::getInt1Ty(TheContext));
-            else 
-                lhs = convert_type(lhs, Type::getInt32Ty(TheContext));
-        }
-        else if (lhs->getType() == Type::getInt32Ty(TheContext) 
-            && rhs->getType() == Type::getInt1Ty(TheContext))
-        {
-            if (hintType == Type::getInt1Ty(TheContext))
-                lhs = convert_type(lhs, Type::getInt1Ty(TheContext));
-            else 
-                rhs = convert_type(rhs, Type::getInt32Ty(TheContext));
-        }
-        else if (lhs->getType() != rhs->getType()
-                    && lhs->getType() != Type::getInt1Ty(TheContext) 
-                    && lhs->getType() != Type::getInt32Ty(TheContext))
+        // Apply every pending operator that binds at least as tightly as
+        //  the next one; its right hand side is complete now.
+        while (pending_ops.size() > base && pending_ops.back().level >= level)
         {
-            // Types aren't the same or aren't both bool/int
-            err_handler->reportError("Bitwise or boolean operations are only defined on bool and integer types", curr_token.line);
+            PendingOp pending = pending_ops.back();
+            pending_ops.pop_back();
+            if (pending.end_block != nullptr)
+                rhs = end_short_circuit(pending, rhs);
+            else
+                rhs = apply_binary_op(pending.level, pending.op, 
+                        pending.lhs, rhs, hintType);
         }
 
-        Value* result;
-        if (op == TokenType::AND)
-            result = Builder.CreateAnd(lhs, rhs);
-        else
-            result = Builder.CreateOr(lhs, rhs);
+        if (level == OP_NONE) break;
 
-        return expression_pr(result, hintType);
+        TokenType op = advance().type;
+        if (level == OP_EXPRESSION && rhs->getType()->isIntegerTy(1)
+            && hintType == Type::getInt1Ty(TheContext))
+        {
+            // Logical & or |; the right side might not need to run
+            pending_ops.push_back(begin_short_circuit(rhs, op));
+        }
+        else pending_ops.push_back({rhs, op, level, nullptr, nullptr});
+        rhs = factor(hintType);
     }
 
-    // No operation performed; return lhs unmodified.
-    else return lhs;
+    return rhs;
 }
 
-Value* Parser::arith_op(Type* hintType)
+Value* Parser::apply_binary_op(OpLevel level, TokenType op, 
+                                Value* lhs, Value* rhs, Type* hintType)
 {
-    if (P_DEBUG) std::cout << "arith op" << '\n';
-
-    Value* val = relation(hintType);
-    return arith_op_pr(val, hintType);
+    lvalue_entry = nullptr;
+    switch (level)
+    {
+    case OP_EXPRESSION:
+        return expression_op(op, lhs, rhs, hintType);
+    case OP_ARITH:
+        return arith_op(op, lhs, rhs, hintType);
+    case OP_RELATION:
+        return relation_op(op, lhs, rhs, hintType);
+    case OP_TERM:
+        return term_op(op, lhs, rhs, hintType);
+    default:
+        // Not a binary operator; this shouldn't happen
+        return lhs;
+    }
 }
 
-Value* Parser::arith_op_pr(Value* lhs, Type* hintType)
+Parser::PendingOp Parser::begin_short_circuit(Value* lhs, TokenType op)
 {
-    if (P_DEBUG) std::cout << "arith op pr" << '\n';
+    Function* TheFunction = symtable_manager->get_curr_proc_function();
 
-    if (token() == TokenType::PLUS || token() == TokenType::MINUS)
-    {
-        // Advance and save current token's operator.
-        TokenType op = advance().type;
+    BasicBlock* lhs_block = Builder.GetInsertBlock();
+    BasicBlock* rhs_block = BasicBlock::Create(TheContext, "rhs", TheFunction);
+    BasicBlock* end_block = BasicBlock::Create(TheContext, "end_rhs");
 
-        Value* rhs = relation(hintType); 
+    // false & ... is false; true | ... is true
+    if (op == TokenType::AND)
+        Builder.CreateCondBr(lhs, rhs_block, end_block);
+    else
+        Builder.CreateCondBr(lhs, end_block, rhs_block);
 
-        // Type conversion
+    seal_block(rhs_block);
+    Builder.SetInsertPoint(rhs_block);
 
-        // If one is int and one is float, 
-        //  convert all to float to get the most precision.
-        // Any other types can't be used here.
-        if (lhs->getType() == Type::getInt32Ty(TheContext) 
-            && rhs->getType() == Type::getFloatTy(TheContext))
-        {
-            // Convert lhs to float
-            lhs = convert_type(lhs, Type::getFloatTy(TheContext));
-        }
-        else if (lhs->getType() == Type::getFloatTy(TheContext) 
-            && rhs->getType() == Type::getInt32Ty(TheContext))
-        {
-            // Convert rhs to float
-            rhs = convert_type(rhs, Type::getFloatTy(TheContext));
-        }
-        else if (lhs->getType() != rhs->getType() 
-                    && lhs->getType() != Type::getFloatTy(TheContext)
-                    && lhs->getType() != Type::getInt32Ty(TheContext))
-        {
-            // Types aren't the same or aren't both float/int
-            err_handler->reportError("Arithmetic operations are only defined on float and integer types", curr_token.line);
-            // TODO: Return?
-        }
+    return {lhs, op, OP_EXPRESSION, lhs_block, end_block};
+}
 
-        Value* result;
-        if (op == TokenType::PLUS)
-        {
-            if (lhs->getType()->isFloatTy())
-                result = Builder.CreateFAdd(lhs, rhs);
-            else
-                result = Builder.CreateAdd(lhs, rhs);
-        }
-        else
-        {
-            if (lhs->getType()->isFloatTy())
-                result = Builder.CreateFSub(lhs, rhs);
-            else
-                result = Builder.CreateSub(lhs, rhs);
-        }
+Value* Parser::end_short_circuit(const PendingOp& pending, Value* rhs)
+{
+    TRACE(TRACE_PARSER, "short circuit op");
+    lvalue_entry = nullptr;
 
-        return arith_op_pr(result, hintType);
+    // Same conversion expression_op would do for a bool lhs
+    if (rhs->getType() == Type::getInt32Ty(TheContext))
+        rhs = convert_type(rhs, Type::getInt1Ty(TheContext));
+    else if (rhs->getType() != Type::getInt1Ty(TheContext))
+    {
+        err_handler->reportError("Bitwise or boolean operations are only defined on bool and integer types", curr_token.line);
+        // (so the phi still gets a bool)
+        rhs = UndefValue::get(Type::getInt1Ty(TheContext));
     }
-    else return lhs;
-}
 
-Value* Parser::relation(Type* hintType)
-{
-    if (P_DEBUG) std::cout << "relation" << '\n';
+    BasicBlock* rhs_end = Builder.GetInsertBlock();
+    Builder.CreateBr(pending.end_block);
 
-    Value* val = term(hintType);
-    return relation_pr(val, hintType);
+    symtable_manager->get_curr_proc_function()->getBasicBlockList()
+        .push_back(pending.end_block);
+    Builder.SetInsertPoint(pending.end_block);
+    seal_block(pending.end_block);
+
+    // The result is the lhs's value if the rhs was skipped
+    PHINode* result = Builder.CreatePHI(Type::getInt1Ty(TheContext), 2);
+    result->addIncoming(pending.lhs, pending.lhs_block);
+    result->addIncoming(rhs, rhs_end);
+    return result;
 }
 
-Value* Parser::relation_pr(Value* lhs, Type* hintType)
+// & or |
+Value* Parser::expression_op(TokenType op, Value* lhs, Value* rhs, Type* hintType)
 {
-    if (P_DEBUG) std::cout << "relation pr" << '\n';
+    TRACE(TRACE_PARSER, "expr op");
 
-    if ((token() == TokenType::LT)
-        || (token() == TokenType::GT)
-        || (token() == TokenType::LT_EQ)
-        || (token() == TokenType::GT_EQ)
-        || (token() == TokenType::EQUALS)
-        || (token() == TokenType::NOTEQUAL))
+    // If one is a bool and one an int, convert
+    if (lhs->getType() == Type::getInt1Ty(TheContext) 
+        && rhs->getType() == Type::getInt32Ty(TheContext))
     {
-        TokenType op = advance().type;
-        Value* rhs = term(hintType);
+        if (hintType == Type::getInt1Ty(TheContext))
+            rhs = convert_type(rhs, Type::getInt1Ty(TheContext));
+        else 
+            lhs = convert_type(lhs, Type::getInt32Ty(TheContext));
+    }
+    else if (lhs->getType() == Type::getInt32Ty(TheContext) 
+        && rhs->getType() == Type::getInt1Ty(TheContext))
+    {
+        if (hintType == Type::getInt1Ty(TheContext))
+            lhs = convert_type(lhs, Type::getInt1Ty(TheContext));
+        else 
+            rhs = convert_type(rhs, Type::getInt32Ty(TheContext));
+    }
+    else if (lhs->getType() != rhs->getType()
+                && lhs->getType() != Type::getInt1Ty(TheContext) 
+                && lhs->getType() != Type::getInt32Ty(TheContext))
+    {
+        // Types aren't the same or aren't both bool/int
+        err_handler->reportError("Bitwise or boolean operations are only defined on bool and integer types", curr_token.line);
+    }
 
-        // Type conversion
-        if (lhs->getType() != rhs->getType())
-        {
-            if (lhs->getType() == Type::getFloatTy(TheContext) 
-                && rhs->getType() == Type::getInt32Ty(TheContext))
-            {
-                // Always convert up to float to avoid losing information
-                convert_type(rhs, Type::getFloatTy(TheContext));
-            }
-            else if (lhs->getType() == Type::getInt32Ty(TheContext) 
-                && rhs->getType() == Type::getFloatTy(TheContext))
-            {
-                // Always convert up to float to avoid losing information
-                convert_type(lhs, Type::getFloatTy(TheContext));
-            }
-            else if (lhs->getType() == Type::getInt1Ty(TheContext)
-                && rhs->getType() == Type::getInt32Ty(TheContext))
-            {
-                // Prefer conversion to hint type if possible to simplify later
-                if (hintType == Type::getInt1Ty(TheContext)) 
-                    convert_type(rhs, Type::getInt1Ty(TheContext));
-                else 
-                    convert_type(lhs, Type::getInt32Ty(TheContext));
-            }
-            else if (lhs->getType() == Type::getInt32Ty(TheContext)     
-                && rhs->getType() == Type::getInt1Ty(TheContext))
-            {
-                // Prefer conversion to hint type if possible to simplify later
-                if (hintType == Type::getInt1Ty(TheContext)) 
-                    convert_type(lhs, Type::getInt1Ty(TheContext));
-                else 
-                    convert_type(rhs, Type::getInt32Ty(TheContext));
-            }
-            else
-            {
+    Value* result;
+    if (op == TokenType::AND)
+        result = Builder.CreateAnd(lhs, rhs);
+    else
+        result = Builder.CreateOr(lhs, rhs);
 
-                err_handler->reportError("Incompatible types for relational operators", 
-                    curr_token.line);
-            }
-        }
+    return result;
+}
 
-        Value* result;
-        switch (op)
-        {
-            case LT:
-                if (lhs->getType()->isFloatTy())
-                    result = Builder.CreateFCmpOLE(lhs, rhs);
-                else
-                    result = Builder.CreateICmpSLT(lhs, rhs);
-                break;
-            case GT:
-                if (lhs->getType()->isFloatTy())
-                    result = Builder.CreateFCmpOGT(lhs, rhs);
-                else
-                    result = Builder.CreateICmpSGT(lhs, rhs);
-                break;
-            case LT_EQ:
-                if (lhs->getType()->isFloatTy())
-                    result = Builder.CreateFCmpOLE(lhs, rhs);
-                else
-                    result = Builder.CreateICmpSLE(lhs, rhs);
-                break;
-            case GT_EQ:
-                if (lhs->getType()->isFloatTy())
-                    result = Builder.CreateFCmpOGE(lhs, rhs);
-                else
-                    result = Builder.CreateICmpSGE(lhs, rhs);
-                break;
-            case EQUALS:
-                if (lhs->getType()->isFloatTy())
-                    result = Builder.CreateFCmpOEQ(lhs, rhs);
-                else
-                    result = Builder.CreateICmpEQ(lhs, rhs);
-                break;
-            case NOTEQUAL:
-                if (lhs->getType()->isFloatTy())
-                    result = Builder.CreateFCmpONE(lhs, rhs);
-                else
-                    result = Builder.CreateICmpNE(lhs, rhs);
-                break;
-            default:
-                // This shouldn't happen
-                result = nullptr;
-                break;
-        }
+// + or -
+Value* Parser::arith_op(TokenType op, Value* lhs, Value* rhs, Type* hintType)
+{
+    TRACE(TRACE_PARSER, "arith op");
+
+    // Type conversion
 
-        return relation_pr(result, hintType);
+    // If one is int and one is float, 
+    //  convert all to float to get the most precision.
+    // Any other types can't be used here.
+    if (lhs->getType() == Type::getInt32Ty(TheContext) 
+        && rhs->getType() == Type::getFloatTy(TheContext))
+    {
+        // Convert lhs to float
+        lhs = convert_type(lhs, Type::getFloatTy(TheContext));
+    }
+    else if (lhs->getType() == Type::getFloatTy(TheContext) 
+        && rhs->getType() == Type::getInt32Ty(TheContext))
+    {
+        // Convert rhs to float
+        rhs = convert_type(rhs, Type::getFloatTy(TheContext));
+    }
+    else if (lhs->getType() != rhs->getType() 
+                && lhs->getType() != Type::getFloatTy(TheContext)
+                && lhs->getType() != Type::getInt32Ty(TheContext))
+    {
+        // Types aren't the same or aren't both float/int
+        err_handler->reportError("Arithmetic operations are only defined on float and integer types", curr_token.line);
+        // TODO: Return?
     }
-    else return lhs;
-}
 
-Value* Parser::term(Type* hintType)
-{
-    if (P_DEBUG) std::cout << "term" << '\n';
+    Value* result;
+    if (op == TokenType::PLUS)
+    {
+        if (lhs->getType()->isFloatTy())
+            result = Builder.CreateFAdd(lhs, rhs);
+        else
+            result = Builder.CreateAdd(lhs, rhs);
+    }
+    else
+    {
+        if (lhs->getType()->isFloatTy())
+            result = Builder.CreateFSub(lhs, rhs);
+        else
+            result = Builder.CreateSub(lhs, rhs);
+    }
 
-    Value* val = factor(hintType);
-    return term_pr(val, hintType);
+    return result;
 }
 
-// Multiplication / Division 
-Value* Parser::term_pr(Value* lhs, Type* hintType)
+// Relational operators
+Value* Parser::relation_op(TokenType op, Value* lhs, Value* rhs, Type* hintType)
 {
-    if (P_DEBUG) std::cout << "term pr" << '\n';
-
+    TRACE(TRACE_PARSER, "relation op");
 
-    if (token() == TokenType::MULTIPLICATION 
-        || token() == TokenType::DIVISION)
+    // Type conversion
+    if (lhs->getType() != rhs->getType())
     {
-        TokenType op = advance().type;
-        Value* rhs = factor(hintType);
-
-        // Type checking
-        if (lhs->getType() == Type::getInt32Ty(TheContext)
+        if (lhs->getType() == Type::getFloatTy(TheContext) 
+            && rhs->getType() == Type::getInt32Ty(TheContext))
+        {
+            // Always convert up to float to avoid losing information
+            convert_type(rhs, Type::getFloatTy(TheContext));
+        }
+        else if (lhs->getType() == Type::getInt32Ty(TheContext) 
             && rhs->getType() == Type::getFloatTy(TheContext))
         {
-            // Convert lhs to float
-            lhs = convert_type(lhs, Type::getFloatTy(TheContext));
+            // Always convert up to float to avoid losing information
+            convert_type(lhs, Type::getFloatTy(TheContext));
         }
-        else if (lhs->getType() == Type::getFloatTy(TheContext) 
+        else if (lhs->getType() == Type::getInt1Ty(TheContext)
             && rhs->getType() == Type::getInt32Ty(TheContext))
         {
-            // Convert rhs to float
-            rhs = convert_type(rhs, Type::getFloatTy(TheContext));
+            // Prefer conversion to hint type if possible to simplify later
+            if (hintType == Type::getInt1Ty(TheContext)) 
+                convert_type(rhs, Type::getInt1Ty(TheContext));
+            else 
+                convert_type(lhs, Type::getInt32Ty(TheContext));
         }
-        else if (lhs->getType() != rhs->getType() 
-                    && lhs->getType() != Type::getFloatTy(TheContext)
-                    && lhs->getType() != Type::getInt32Ty(TheContext))
+        else if (lhs->getType() == Type::getInt32Ty(TheContext)     
+            && rhs->getType() == Type::getInt1Ty(TheContext))
         {
-            // Types aren't the same or aren't both float/int
-            err_handler->reportError("Term operations (multiplication and division) are only defined on float and integer types.", curr_token.line);
+            // Prefer conversion to hint type if possible to simplify later
+            if (hintType == Type::getInt1Ty(TheContext)) 
+                convert_type(lhs, Type::getInt1Ty(TheContext));
+            else 
+                convert_type(rhs, Type::getInt32Ty(TheContext));
         }
+        else
+        {
 
-        Value* result;
+            err_handler->reportError("Incompatible types for relational operators", 
+                curr_token.line);
+        }
+    }
 
-        if (op == TokenType::MULTIPLICATION)
-        {
+    Value* result;
+    switch (op)
+    {
+        case LT:
             if (lhs->getType()->isFloatTy())
-                result = Builder.CreateFMul(lhs, rhs);
+                result = Builder.CreateFCmpOLE(lhs, rhs);
             else
-                result = Builder.CreateMul(lhs, rhs);
-        }
-        else
-        {
+                result = Builder.CreateICmpSLT(lhs, rhs);
+            break;
+        case GT:
             if (lhs->getType()->isFloatTy())
-                result = Builder.CreateFDiv(lhs, rhs);
+                result = Builder.CreateFCmpOGT(lhs, rhs);
             else
-                result = Builder.CreateSDiv(lhs, rhs);
-        }
+                result = Builder.CreateICmpSGT(lhs, rhs);
+            break;
+        case LT_EQ:
+            if (lhs->getType()->isFloatTy())
+                result = Builder.CreateFCmpOLE(lhs, rhs);
+            else
+                result = Builder.CreateICmpSLE(lhs, rhs);
+            break;
+        case GT_EQ:
+            if (lhs->getType()->isFloatTy())
+                result = Builder.CreateFCmpOGE(lhs, rhs);
+            else
+                result = Builder.CreateICmpSGE(lhs, rhs);
+            break;
+        case EQUALS:
+            if (lhs->getType()->isFloatTy())
+                result = Builder.CreateFCmpOEQ(lhs, rhs);
+            else
+                result = Builder.CreateICmpEQ(lhs, rhs);
+            break;
+        case NOTEQUAL:
+            if (lhs->getType()->isFloatTy())
+                result = Builder.CreateFCmpONE(lhs, rhs);
+            else
+                result = Builder.CreateICmpNE(lhs, rhs);
+            break;
+        default:
+            // This shouldn't happen
+            result = nullptr;
+            break;
+    }
+
+    return result;
+}
+
+// Multiplication / Division 
+Value* Parser::term_op(TokenType op, Value* lhs, Value* rhs, Type* hintType)
+{
+    TRACE(TRACE_PARSER, "term op");
+
+    // Type checking
+    if (lhs->getType() == Type::getInt32Ty(TheContext)
+        && rhs->getType() == Type::getFloatTy(TheContext))
+    {
+        // Convert lhs to float
+        lhs = convert_type(lhs, Type::getFloatTy(TheContext));
+    }
+    else if (lhs->getType() == Type::getFloatTy(TheContext) 
+        && rhs->getType() == Type::getInt32Ty(TheContext))
+    {
+        // Convert rhs to float
+        rhs = convert_type(rhs, Type::getFloatTy(TheContext));
+    }
+    else if (lhs->getType() != rhs->getType() 
+                && lhs->getType() != Type::getFloatTy(TheContext)
+                && lhs->getType() != Type::getInt32Ty(TheContext))
+    {
+        // Types aren't the same or aren't both float/int
+        err_handler->reportError("Term operations (multiplication and division) are only defined on float and integer types.", curr_token.line);
+    }
 
-        return term_pr(result, hintType);
+    Value* result;
+
+    if (op == TokenType::MULTIPLICATION)
+    {
+        if (lhs->getType()->isFloatTy())
+            result = Builder.CreateFMul(lhs, rhs);
+        else
+            result = Builder.CreateMul(lhs, rhs);
+    }
+    else
+    {
+        if (lhs->getType()->isFloatTy())
+            result = Builder.CreateFDiv(lhs, rhs);
+        else
+            result = Builder.CreateSDiv(lhs, rhs);
     }
-    else return lhs;
+
+    return result;
 }
 
 Value* Parser::factor(Type* hintType)
 {
-    if (P_DEBUG) std::cout << "factor" << '\n';
+    TRACE(TRACE_PARSER, "factor");
     Value* retval = nullptr;
 
     // Token is one of:
     //  (expression), [-] name, [-] float|integer, string, char, bool 
+    lvalue_entry = nullptr;
     if (token() == TokenType::L_PAREN)
     {
         advance();
@@ -1339,21 +2176,20 @@ Value* Parser::factor(Type* hintType)
 
         if (token() == TokenType::INTEGER)
         {
-            MyValue mval = advance().val;
-            APInt negated_int = APInt(32, mval.int_value);
+            APInt negated_int = APInt(32, advance().val.int_value);
             negated_int.negate();
             return ConstantInt::get(TheContext, negated_int);
         }
         else if (token() == TokenType::FLOAT) 
         {
-            MyValue mval = advance().val;
-            APFloat negated_float = APFloat(mval.float_value);
+            APFloat negated_float = APFloat(advance().val.float_value);
             negated_float.changeSign();
             return ConstantFP::get(TheContext, negated_float);
         }
         else if (token() == TokenType::IDENTIFIER) 
         {
             Value* nameVal = name(hintType);
+            lvalue_entry = nullptr;
             if (nameVal->getType() == Type::getInt32Ty(TheContext))
                 return Builder.CreateNeg(nameVal);
             else if (nameVal->getType() == Type::getFloatTy(TheContext))
@@ -1373,38 +2209,23 @@ Value* Parser::factor(Type* hintType)
     }
     else if (token() == STRING)
     {
-        MyValue mval = advance().val;
-        int len = mval.string_value.length() + 1; // +1 for \0
-        GlobalVariable* string = new GlobalVariable(*TheModule, 
-            ArrayType::get(Type::getInt8Ty(TheContext), len), 
-            true,
-            GlobalValue::ExternalLinkage,
-            0);
-        Constant *string_arr = ConstantDataArray::getString(TheContext, 
-            mval.string_value, true);
-        string->setInitializer(string_arr);
-
-        retval = string;
+        retval = string_literal(advance().val.literal);
     }
     else if (token() == CHAR)
     {
-        MyValue mval = advance().val;
-        retval = ConstantInt::get(TheContext, APInt(8, mval.char_value));
+        retval = ConstantInt::get(TheContext, APInt(8, advance().val.char_value));
     }
     else if (token() == INTEGER)
     {
-        MyValue mval = advance().val;
-        retval = ConstantInt::get(TheContext, APInt(32, mval.int_value));
+        retval = ConstantInt::get(TheContext, APInt(32, advance().val.int_value));
     }
     else if (token() == FLOAT)
     {
-        MyValue mval = advance().val;
-        retval = ConstantFP::get(TheContext, APFloat(mval.float_value));
+        retval = ConstantFP::get(TheContext, APFloat(advance().val.float_value));
     }
     else if (token() == RS_TRUE || token() == RS_FALSE)
     {
-        MyValue mval = advance().val;
-        retval = ConstantInt::get(TheContext, APInt(1, mval.int_value));
+        retval = ConstantInt::get(TheContext, APInt(1, advance().val.int_value));
     }
     else
     {
@@ -1419,13 +2240,22 @@ Value* Parser::factor(Type* hintType)
 
 Value* Parser::name(Type* hintType)
 {
-    if (P_DEBUG) std::cout << "name" << '\n';
+    TRACE(TRACE_PARSER, "name");
 
-    std::string id = require(TokenType::IDENTIFIER).val.string_value;
+    const std::string& id = identifier_string(require(TokenType::IDENTIFIER));
 
     // RS_IN - we expect to be able to read this variable's value
     SymTableEntry* entry = symtable_manager->resolve_symbol(id, true, RS_IN);
 
+    if (entry->ssa_type != nullptr && token() != TokenType::L_BRACKET)
+    {
+        // Its current value, no load needed
+        Value* val = read_variable(entry, Builder.GetInsertBlock());
+        lvalue_entry = entry;
+        lvalue_value = val;
+        return val;
+    }
+
     Value* val_to_load;
     val_to_load = entry->value;
 
@@ -1445,8 +2275,8 @@ Value* Parser::name(Type* hintType)
         //GEPIdxs.push_back(ConstantInt::get(TheContext, APInt(64, 0)));
         GEPIdxs.push_back(normalized_idx);
 
-        TheModule->print(llvm::errs(), NULL);
         val_to_load = Builder.CreateGEP(val_to_load, ArrayRef<Value*>(GEPIdxs));
+        TRACE(TRACE_CODEGEN, "index " << id << ": " << ir_string(*val_to_load));
         // THe fuck is this
         /*
         else if (isa<ArrayType>(val_to_load->getType()))
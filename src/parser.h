@@ -3,9 +3,19 @@
 #include "errhandler.h"
 #include "symboltable.h"
 #include "scanner.h"
+#include "options.h"
+#include "allocation.h"
+#include "parallel.h"
+#include "incremental.h"
+#include "evaluator.h"
+#include "memoize.h"
+#include "streaming.h"
+#include "debuginfo.h"
 #include "llvm_helper.h"
 
+#include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
@@ -15,12 +25,24 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_os_ostream.h"
 
 #include <iostream>
 #include <sstream>
 #include <cstdint>
 #include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+// Binding levels of the binary operators, loosest to tightest.
+// These are the expression, arith_op, relation and term 
+//  levels of the grammar.
+enum OpLevel
+{
+    OP_NONE=0, OP_EXPRESSION, OP_ARITH, OP_RELATION, OP_TERM
+};
 
 class Parser
 {
@@ -28,17 +50,88 @@ public:
     Parser(ErrHandler* handler, 
         SymbolTableManager* manager, 
         Scanner* scan, 
-        std::string filename);
+        std::string filename,
+        llvm::LLVMContext& context,
+        CompilerOptions options);
 
     ~Parser();
     std::unique_ptr<llvm::Module> parse();
+
+    // Parse a single procedure declaration (for a ProcedureJob).
+    // Globals it uses must have been imported into the symbol table.
+    std::unique_ptr<llvm::Module> parse_procedure();
+
+    // Reuse top-level procedures from earlier compiles, and save them for 
+    //  later ones. TheContext must be the cache's context.
+    void set_procedure_cache(ProcedureCache* cache);
+
+    // Write each procedure to streamer once it's finished, instead of 
+    //  keeping it in the module (--stream)
+    void set_streamer(ModuleStreamer* streamer);
 private:
+    llvm::LLVMContext& TheContext;
+    llvm::IRBuilder<> Builder;
+    std::unique_ptr<llvm::Module> TheModule;
+
+    AllocationManager allocations;
+
+    CompilerOptions options;
+
+    // The source file's name (for debug info)
+    std::string filename;
+    // Debug info for the module (-g), or null
+    std::unique_ptr<DebugInfo> debug;
+
+    // Runs calls with constant arguments at compile time where it can.
+    //  Off while parsing a procedure for the ProcedureCache (the results 
+    //  would go stale if the procedure called changed).
+    ConstantEvaluator evaluator;
+    bool evaluate_calls = true;
+
+    // Top-level procedures found by the scanner's pre-pass. 
+    //  When parsing in parallel, these are handed to the pool 
+    //  as they're reached instead of being parsed here.
+    std::vector<SourceRange> procedure_ranges;
+    size_t next_procedure_range = 0;
+    std::unique_ptr<ProcedurePool> pool;
+    int pool_threads = 0;
+    bool pool_started = false;
+    // Whether to print the diagnostics held during a parallel parse 
+    //  (not if err_handler was already holding them for someone else)
+    bool flush_diagnostics = true;
+    ProcedureCache* procedure_cache = nullptr;
+    ModuleStreamer* streamer = nullptr;
+
+    // Set up parallel parsing if it's enabled and worth it for this file
+    //  (or find the procedures for the procedure cache)
+    void plan_parallel_parse();
+    // If this is the start of a top-level procedure the pre-pass found, 
+    //  its range. Null if parallel parsing isn't planned.
+    const SourceRange* top_level_range();
+    // Source text of a top-level procedure (its key in the ProcedureCache)
+    std::string procedure_text(const SourceRange& range);
+    void start_procedure_jobs();
+    // Wait for the jobs and link their modules into TheModule
+    void finish_parallel_parse();
+
+    // Declare an imported global in this module (see import_globals)
+    void import_symbol(SymTableEntry* entry);
+
+    // The llvm type of a value of the given type (arrays not included)
+    llvm::Type* llvm_type(SymbolType type);
+
     // For use in LLVM codegen. 
     // Declare builtin functions in the LLVM IR
-    void decl_single_builtin(std::string name, llvm::Type* paramtype);
+    void decl_single_builtin(std::string name, SymbolType param_sym_type, 
+        TokenType param_type);
     void decl_builtins();
     std::string next_label();
 
+    // The module's constant for a string literal (by scanner literal index).
+    //  Each distinct literal is emitted once, however often it's used.
+    llvm::GlobalVariable* string_literal(int literal);
+    std::unordered_map<int, llvm::GlobalVariable*> string_literals;
+
     ErrHandler* err_handler;
     SymbolTableManager* symtable_manager;
     Scanner* scanner;
@@ -46,6 +139,20 @@ private:
     Token curr_token;
     bool curr_token_valid;
 
+    // An operator and its left operand, waiting for its right operand
+    struct PendingOp
+    {
+        llvm::Value* lhs;
+        TokenType op;
+        OpLevel level;
+        // For a short circuit & or |: the block the lhs was evaluated in, 
+        //  and the block both sides jump to. Otherwise both are null.
+        llvm::BasicBlock* lhs_block;
+        llvm::BasicBlock* end_block;
+    };
+    // Operator stack for binary_expression
+    std::vector<PendingOp> pending_ops;
+
     // Get a token from scanner and store in curr_token if !curr_token_valid
     TokenType token();
     // Consume the token; subsequent calls to getToken will return a new token.
@@ -53,10 +160,36 @@ private:
     // Ensure current_token has type t, 
     //  if not, report err (if error=true) or warning 
     Token require(TokenType t, bool error=true);
+    // Get the identifier text of a token from the scanner's atom table
+    const std::string& identifier_string(const Token& tok);
 
     // For type conversion
     llvm::Value* convert_type(llvm::Value* val, llvm::Type* required_type);
 
+    // SSA construction for scalar locals, as in Braun et al., "Simple and 
+    //  Efficient Construction of Static Single Assignment Form". 
+    // Reads look up the variable's value in the current block, or ask its 
+    //  predecessors (adding a phi if there's more than one). 
+    void write_variable(SymTableEntry* var, llvm::BasicBlock* block, llvm::Value* val);
+    llvm::Value* read_variable(SymTableEntry* var, llvm::BasicBlock* block);
+    llvm::Value* read_variable_recursive(SymTableEntry* var, llvm::BasicBlock* block);
+    llvm::PHINode* new_phi(SymTableEntry* var, llvm::BasicBlock* block);
+    llvm::Value* add_phi_operands(SymTableEntry* var, llvm::PHINode* phi);
+    llvm::Value* try_remove_trivial_phi(llvm::PHINode* phi);
+    // A block is sealed once all of its predecessors are known
+    void seal_block(llvm::BasicBlock* block);
+
+    std::unordered_set<llvm::BasicBlock*> sealed_blocks;
+    // Phis added to unsealed blocks, to be filled in when they are sealed
+    std::unordered_map<llvm::BasicBlock*, 
+        std::vector<std::pair<SymTableEntry*, llvm::PHINode*>>> incomplete_phis;
+
+    // If the expression just parsed was only an SSA variable's name, 
+    //  the variable and the value read (anything else that makes a 
+    //  value clears it). Used to assign an OUT or INOUT argument.
+    SymTableEntry* lvalue_entry = nullptr;
+    llvm::Value* lvalue_value = nullptr;
+
     void program();
     void program_header();
     void program_body();
@@ -64,7 +197,22 @@ private:
     void declaration();
 
     void proc_declaration(bool is_global);
-    void proc_header();
+    // The ways a procedure's body can be handled: parsed here, 
+    //  handed to a ProcedureJob, or reused with the ProcedureCache 
+    //  (parsed here if it changed)
+    void define_procedure();
+    void defer_procedure(const SourceRange& range);
+    void cache_procedure(const SourceRange& range);
+    void skip_procedure_body(const SourceRange& range);
+    // Check a MEMOIZE PROCEDURE (declared on line) once it's defined, 
+    //  and put its cache in front of it. Returns the function with 
+    //  its body (null if it couldn't be memoized).
+    llvm::Function* memoize_procedure(int line);
+    // Emit a finished procedure F (and impl, its body if memoized) 
+    //  to the streamer, unless calls to it might still be evaluated
+    void stream_procedure(llvm::Function* F, llvm::Function* impl);
+    // define - set up the function body (false if it's parsed elsewhere)
+    void proc_header(bool define=true);
     void proc_body();
     void parameter_list();
     void parameter();
@@ -76,23 +224,58 @@ private:
 
     bool statement();
     void identifier_statement();
-    void assignment_statement(std::string);
-    void proc_call(std::string);
-    std::vector<llvm::Value*> argument_list(SymTableEntry* proc_entry);
+    void assignment_statement(const std::string&);
+    void proc_call(const std::string&);
+    // An SSA variable passed by reference: it's copied into slot 
+    //  for the call, and back out after
+    struct ByRefCopy
+    {
+        SymTableEntry* var;
+        llvm::AllocaInst* slot;
+    };
+    // Where a call's returned OUT/INOUT value goes: an SSA variable, 
+    //  memory, or nowhere (the argument wasn't a variable)
+    struct ResultTarget
+    {
+        SymTableEntry* var;
+        llvm::Value* pointer;
+    };
+    std::vector<llvm::Value*> argument_list(SymTableEntry* proc_entry, 
+        std::vector<ByRefCopy>& copies, std::vector<ResultTarget>& targets);
+    ResultTarget result_argument(SymTableEntry* param, 
+        std::vector<llvm::Value*>& args);
+    // arg, or undef if it isn't the expected type (reported as an error)
+    llvm::Value* checked_argument(llvm::Type* expected, llvm::Value* arg);
+    llvm::Value* by_ref_argument(llvm::Type* real_type, TokenType param_type, 
+        std::vector<ByRefCopy>& copies);
 
     void if_statement();
     void loop_statement();
+    void case_statement();
+    int case_label();
+    void case_body();
     void return_statement();
+    // Return the current procedure's OUT and INOUT values
+    void return_results();
 
     llvm::Value* expression(llvm::Type* hintType);
-    // _pr functions are needed for eliminating left recursion
-    llvm::Value* expression_pr(llvm::Value* lhs, llvm::Type* hintType); 
-    llvm::Value* arith_op(llvm::Type* hintType);
-    llvm::Value* arith_op_pr(llvm::Value* lhs, llvm::Type* hintType); 
-    llvm::Value* relation(llvm::Type* hintType);
-    llvm::Value* relation_pr(llvm::Value* lhs, llvm::Type* hintType); 
-    llvm::Value* term(llvm::Type* hintType);
-    llvm::Value* term_pr(llvm::Value* lhs, llvm::Type* hintType);
+    // Operator precedence parser for the binary operator levels
+    llvm::Value* binary_expression(OpLevel min_level, llvm::Type* hintType);
+    llvm::Value* apply_binary_op(OpLevel level, TokenType op, 
+        llvm::Value* lhs, llvm::Value* rhs, llvm::Type* hintType);
+    // Short circuit evaluation of bool & and |. The first half branches 
+    //  past the rhs if the lhs decides the result; the second merges them.
+    PendingOp begin_short_circuit(llvm::Value* lhs, TokenType op);
+    llvm::Value* end_short_circuit(const PendingOp& pending, llvm::Value* rhs);
+    // Codegen (and type conversion) for each level's operators
+    llvm::Value* expression_op(TokenType op, 
+        llvm::Value* lhs, llvm::Value* rhs, llvm::Type* hintType);
+    llvm::Value* arith_op(TokenType op, 
+        llvm::Value* lhs, llvm::Value* rhs, llvm::Type* hintType);
+    llvm::Value* relation_op(TokenType op, 
+        llvm::Value* lhs, llvm::Value* rhs, llvm::Type* hintType);
+    llvm::Value* term_op(TokenType op, 
+        llvm::Value* lhs, llvm::Value* rhs, llvm::Type* hintType);
     llvm::Value* factor(llvm::Type* hintType);
     llvm::Value* name(llvm::Type* hintType);
 };
@@ -0,0 +1,17 @@
+#pragma once
+
+// The runtime's functions (src/runtime/runtime.c, linked into the 
+//  compiler by make), for running programs in the compiler's process
+extern "C"
+{
+#define BUILTIN_RS_IN(name, c_type) void name(c_type val);
+#define BUILTIN_RS_OUT(name, c_type) void name(c_type* val);
+#define BUILTIN(name, sym_type, param_type, c_type) \
+    BUILTIN_##param_type(name, c_type)
+#include "builtins.def"
+#undef BUILTIN_RS_IN
+#undef BUILTIN_RS_OUT
+
+void MEMOIZE_REGISTER(char* name, long long* counters);
+int CPU_LEVEL(void);
+}
@@ -1,28 +1,35 @@
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+// The compiler's declarations of the builtins, 
+//  so a definition that doesn't match them won't compile
+#define BUILTIN_RS_IN(name, c_type) void name(c_type val);
+#define BUILTIN_RS_OUT(name, c_type) void name(c_type* val);
+#define BUILTIN(name, sym_type, param_type, c_type) \
+    BUILTIN_##param_type(name, c_type)
+#include "../builtins.def"
+
 /* PUT */
 
-void PUTINTEGER(int* val)
+void PUTINTEGER(int val)
 {
-    printf("%d\n", *val);
+    printf("%d\n", val);
 }
 
-// Chars are treated as i8
-void PUTCHAR(int* val)
+void PUTCHAR(char val)
 {
-    char c = (char)*val;
-    printf("%c\n", c);
+    printf("%c\n", val);
 }
 
-void PUTFLOAT(float* val)
+void PUTFLOAT(float val)
 {
-    printf("%f\n", *val);
+    printf("%f\n", val);
 }
 
-void PUTBOOL(int* val)
+void PUTBOOL(bool val)
 {
-    printf("%s\n", *val? "true" : "false");
+    printf("%s\n", val ? "true" : "false");
 }
 
 void PUTSTRING(char* str)
@@ -37,12 +44,9 @@ void GETINTEGER(int* val)
     scanf("%d", val);
 }
 
-// Chars are treated as i8
-void GETCHAR(int* val)
+void GETCHAR(char* val)
 {
-    char a;
-    scanf(" %c", &a);
-    *val = (int)a;
+    scanf(" %c", val);
 }
 
 void GETFLOAT(float* val)
@@ -50,15 +54,82 @@ void GETFLOAT(float* val)
     scanf("%f", val);
 }
 
-void GETBOOL(int* val)
+void GETBOOL(bool* val)
 {
-    scanf("%d", val);
-    // Convert to bool; 0 = false, anything else = true
-    *val = *val != 0;
+    // 0 = false, anything else = true
+    int read = 0;
+    scanf("%d", &read);
+    *val = read != 0;
 }
 
 void GETSTRING(char** str)
 {
     *str = malloc(1024 * sizeof(char));
-    fgets(*str, 1024, stdin);
+    // Empty at the end of the input (malloc'd memory isn't always zeroed,
+    //  e.g. with --run, in the compiler's heap)
+    if (fgets(*str, 1024, stdin) == NULL) (*str)[0] = '\0';
+}
+
+/* MEMOIZE */
+
+// Hit/miss counters of each memoized procedure that was called,
+//  printed at exit (to stderr) if MEMOIZE_STATS is set
+struct MemoStats
+{
+    char* name;
+    long long* counters;
+    struct MemoStats* next;
+};
+static struct MemoStats* memo_stats = NULL;
+
+static void print_memo_stats(void)
+{
+    struct MemoStats* stats;
+    for (stats = memo_stats; stats != NULL; stats = stats->next)
+    {
+        fprintf(stderr, "memoize %s: %lld hits, %lld misses\n", 
+            stats->name, stats->counters[0], stats->counters[1]);
+    }
+}
+
+// counters - {hits, misses}, kept up to date by the procedure
+void MEMOIZE_REGISTER(char* name, long long* counters)
+{
+    struct MemoStats* stats;
+    if (getenv("MEMOIZE_STATS") == NULL) return;
+    if (memo_stats == NULL) atexit(print_memo_stats);
+
+    stats = malloc(sizeof(struct MemoStats));
+    stats->name = name;
+    stats->counters = counters;
+    stats->next = memo_stats;
+    memo_stats = stats;
+}
+
+/* MULTIVERSIONING */
+
+// The x86-64 level this machine is at (1-4, or 0 if it isn't x86-64), 
+//  for --multiversion's dispatchers to pick a version with
+int CPU_LEVEL(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    static int level = -1;
+    if (level >= 0) return level;
+
+    __builtin_cpu_init();
+    level = 1;
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        level = 2;
+    if (level == 2 && __builtin_cpu_supports("avx2") 
+        && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("fma"))
+        level = 3;
+    if (level == 3 && __builtin_cpu_supports("avx512f") 
+        && __builtin_cpu_supports("avx512bw") 
+        && __builtin_cpu_supports("avx512dq") 
+        && __builtin_cpu_supports("avx512vl"))
+        level = 4;
+    return level;
+#else
+    return 0;
+#endif
 }
@@ -1,18 +1,38 @@
 #include "scanner.h"
+#include "trace.h"
 
 Scanner::Scanner(ErrHandler* handler, SymbolTableManager* manager) 
     : err_handler(handler), symtable_manager(manager) {}
 
-bool Scanner::init(const char* filename)
+void Scanner::init(std::shared_ptr<const std::string> source)
 {
-    // TODO: make sure file isn't a dir
-    input_file.open(filename, std::ifstream::in);
-    if (!input_file.is_open() || input_file.bad()) return false;
-    
-    line_number = 1;
+    init(source, SourceRange {0, source->size(), 1, 0});
+}
+
+void Scanner::init(std::shared_ptr<const std::string> source, SourceRange range)
+{
+    this->source = source;
+    pos = range.begin;
+    end = range.end;
+    line_number = range.line;
 
     symtable_manager->init_tables();
+    init_char_classes();
+}
+
+std::shared_ptr<const std::string> Scanner::get_source()
+{
+    return source;
+}
+
+void Scanner::seek(size_t offset, int line)
+{
+    pos = offset;
+    line_number = line;
+}
 
+void Scanner::init_char_classes()
+{
     // Init ascii character class mapping
     for (char k = '0'; k <= '9'; k++)
     {
@@ -28,14 +48,190 @@ bool Scanner::init(const char* filename)
     ascii_mapping[(int)'\n'] = CharClass::WHITESPACE; 
     ascii_mapping[(int)'\r'] = CharClass::WHITESPACE; 
     ascii_mapping[(int)' '] = CharClass::WHITESPACE; 
+}
+
+std::vector<SourceRange> Scanner::find_top_level_procedures()
+{
+    std::vector<SourceRange> ranges;
+    const std::string& text = *source;
+
+    // Start of the top-level procedure currently open, if depth > 0
+    SourceRange curr = {0, 0, 0, 0};
+    int depth = 0;
+    // Whether the last token was the word END (so PROCEDURE closes)
+    bool after_end = false;
+    // Where the last token was, if it was the word MEMOIZE 
+    //  (part of the procedure that follows)
+    bool after_memoize = false;
+    size_t memoize_begin = 0;
+    int memoize_line = 0;
+
+    size_t i = pos;
+    int line = line_number;
+    while (i < end)
+    {
+        char ch = text[i];
+        char next = i + 1 < end ? text[i + 1] : '\0';
+
+        if (ch == '\n')
+        {
+            line++;
+            i++;
+        }
+        else if (ch == '/' && next == '/')
+        {
+            while (i < end && text[i] != '\n') i++;
+        }
+        else if (ch == '/' && next == '*')
+        {
+            // Nested block comment, same as consumeWhitespaceAndComments
+            int comment_level = 1;
+            i += 2;
+            while (i < end && comment_level > 0)
+            {
+                if (text[i] == '*' && i + 1 < end && text[i + 1] == '/')
+                {
+                    comment_level--;
+                    i++;
+                }
+                else if (text[i] == '/' && i + 1 < end && text[i + 1] == '*')
+                {
+                    comment_level++;
+                    i++;
+                }
+                else if (text[i] == '\n') line++;
+                i++;
+            }
+        }
+        else if (ch == '"')
+        {
+            // getToken doesn't count lines inside strings either
+            i++;
+            while (i < end && text[i] != '"') i++;
+            i++;
+            after_end = false;
+            after_memoize = false;
+        }
+        else if (ch == '\'')
+        {
+            i += 3;
+            after_end = false;
+            after_memoize = false;
+        }
+        else if (ch > 0 && ascii_mapping[(int)ch] == CharClass::LETTER)
+        {
+            size_t word_begin = i;
+            lexeme.clear();
+            while (i < end && text[i] > 0 && isValidInIdentifier(text[i]))
+                lexeme.push_back((char)toupper(text[i++]));
+
+            if (lexeme == "PROCEDURE")
+            {
+                if (after_end)
+                {
+                    depth--;
+                    if (depth == 0)
+                    {
+                        curr.end = i;
+                        curr.end_line = line;
+                        ranges.push_back(curr);
+                    }
+                }
+                else
+                {
+                    if (depth == 0 && after_memoize) 
+                        curr = {memoize_begin, 0, memoize_line, 0};
+                    else if (depth == 0) curr = {word_begin, 0, line, 0};
+                    depth++;
+                }
+            }
+            else if (lexeme == "BEGIN" && depth == 0)
+            {
+                // Start of the program body; no more declarations
+                break;
+            }
+            after_end = lexeme == "END";
+            after_memoize = lexeme == "MEMOIZE";
+            memoize_begin = word_begin;
+            memoize_line = line;
+        }
+        else
+        {
+            if (ch < 0 || ascii_mapping[(int)ch] != CharClass::WHITESPACE) 
+            {
+                after_end = false;
+                after_memoize = false;
+            }
+            i++;
+        }
+    }
+
+    return ranges;
+}
 
+bool Scanner::get_char(char& ch)
+{
+    // Step past the end too, so unget_char after a failed read is a no-op
+    //  on the input (same as an istream)
+    if (pos++ >= end)
+    {
+        ch = '\0';
+        return false;
+    }
+    ch = (*source)[pos - 1];
     return true;
 }
 
+int Scanner::peek_char()
+{
+    if (pos >= end) return EOF;
+    return (unsigned char)(*source)[pos];
+}
+
+void Scanner::unget_char()
+{
+    pos--;
+}
+
+int Scanner::intern_atom(const std::string& str)
+{
+    auto it = atom_ids.find(str);
+    if (it != atom_ids.end()) return it->second;
+
+    int atom = atoms.size();
+    atoms.push_back(str);
+    atom_ids.insert({str, atom});
+    // Reserved words are all in the table before scanning starts,
+    //  so a word's type can be decided once, when it is first seen
+    atom_types.push_back(getWordTokenType(str));
+    return atom;
+}
+
+int Scanner::intern_literal(const std::string& str)
+{
+    auto it = literal_ids.find(str);
+    if (it != literal_ids.end()) return it->second;
+
+    int literal = literals.size();
+    literals.push_back(str);
+    literal_ids.insert({str, literal});
+    return literal;
+}
+
+const std::string& Scanner::atom_string(int atom)
+{
+    return atoms[atom];
+}
+
+const std::string& Scanner::literal_string(int literal)
+{
+    return literals[literal];
+}
+
 // Check if ch is a valid identifier character
 bool Scanner::isValidInIdentifier(char ch)
 {
-    CharClass cls = ascii_mapping[(int)ch];
+    CharClass cls = ascii_mapping[(unsigned char)ch];
     return cls == CharClass::LETTER 
             || cls == CharClass::DIGIT 
             || ch == '_';
@@ -53,7 +249,7 @@ bool Scanner::isValidChar(char ch)
 
 // Return the proper TokenType if str is a reserved word.
 // Otherwise, str is interpreted as an identifier.
-TokenType Scanner::getWordTokenType(std::string str)
+TokenType Scanner::getWordTokenType(const std::string& str)
 {
     // Don't check so no error is reported if this symbol doesn't exist yet.
     SymTableEntry* entry = symtable_manager->resolve_symbol(str, false);
@@ -68,57 +264,58 @@ TokenType Scanner::getWordTokenType(std::string str)
 void Scanner::consumeWhitespaceAndComments()
 {
     // Buffer
-    char ch;
-    while ((ch = input_file.peek()) 
-            && ((ascii_mapping[(int)ch] == CharClass::WHITESPACE) || ch == '/'))
+    int ch;
+    while ((ch = peek_char()) != EOF
+            && ((ascii_mapping[ch] == CharClass::WHITESPACE) || ch == '/'))
     {
+        char next;
         if (ch == '/')
         {
             // First, consume the / so we can peek the next char 
-            input_file.get();
-            ch = input_file.peek();
+            get_char(next);
+            ch = peek_char();
             if (ch == '/')
             {
                 // Consume line comment
-                while (input_file.get() != '\n') {}
+                while (get_char(next) && next != '\n') {}
                 line_number++;
             }
             else if (ch == '*')
             {
-                input_file.get(); // Consume the *
+                get_char(next); // Consume the *
 
                 // Support nested comments
                 int comment_level = 1;
                 
                 // Consume block comment
-                while (input_file.get(ch))
+                while (get_char(next))
                 {
-                    if (ch == '*' && input_file.peek() == '/')
+                    if (next == '*' && peek_char() == '/')
                     {
-                        input_file.get();
+                        get_char(next);
                         comment_level--;
                         if (comment_level == 0) break;
                     }
-                    else if (ch == '/' && input_file.peek() == '*')
+                    else if (next == '/' && peek_char() == '*')
                     {
-                        input_file.get();
+                        get_char(next);
                         comment_level++;
                     }
-                    else if (ch == '\n') line_number++;
+                    else if (next == '\n') line_number++;
                 }
             }
             else 
             {
                 // The / was not followed by a / or *, so it's not a comment.
                 // Put it back and let the switch handle it normally
-                input_file.unget();
+                unget_char();
                 break;
             }
         }
         else
         {
             // Consume the whitespace token
-            input_file.get();
+            get_char(next);
 
             if (ch == '\n') line_number++;
         }
@@ -128,7 +325,7 @@ void Scanner::consumeWhitespaceAndComments()
 Token Scanner::getToken()
 {
     // The token to be returned; defaults to unknown
-    Token token;
+    Token token = Token();
     token.type = TokenType::UNKNOWN;
 
     // Stores next char read from file
@@ -137,59 +334,47 @@ Token Scanner::getToken()
     consumeWhitespaceAndComments();
 
     token.line = line_number;
+    token.offset = pos;
 
     // Store next char of file in ch
-    input_file.get(ch);
-
     // Check for EOF
-    if (input_file.eof())
+    if (!get_char(ch))
     {
         token.type = TokenType::FILE_END;
+        TRACE(TRACE_LEXER, "line " << token.line << ": FILE_END");
         return token;
     }
 
-    // Initial ch value 
-    token.val.char_value = ch;
-
     // Main switch to get token type (and value if necessary)
-    switch (ascii_mapping[(int)ch])
+    switch (ascii_mapping[(unsigned char)ch])
     {
     case CharClass::WHITESPACE:
         // Something in consumeWhitespace... is not working correctly...
         break;
     case CharClass::LETTER:
         // Identifiers/Reserved words must all start with a letter
+        lexeme.clear();
         while (isValidInIdentifier(ch))
         {
             // append char to str
-            token.val.string_value.push_back((char)toupper(ch));
-            input_file.get(ch);
+            lexeme.push_back((char)toupper(ch));
+            if (!get_char(ch)) break;
         }
         // Put back most recently read char (it wasn't valid in an identifier)
-        input_file.unget();
+        unget_char();
 
         // Check whether this is a reserved word or identifier
-        token.type = getWordTokenType(token.val.string_value);
+        token.val.atom = intern_atom(lexeme);
+        token.type = atom_types[token.val.atom];
 
         // Handle bools, since they use reserved words as literals.
         if (token.type == RS_TRUE)
         {
             token.val.int_value = 1;
-            token.val.sym_type = S_BOOL;
         }
         else if (token.type == RS_FALSE)
         {
             token.val.int_value = 0;
-            token.val.sym_type = S_BOOL;
-        }
-        
-        if (token.type == IDENTIFIER 
-            && symtable_manager->resolve_symbol(token.val.string_value, false)
-                    == NULL)
-        {
-            // Add this identifier to sym table 
-            // Add to sym table (type will be IDENTIFIER)
-            symtable_manager->add_symbol(false, token.val.string_value, IDENTIFIER);
         }
 
         break;
@@ -198,48 +383,46 @@ Token Scanner::getToken()
         {
             token.type = TokenType::INTEGER;
 
-            token.val.int_value = (int)(ch - '0');
+            // int_value and float_value share storage in the token,
+            //  so build the number up here and store it once at the end
+            int int_value = (int)(ch - '0');
+            float float_value = 0;
 
             bool is_fractional_part = false;
             double fract_mult = 0.1;
 
-            while (input_file.get(ch))
+            while (get_char(ch))
             {
                 if (ch == '.')
                 {
                     token.type = TokenType::FLOAT;
-                    token.val.float_value = token.val.int_value;
+                    float_value = int_value;
                     is_fractional_part = true;
                     continue;
                 }
                 else if (ch == '_') continue;
-                else if (ascii_mapping[(int)ch] != CharClass::DIGIT) 
+                else if (ascii_mapping[(unsigned char)ch] != CharClass::DIGIT) 
                 {
-                    input_file.unget();
+                    unget_char();
                     break;
                 }
                 
                 // Is there a better way to do this?
                 if (is_fractional_part)
                 {
-                    token.val.float_value += fract_mult * (ch - '0');
+                    float_value += fract_mult * (ch - '0');
                     fract_mult *= 0.1;
                 }
                 else 
                 {
-                    token.val.int_value = 10 * token.val.int_value + (int)(ch - '0');
+                    int_value = 10 * int_value + (int)(ch - '0');
                 }
             }
 
-            // Set token's value's type
             if (token.type == INTEGER)
-            {
-                token.val.sym_type = S_INTEGER;
-            }
-            else if (token.type == FLOAT)
-            {
-                token.val.sym_type = S_FLOAT;
-            }
+                token.val.int_value = int_value;
+            else
+                token.val.float_value = float_value;
         }
         break;
     case CharClass::SYMBOL:
@@ -286,9 +469,9 @@ Token Scanner::getToken()
             token.type = TokenType::OR;
             break;
         case '<':
-            if (input_file.peek() == '=')
+            if (peek_char() == '=')
             {
-                input_file.get();
+                get_char(ch);
                 token.type = TokenType::LT_EQ;
             }
             else 
@@ -296,9 +479,9 @@ Token Scanner::getToken()
 
             break;
         case '>':
-            if (input_file.peek() == '=')
+            if (peek_char() == '=')
             {
-                input_file.get();
+                get_char(ch);
                 token.type = TokenType::GT_EQ;
             }
             else 
@@ -309,8 +492,8 @@ Token Scanner::getToken()
             // String token
             token.type = TokenType::STRING;
 
-            //k = 0;
-            while (input_file.get(ch) && ch != '"')
+            lexeme.clear();
+            while (get_char(ch) && ch != '"')
             {
                 if (!isValidInString(ch))
                 {
@@ -320,19 +503,18 @@ Token Scanner::getToken()
                 }
                 else 
                 {
-                    //token.val.string_value[k++] = ch;
-                    token.val.string_value.push_back(ch);
+                    lexeme.push_back(ch);
                 }
             }
             if (ch != '"') 
             {
                 err_handler->reportError("Reached EOF and string quotes were never closed.", line_number);
             }
-            token.val.sym_type = S_STRING;
+            token.val.literal = intern_literal(lexeme);
             break;
         case '\'':
             token.type = TokenType::CHAR;
-            input_file.get(ch);
+            get_char(ch);
             if (!isValidChar(ch))
             {
                 std::ostringstream stream;
@@ -340,24 +522,23 @@ Token Scanner::getToken()
                 err_handler->reportError(stream.str(), line_number);
             }
             token.val.char_value = ch;
-            ch = input_file.get();
+            get_char(ch);
             if (ch != '\'')
             {
                 err_handler->reportError("Single quote containing more than one char", line_number);
             }
-            token.val.sym_type = S_CHAR;
             break;
         case '=':
-            if (input_file.peek() == '=')
+            if (peek_char() == '=')
             {
-                input_file.get();
+                get_char(ch);
                 token.type = TokenType::EQUALS;
             }
             break;
         case ':':
-            if (input_file.peek() == '=') 
+            if (peek_char() == '=') 
             {
-                input_file.get();
+                get_char(ch);
                 token.type = TokenType::ASSIGNMENT;
             }
             else 
@@ -366,9 +547,9 @@ Token Scanner::getToken()
             }
             break;
         case '!':
-            if (input_file.peek() == '=') 
+            if (peek_char() == '=') 
             {
-                input_file.get();
+                get_char(ch);
                 token.type = TokenType::NOTEQUAL;
             }
             break;
@@ -382,8 +563,11 @@ Token Scanner::getToken()
         err_handler->reportError(stream.str(), line_number);
     }
 
+    TRACE(TRACE_LEXER, "line " << token.line << ": " 
+        << TokenTypeStrings[token.type] << " " 
+        << source->substr(token.offset, pos - token.offset));
     return token;
 }
 
-Scanner::~Scanner() { input_file.close(); }
+Scanner::~Scanner() { }
 
@@ -3,10 +3,23 @@
 #include "errhandler.h"
 #include "symboltable.h"
 
-#include <fstream>
 #include <sstream>
 #include <ctype.h>
 #include <string>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// A span of the source: [begin, end) byte offsets, 
+//  plus the line numbers at begin and end
+struct SourceRange
+{
+    size_t begin;
+    size_t end;
+    int line;
+    int end_line;
+};
 
 class Scanner
 {
@@ -15,34 +28,92 @@ public:
     Scanner(ErrHandler* handler, SymbolTableManager* manager);
 
     /*
-        Sets up the scanner to read from a file.
+        Sets up the scanner to read a whole program, already in memory.
         Initializes variables in the class.
 
-        filename - name of the file to read the program from
+        source - the program's text
+    */
+    void init(std::shared_ptr<const std::string> source);
+
+    /*
+        Sets up the scanner to read only part of an already loaded source, 
+        e.g. one procedure of a file being parsed on several threads.
+        The source is shared, not copied.
+    */
+    void init(std::shared_ptr<const std::string> source, SourceRange range);
+
+    // The loaded source, for sharing with other scanners
+    std::shared_ptr<const std::string> get_source();
 
-        returns - whether the scanner was successfully initialized 
-                    (mainly whether the file was initialized for reading)
+    // Continue scanning at offset (on line), skipping everything before it
+    void seek(size_t offset, int line);
+
+    /*
+        Quick pass over the source that finds the top-level procedure 
+        declarations: from each PROCEDURE token to the end of its matching 
+        END PROCEDURE. Only keywords are looked at, so this is much faster 
+        than parsing and doesn't touch the symbol table.
     */
-    bool init(const char* filename);
+    std::vector<SourceRange> find_top_level_procedures();
 
-    Token getToken(); // returns the next token in input_file
+    Token getToken(); // returns the next token in the source
+
+    /*
+        Tokens only carry an index for identifiers and string literals;
+        these return the text the index refers to.
+        References stay valid for the lifetime of the scanner.
+    */
+    const std::string& atom_string(int atom);
+    const std::string& literal_string(int literal);
 
     ~Scanner();
 private:
     ErrHandler* err_handler;
     SymbolTableManager* symtable_manager;
 
-    std::ifstream input_file;
+    // The whole input file; tokens are read out of this buffer
+    std::shared_ptr<const std::string> source;
+    // Position of the next char to read in source, 
+    //  and the end of the part of source being scanned
+    size_t pos;
+    size_t end;
     int line_number;
 
-    CharClass ascii_mapping[128] = {CharClass::SYMBOL};
+    // Indexed by unsigned char; bytes past ASCII (e.g. UTF-8 in comments 
+    //  and strings) are SYMBOLs
+    CharClass ascii_mapping[256] = {CharClass::SYMBOL};
+
+    // Interned identifiers/reserved words (atoms) and string literals.
+    // Deques so references handed out by atom_string/literal_string 
+    //  aren't invalidated as the tables grow.
+    std::deque<std::string> atoms;
+    std::unordered_map<std::string, int> atom_ids;
+    // TokenType of each atom (reserved word or IDENTIFIER)
+    std::deque<TokenType> atom_types;
+    std::deque<std::string> literals;
+    std::unordered_map<std::string, int> literal_ids;
+
+    // Scratch buffer for the text of the current word or string literal.
+    //  Reused between tokens so scanning doesn't allocate.
+    std::string lexeme;
 
-    TokenType getWordTokenType(std::string str);
+    // Reads the next char into ch. Returns false at end of input.
+    bool get_char(char& ch);
+    // Returns the next char without consuming it, or EOF at end of input.
+    int peek_char();
+    // Puts back the most recently read char.
+    void unget_char();
+
+    int intern_atom(const std::string& str);
+    int intern_literal(const std::string& str);
+
+    TokenType getWordTokenType(const std::string& str);
 
     bool isValidInIdentifier(char ch);
     bool isValidInString(char ch);
     bool isValidChar(char ch);
 
+    void init_char_classes();
+
     void consumeWhitespaceAndComments();
 };
-
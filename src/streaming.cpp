@@ -0,0 +1,73 @@
+#include "streaming.h"
+#include "llvm_helper.h"
+
+using namespace llvm;
+
+ModuleStreamer::ModuleStreamer(raw_ostream& output) : out(output) {}
+
+bool ModuleStreamer::begin(Module& M, const CompilerOptions& options, 
+    std::string& error)
+{
+    if (!host_target(M, options, error)) return false;
+
+    // Nothing in it yet, so this is only the header
+    //  (module id, source filename, data layout and triple)
+    M.print(out, nullptr);
+    scratch.reset(new Module("", M.getContext()));
+    scratch->setDataLayout(M.getDataLayout());
+    begun = true;
+    return true;
+}
+
+Function* ModuleStreamer::emit(Function* F)
+{
+    if (!begun || F->isDeclaration()) return F;
+
+    // Same layout as Module::print. Procedures only refer to named 
+    //  globals, so nothing printed needs the real module's numbering.
+    Module* M = F->getParent();
+    F->removeFromParent();
+    scratch->getFunctionList().push_back(F);
+    out << '\n';
+    F->print(out);
+
+    // A new declaration rather than F without its body: 
+    //  F's tables (e.g. of its value names) don't shrink
+    Function* declaration = Function::Create(F->getFunctionType(), 
+        Function::ExternalLinkage, "", M);
+    declaration->takeName(F);
+    F->replaceAllUsesWith(declaration);
+    F->eraseFromParent();
+
+    emitted.push_back(declaration);
+    return declaration;
+}
+
+void ModuleStreamer::finish(Module& M)
+{
+    if (!begun) return;
+
+    // The header's already written; blank it out for printing the rest
+    std::string id = M.getModuleIdentifier();
+    std::string source_filename = M.getSourceFileName();
+    std::string data_layout = M.getDataLayoutStr();
+    std::string triple = M.getTargetTriple();
+    M.setModuleIdentifier("");
+    M.setSourceFileName("");
+    M.setDataLayout("");
+    M.setTargetTriple("");
+
+    // Take out the emitted functions' declarations while it's printed
+    //  (the calls to them still print their names)
+    for (Function* F : emitted) F->removeFromParent();
+
+    M.print(out, nullptr);
+    out.flush();
+
+    for (Function* F : emitted) M.getFunctionList().push_back(F);
+    M.setModuleIdentifier(id);
+    M.setSourceFileName(source_filename);
+    M.setDataLayout(data_layout);
+    M.setTargetTriple(triple);
+    scratch.reset();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "options.h"
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Writes a module's IR text out a procedure at a time (--stream), so a
+//  procedure's code doesn't have to stay in memory once it's finished.
+// The file says the same as printing the whole module at the end would,
+//  just with the definitions in the order they were emitted.
+class ModuleStreamer
+{
+public:
+    ModuleStreamer(llvm::raw_ostream& out);
+
+    // Set M up for the host (see host_target) and write its header.
+    //  M has to be empty still. False, with error set, if llvm can't
+    //  target the host; nothing is written then.
+    // (The options can't have a CPU or features: each function's 
+    //  attributes would need an attribute group, numbered for the whole 
+    //  module, in a file that's only written a function at a time.)
+    bool begin(llvm::Module& M, const CompilerOptions& options, 
+        std::string& error);
+
+    // Write F's definition, then replace F with a declaration for the 
+    //  calls to it. Returns the declaration (F is freed).
+    llvm::Function* emit(llvm::Function* F);
+
+    // Write the rest of M (globals, declarations, definitions that
+    //  weren't emitted), and flush
+    void finish(llvm::Module& M);
+
+private:
+    llvm::raw_ostream& out;
+    bool begun = false;
+    // An empty module (like the real one) to print each function in: 
+    //  printing a function looks over its whole module first, 
+    //  which would make streaming quadratic
+    std::unique_ptr<llvm::Module> scratch;
+    // Their declarations aren't printed again by finish()
+    std::vector<llvm::Function*> emitted;
+};
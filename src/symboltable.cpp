@@ -2,7 +2,13 @@
 
 SymbolTableManager::SymbolTableManager(ErrHandler* handler) : err_handler(handler) {}
 
-SymTableEntry* SymbolTableManager::resolve_symbol(std::string id, bool check, TokenType paramIntent)
+SymTable* SymbolTableManager::new_table()
+{
+    tables.emplace_back(new SymTable());
+    return tables.back().get();
+}
+
+SymTableEntry* SymbolTableManager::resolve_symbol(const std::string& id, bool check, TokenType paramIntent)
 {
     // exists but not well-defined, and is expected to be (check ==true)    
     bool check_err = false; 
@@ -35,14 +41,29 @@ SymTableEntry* SymbolTableManager::resolve_symbol(std::string id, bool check, To
     else if (global_symbols.count(id) != 0)
     {
         // It's in the global symbol table
+        if (global_lookups) global_lookups->push_back(id);
         entry = global_symbols[id];
         if (check && entry->sym_type == S_UNDEFINED)
         {
             // We're checking for it to exist but it's type is undefined
             check_err = true;
         }
+        if (entry->imported && entry->value == nullptr && import_handler)
+        {
+            import_handler(entry);
+        }
+    }
+    else 
+    {
+        if (global_lookups) global_lookups->push_back(id);
+        if (check)
+        {
+            check_err = true;
+            // Undefined from here on, so the parser can go on with it
+            entry = new_entry(IDENTIFIER, S_UNDEFINED, id);
+            curr_symbols->insert({id, entry});
+        }
     }
-    else if (check) check_err = true;
 
     if (check_err)
     {
@@ -79,21 +100,16 @@ void SymbolTableManager::init_tables()
     add_symbol(true, "TRUE", TokenType::RS_TRUE);
     add_symbol(true, "FALSE", TokenType::RS_FALSE);
     add_symbol(true, "NOT", TokenType::RS_NOT);
+    add_symbol(true, "CASE", TokenType::RS_CASE);
+    add_symbol(true, "WHEN", TokenType::RS_WHEN);
+    add_symbol(true, "MEMOIZE", TokenType::RS_MEMOIZE);
 
-    add_builtin_proc(true, "GETBOOL", IDENTIFIER, S_PROCEDURE, S_BOOL, RS_OUT);
-    add_builtin_proc(true, "GETINTEGER", IDENTIFIER, S_PROCEDURE, S_INTEGER, RS_OUT);
-    add_builtin_proc(true, "GETFLOAT", IDENTIFIER, S_PROCEDURE, S_FLOAT, RS_OUT);
-    add_builtin_proc(true, "GETSTRING", IDENTIFIER, S_PROCEDURE, S_STRING, RS_OUT);
-    add_builtin_proc(true, "GETCHAR", IDENTIFIER, S_PROCEDURE, S_CHAR, RS_OUT);
-
-    add_builtin_proc(true, "PUTBOOL", IDENTIFIER, S_PROCEDURE, S_BOOL, RS_IN);
-    add_builtin_proc(true, "PUTINTEGER", IDENTIFIER, S_PROCEDURE, S_INTEGER, RS_IN);
-    add_builtin_proc(true, "PUTFLOAT", IDENTIFIER, S_PROCEDURE, S_FLOAT, RS_IN);
-    add_builtin_proc(true, "PUTSTRING", IDENTIFIER, S_PROCEDURE, S_STRING, RS_IN);
-    add_builtin_proc(true, "PUTCHAR", IDENTIFIER, S_PROCEDURE, S_CHAR, RS_IN);
+#define BUILTIN(name, sym_type, param_type, c_type) \
+    add_builtin_proc(true, #name, IDENTIFIER, S_PROCEDURE, sym_type, param_type);
+#include "builtins.def"
 }
 
-void SymbolTableManager::add_symbol(bool is_global, std::string id,
+void SymbolTableManager::add_symbol(bool is_global, const std::string& id,
                                     TokenType type, SymbolType stype)
 {
     if (is_global && scope_stack.size() != 0) 
@@ -117,8 +133,8 @@ void SymbolTableManager::add_symbol(bool is_global, std::string id,
     // Only insert when not defined yet.
     else     
     {
-        if (is_global) global_symbols.insert({id, new SymTableEntry(type, stype, id)});
-        else curr_symbols->insert({id, new SymTableEntry(type, stype, id)});
+        if (is_global) global_symbols.insert({id, new_entry(type, stype, id)});
+        else curr_symbols->insert({id, new_entry(type, stype, id)});
     }
 }
 
@@ -133,12 +149,12 @@ void SymbolTableManager::add_builtin_proc(bool is_global, std::string id,
     SymTableEntry* proc_entry = resolve_symbol(id, true);
 
     // Setup proc's parameter
-    SymTableEntry* param_entry = new SymTableEntry(IDENTIFIER, param_sym_type, id);
+    SymTableEntry* param_entry = new_entry(IDENTIFIER, param_sym_type, id);
     param_entry->param_type = param_type; // IN|OUT|INOUT
 
     // Add parameter to proc's parameters
     proc_entry->parameters.push_back(param_entry);
-    proc_entry->local_symbols = new SymTable();
+    proc_entry->local_symbols = new_table();
     // Add parameter to proc's scope, named val.
     (*(proc_entry->local_symbols))["val"] = param_entry;
 }
@@ -168,11 +184,13 @@ void SymbolTableManager::promote_to_global(std::string id, SymTableEntry* entry)
 
 void SymbolTableManager::set_proc_scope(std::string id)
 {
+    if (curr_symbols->count(id) == 0) 
+        curr_symbols->insert({id, new_entry(IDENTIFIER, S_UNDEFINED, id)});
     SymTableEntry* proc_entry = (*curr_symbols)[id];
 
     // TODO: Check if proc was already declared
     proc_entry->sym_type = S_PROCEDURE;
-    proc_entry->local_symbols = new SymTable();
+    proc_entry->local_symbols = new_table();
 
     scope_stack.push({curr_symbols, curr_proc});
     curr_symbols = proc_entry->local_symbols; 
@@ -236,9 +254,70 @@ llvm::Function* SymbolTableManager::get_curr_proc_function()
 
 void SymbolTableManager::reset_scope()
 {
+    // Nothing in the scope being left is read or assigned again, 
+    //  so its variables' SSA values can go (and with them, any 
+    //  pointers to blocks that might be deleted, see --stream)
+    for (auto& pair : *curr_symbols)
+    {
+        SymTableEntry* entry = pair.second;
+        decltype(entry->ssa_defs)().swap(entry->ssa_defs);
+    }
+
     std::pair<SymTable*, SymTableEntry*> context = scope_stack.top();
     curr_symbols = context.first;
     curr_proc = context.second;
     scope_stack.pop();
 }
 
+
+int SymbolTableManager::scope_depth()
+{
+    return scope_stack.size();
+}
+
+SymTable SymbolTableManager::snapshot_globals()
+{
+    SymTable snapshot;
+    for (auto& pair : global_symbols)
+    {
+        SymTableEntry* entry = pair.second;
+        // Reserved words have their own TokenType; 
+        //  builtins are set up again by init_tables
+        if (entry->type != IDENTIFIER || entry->sym_type == S_PROCEDURE)
+            continue;
+
+        SymTableEntry* copy = new_entry(*entry);
+        copy->value = nullptr;
+        copy->function = nullptr;
+        snapshot.insert({pair.first, copy});
+    }
+    return snapshot;
+}
+
+void SymbolTableManager::import_globals(const SymTable& globals)
+{
+    for (auto& pair : globals)
+    {
+        SymTableEntry* copy = new_entry(*pair.second);
+        copy->imported = true;
+        global_symbols.insert({pair.first, copy});
+    }
+}
+
+void SymbolTableManager::set_import_handler(
+    std::function<void(SymTableEntry*)> handler)
+{
+    import_handler = handler;
+}
+
+void SymbolTableManager::record_global_lookups(std::vector<std::string>* lookups)
+{
+    global_lookups = lookups;
+}
+
+SymTableEntry* SymbolTableManager::find_global(const std::string& id)
+{
+    auto it = global_symbols.find(id);
+    if (it == global_symbols.end()) return nullptr;
+    return it->second;
+}
@@ -2,10 +2,14 @@
 #include "token.h"
 #include "errhandler.h"
 
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/ValueHandle.h"
 
+#include <functional>
+#include <memory>
 #include <sstream>
 #include <unordered_map>
 #include <stack>
@@ -39,7 +43,7 @@ struct SymTableEntry
 
     // If this is a procedure, this
     //  stores the proc local symbol table
-    SymTable* local_symbols;
+    SymTable* local_symbols = nullptr;
 
     // If this is a procedure, stores a list of params: type, id, in|out|inout
     std::vector<SymTableEntry*> parameters;
@@ -52,10 +56,24 @@ struct SymTableEntry
     // if type==IDENTIFIER, 
     // stores the llvm variable allocated space
     //llvm::AllocaInst* value;
-    llvm::Value* value;
+    llvm::Value* value = nullptr;
     
     // Maybe just keep this? No need for the other info then?
-    llvm::Function* function;
+    llvm::Function* function = nullptr;
+
+    // If this is a local scalar (or a scalar parameter), it's kept in 
+    //  SSA registers instead of memory; value is unused then. 
+    //  ssa_type is its llvm type, and ssa_defs is its current 
+    //  value at the end of each block it's been assigned in.
+    llvm::Type* ssa_type = nullptr;
+    std::unordered_map<llvm::BasicBlock*, llvm::WeakTrackingVH> ssa_defs;
+
+    // The variable's debug info (-g), if it's a local or a parameter
+    llvm::DILocalVariable* debug_variable = nullptr;
+
+    // Copied in from another symbol table (see import_globals). 
+    //  value is filled in by the import handler the first time it's used.
+    bool imported = false;
 
     // If this is a function, this is the insert point that the builder
     //  should reset to when it needs to append to this function
@@ -70,20 +88,21 @@ public:
     // Get a given identifier's associated symtable entry
     //  - can be global or current scope
     // If check is true - function expects the variable to exist and 
-    //  reports an error if it does not.
-    // WARNING RETURNS NULL AND REPORTS TO ERR_HANDLER IF NOT FOUND.
+    //  reports an error if it does not (then it's added to the current 
+    //  scope, undefined, and returned).
+    // WARNING RETURNS NULL IF NOT FOUND AND CHECK IS FALSE.
     // paramIntent - the intention for this symbol; used to check parameters
     // Parameters can be IN (read only) or OUT (write only) or INOUT (read/write)
     // The intent for the parameter can be IN (it wants to read) or OUT (it wants to write)
     // If we expect to be able to read but the type is OUT, it's an error
     // Same thing if we expect to write but the type is IN
-    SymTableEntry* resolve_symbol(std::string id, bool check, TokenType paramIntent=TokenType::UNKNOWN); 
+    SymTableEntry* resolve_symbol(const std::string& id, bool check, TokenType paramIntent=TokenType::UNKNOWN); 
 
     // Setup the global table with reserved words and builtin procedures
     void init_tables();
 
     // Add a symbol to the current symbol table
-    void add_symbol(bool is_global, std::string id, 
+    void add_symbol(bool is_global, const std::string& id, 
                     TokenType type=UNKNOWN, SymbolType stype=S_UNDEFINED);
 
     // Add a builtin proc to the global table with a single parameter
@@ -96,7 +115,8 @@ public:
     void promote_to_global(std::string id, SymTableEntry* entry);
 
     // Sets the current_scope to the scope of the named procedure
-    //  (for procedure definitions)
+    //  (for procedure definitions; it's added to the current scope if 
+    //  it isn't there)
     void set_proc_scope(std::string id);
 
     // Add a parameter to the current proc. If the current scope is a proc,
@@ -120,15 +140,38 @@ public:
     // Reset curr_symbols to one scope up (pop from the stack)
     void reset_scope();
 
+    // Number of procedure scopes we're inside (0 in the outermost scope)
+    int scope_depth();
+
+    // Copies of the user defined global symbols (not reserved words or 
+    //  builtins), without their llvm values. 
+    SymTable snapshot_globals();
+
+    // Add copies of a snapshot's entries to the global table.
+    // The first time one of them is resolved, the import handler is 
+    //  called so it can create the entry's llvm value.
+    void import_globals(const SymTable& globals);
+    void set_import_handler(std::function<void(SymTableEntry*)> handler);
+
+    // While set, the id of every lookup that goes past the current scope 
+    //  (to the global table) is added to lookups
+    void record_global_lookups(std::vector<std::string>* lookups);
+
+    // The global symbol with this id, or null. Unlike resolve_symbol, 
+    //  this doesn't report, import or record anything.
+    SymTableEntry* find_global(const std::string& id);
+
 private:
     ErrHandler* err_handler;
 
     // The global scope symbol table
     SymTable global_symbols;
+    // The outermost scope's local symbols
+    SymTable outer_symbols;
     // The local scope symbol table (varies depending on context)
     // The parser will be modifying this so it is guranteed to point to the 
     //  correct scope based on parser context
-    SymTable* curr_symbols = new SymTable();
+    SymTable* curr_symbols = &outer_symbols;
 
     // The current procedure, if the current scope is a procedure's scope.
     // If current scope is the outer scope, this is null.
@@ -141,6 +184,22 @@ private:
 
     // The outermost symtable entry, storing info about 
     //  the outermost (main) function
-    SymTableEntry* global_entry = new SymTableEntry(IDENTIFIER, S_PROCEDURE, "MAIN");
+    SymTableEntry main_entry {IDENTIFIER, S_PROCEDURE, "MAIN"};
+    SymTableEntry* global_entry = &main_entry;
+
+    // Every entry and procedure table made here; 
+    //  they're freed along with the manager
+    std::vector<std::unique_ptr<SymTableEntry>> entries;
+    std::vector<std::unique_ptr<SymTable>> tables;
+    template <typename... Args>
+    SymTableEntry* new_entry(Args&&... args)
+    {
+        entries.emplace_back(new SymTableEntry(std::forward<Args>(args)...));
+        return entries.back().get();
+    }
+    SymTable* new_table();
+
+    std::function<void(SymTableEntry*)> import_handler;
+    std::vector<std::string>* global_lookups = nullptr;
 };
 
@@ -8,9 +8,12 @@
 enum TokenType 
 {
     PERIOD, SEMICOLON, L_PAREN, R_PAREN, COMMA, L_BRACKET, R_BRACKET, COLON, AND, OR, PLUS, MINUS, LT, GT, LT_EQ, GT_EQ, ASSIGNMENT, EQUALS, NOTEQUAL, MULTIPLICATION, DIVISION, FILE_END, STRING, CHAR, INTEGER, FLOAT, BOOL, IDENTIFIER, UNKNOWN,
-    RS_IN, RS_OUT, RS_INOUT, RS_PROGRAM, RS_IS, RS_BEGIN, RS_END, RS_GLOBAL, RS_PROCEDURE, RS_STRING, RS_CHAR, RS_INTEGER, RS_FLOAT, RS_BOOL, RS_IF, RS_THEN, RS_ELSE, RS_FOR, RS_RETURN, RS_TRUE, RS_FALSE, RS_NOT
+    RS_IN, RS_OUT, RS_INOUT, RS_PROGRAM, RS_IS, RS_BEGIN, RS_END, RS_GLOBAL, RS_PROCEDURE, RS_STRING, RS_CHAR, RS_INTEGER, RS_FLOAT, RS_BOOL, RS_IF, RS_THEN, RS_ELSE, RS_FOR, RS_RETURN, RS_TRUE, RS_FALSE, RS_NOT, RS_CASE, RS_WHEN, RS_MEMOIZE
 };
 
+// Name of each TokenType, for messages (defined in parser.cpp)
+extern const char* TokenTypeStrings[];
+
 // Types that identifiers and values (literals) can be
 enum SymbolType
 {
@@ -22,24 +25,30 @@ enum CharClass
     SYMBOL=0, LETTER, DIGIT, WHITESPACE
 };
 
-// TODO: Code generation stage - value should just store llvm registers.
-//  Value is passed around in every stage below expression(), 
-//  which would mean it's dealing with literals and symbols, which are regs.
-struct MyValue
+// Payload of a token. Which member is valid depends on the token type:
+//  IDENTIFIER and reserved words - atom (index into the scanner's atom table)
+//  STRING - literal (index into the scanner's string literal pool)
+//  CHAR - char_value
+//  INTEGER, RS_TRUE, RS_FALSE - int_value
+//  FLOAT - float_value
+union TokenValue
 {
-    SymbolType sym_type;
-
-    std::string string_value;
+    int atom;
+    int literal;
     char char_value;
     int int_value;
     float float_value;
 };
 
-// Represents a single token from the source file
+// Represents a single token from the source file.
+// Tokens are small enough to be passed around by value; anything that
+//  doesn't fit in the payload lives in the scanner's tables.
 struct Token
 {
     TokenType type;
-    MyValue val;
+    TokenValue val;
+    int offset; // Byte offset of the token in the source
     int line;
 };
 
+static_assert(sizeof(Token) == 16, "Token should stay 16 bytes");
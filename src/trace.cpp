@@ -0,0 +1,39 @@
+#include "trace.h"
+
+#include <iostream>
+#include <mutex>
+
+unsigned trace_categories = 0;
+
+static std::mutex trace_mutex;
+
+bool enable_tracing(const std::string& list)
+{
+    bool valid = true;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(start, end - start);
+
+        if (name == "lexer") trace_categories |= TRACE_LEXER;
+        else if (name == "parser") trace_categories |= TRACE_PARSER;
+        else if (name == "codegen") trace_categories |= TRACE_CODEGEN;
+        else if (name == "passes") trace_categories |= TRACE_PASSES;
+        else if (name == "vm") trace_categories |= TRACE_VM;
+        else if (name == "all") 
+            trace_categories |= TRACE_LEXER | TRACE_PARSER | TRACE_CODEGEN 
+                | TRACE_PASSES | TRACE_VM;
+        else valid = false;
+
+        start = end + 1;
+    }
+    return valid;
+}
+
+void trace_line(const std::string& line)
+{
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    std::cerr << line << '\n';
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <sstream>
+#include <string>
+
+// Debug output, enabled per category at runtime with --trace=...
+// Each category is one bit of trace_categories.
+enum TraceCategory
+{
+    TRACE_LEXER = 1,    // every token the scanner returns
+    TRACE_PARSER = 2,   // grammar rules as they're entered
+    TRACE_CODEGEN = 4,  // llvm ir as it's generated
+    TRACE_PASSES = 8,   // time spent in each optimization pass
+    TRACE_VM = 16       // the bytecode VM's lowering and running time
+};
+
+// Set once from the command line, before anything is compiled
+extern unsigned trace_categories;
+
+// Enable the categories in a comma separated list (e.g. "lexer,parser"). 
+//  "all" enables every category. Returns false if a name isn't known.
+bool enable_tracing(const std::string& list);
+
+// Print a finished trace line to stderr (lines from different threads 
+//  don't get mixed together)
+void trace_line(const std::string& line);
+
+// TRACE(TRACE_PARSER, "name " << id);
+// When the category is off, this is a single test of a global and the 
+//  message isn't evaluated.
+#define TRACE(category, message) \
+    do \
+    { \
+        if (trace_categories & (category)) \
+        { \
+            std::ostringstream trace_stream; \
+            trace_stream << message; \
+            trace_line(trace_stream.str()); \
+        } \
+    } while (false)
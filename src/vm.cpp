@@ -0,0 +1,1575 @@
+#include "vm.h"
+#include "runtime.h"
+#include "trace.h"
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+
+using namespace llvm;
+
+typedef std::chrono::steady_clock Clock;
+
+#if defined(__GNUC__)
+// Each handler jumps straight to the next one's address
+#define VM_THREADED
+#endif
+
+// Registers: a the result (or the value stored), b and c the operands;
+//  d is the bit width for the ops that work on any integer type.
+//  Branch targets are instruction indices.
+#define VM_OPS(X) \
+    X(MOV) \
+    X(ADD_I32) X(SUB_I32) X(MUL_I32) X(SDIV_I32) X(SREM_I32) \
+    X(ADD) X(SUB) X(MUL) X(SDIV) X(SREM) X(UDIV) X(UREM) \
+    X(AND) X(OR) X(XOR) X(SHL) X(LSHR) X(ASHR) \
+    X(ICMP_EQ) X(ICMP_NE) X(ICMP_SLT) X(ICMP_SLE) X(ICMP_SGT) X(ICMP_SGE) \
+    X(ICMP_ULT) X(ICMP_ULE) X(ICMP_UGT) X(ICMP_UGE) \
+    X(FADD) X(FSUB) X(FMUL) X(FDIV) X(FNEG) X(FCMP) \
+    X(ZEXT) X(SEXT_I1) X(TRUNC) X(SITOFP) X(FPTOSI) \
+    X(LOAD_I1) X(LOAD_I8) X(LOAD_I16) X(LOAD_I32) X(LOAD_I64) \
+    X(LOAD_F32) X(LOAD_F64) \
+    X(STORE_I8) X(STORE_I16) X(STORE_I32) X(STORE_I64) \
+    X(STORE_F32) X(STORE_F64) \
+    X(PTR_ADD) X(GEP_INDEX) X(ALLOCA) X(AGG_COPY) X(AGG_STORE) X(SELECT) \
+    X(JMP) X(BR_IF) X(BR_EQ) X(BR_NE) X(BR_SLT) X(BR_SLE) X(BR_SGT) \
+    X(BR_SGE) X(SWITCH) \
+    X(CALL) X(NATIVE) X(RET) X(RET_VOID) X(UNREACHABLE)
+
+enum Op
+{
+#define OP_ENUM(name) OP_##name,
+    VM_OPS(OP_ENUM)
+#undef OP_ENUM
+};
+
+// Registers hold 64 bits
+static const unsigned MAX_WIDTH = 64;
+// Registers for every frame being run, and their memory
+static const int REGISTER_STACK_SLOTS = 1 << 21;
+static const int FRAME_STACK_BYTES = 64 << 20;
+
+// value (of an integer type width bits wide) in a register's form
+static inline int64_t canonical(uint64_t value, unsigned width)
+{
+    if (width >= 64) return (int64_t)value;
+    if (width == 1) return value & 1;
+    unsigned shift = 64 - width;
+    return (int64_t)(value << shift) >> shift;
+}
+
+// A register's integer, zero extended from width bits
+static inline uint64_t zero_extend(int64_t value, unsigned width)
+{
+    if (width >= 64) return (uint64_t)value;
+    return (uint64_t)value & ((uint64_t(1) << width) - 1);
+}
+
+static inline uint64_t align_to(uint64_t size, uint64_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static std::string describe(const Value& V)
+{
+    std::string text;
+    raw_string_ostream out(text);
+    V.print(out);
+    out.flush();
+    return text.substr(text.find_first_not_of(' '));
+}
+
+// The builtins, called with their argument's register
+template <typename T> static T slot_value(const BytecodeVM::Slot& slot);
+template <> bool slot_value<bool>(const BytecodeVM::Slot& slot)
+{
+    return slot.i != 0;
+}
+template <> int slot_value<int>(const BytecodeVM::Slot& slot)
+{
+    return (int)slot.i;
+}
+template <> char slot_value<char>(const BytecodeVM::Slot& slot)
+{
+    return (char)slot.i;
+}
+template <> float slot_value<float>(const BytecodeVM::Slot& slot)
+{
+    return slot.f;
+}
+template <> char* slot_value<char*>(const BytecodeVM::Slot& slot)
+{
+    return (char*)slot.p;
+}
+
+#define BUILTIN_RS_IN(name, c_type) \
+    static void call_##name(BytecodeVM::Slot* regs, const int* args) \
+    { \
+        name(slot_value<c_type>(regs[args[0]])); \
+    }
+#define BUILTIN_RS_OUT(name, c_type) \
+    static void call_##name(BytecodeVM::Slot* regs, const int* args) \
+    { \
+        name((c_type*)regs[args[0]].p); \
+    }
+#define BUILTIN(name, sym_type, param_type, c_type) \
+    BUILTIN_##param_type(name, c_type)
+#include "builtins.def"
+#undef BUILTIN_RS_IN
+#undef BUILTIN_RS_OUT
+
+static void call_MEMOIZE_REGISTER(BytecodeVM::Slot* regs, const int* args)
+{
+    MEMOIZE_REGISTER((char*)regs[args[0]].p, (long long*)regs[args[1]].p);
+}
+
+static const std::map<std::string,
+    void (*)(BytecodeVM::Slot*, const int*)> native_functions = {
+#define BUILTIN(name, sym_type, param_type, c_type) {#name, &call_##name},
+#include "builtins.def"
+    {"MEMOIZE_REGISTER", &call_MEMOIZE_REGISTER}
+};
+
+// Lowers one function's IR to bytecode
+class FunctionLowering
+{
+public:
+    FunctionLowering(BytecodeVM& vm, BytecodeVM::Function& out,
+        std::string& error)
+        : vm(vm), out(out), error(error), layout(*vm.layout)
+    {
+    }
+
+    bool lower(Function& F);
+
+private:
+    typedef BytecodeVM::Instruction Instruction;
+    typedef BytecodeVM::Slot Slot;
+
+    // A branch target, set once every block has been lowered:
+    //  the instruction's field, or a case of a switch table
+    struct Fixup
+    {
+        enum Kind { FIELD_B, FIELD_C, FIELD_D, CASE, DEFAULT } kind;
+        size_t index;
+        size_t case_index;
+        // The edge (from is null if the phis' moves are done already)
+        const BasicBlock* from;
+        const BasicBlock* to;
+    };
+
+    BytecodeVM& vm;
+    BytecodeVM::Function& out;
+    std::string& error;
+    const DataLayout& layout;
+
+    int next_register = 0;
+    std::unordered_map<const Value*, int> registers;
+    std::unordered_map<const Constant*, int> constant_registers;
+    std::unordered_map<const BasicBlock*, int> block_starts;
+    std::map<std::pair<const BasicBlock*, const BasicBlock*>, int> edges;
+    std::vector<Fixup> fixups;
+    // For moves that would overwrite each other's sources
+    std::vector<int> temporaries;
+    const BasicBlock* next_block = nullptr;
+
+    bool fail(const std::string& message)
+    {
+        if (error.empty()) error = message;
+        return false;
+    }
+    bool unsupported(const Value& V)
+    {
+        return fail("The VM can't run: " + describe(V));
+    }
+
+    void emit(Op op, int a = 0, int b = 0, int c = 0, int d = 0)
+    {
+        Instruction instruction;
+        instruction.op = op;
+        instruction.a = a;
+        instruction.b = b;
+        instruction.c = c;
+        instruction.d = d;
+        out.code.push_back(instruction);
+    }
+
+    // Space in the frame's memory
+    int allocate(uint64_t size)
+    {
+        uint64_t offset = out.frame_size;
+        uint64_t end = align_to(offset + size, 16);
+        if (end > (uint64_t)std::numeric_limits<int32_t>::max())
+        {
+            fail("The VM can't run " + out.name + ": its locals are too big");
+            return 0;
+        }
+        out.frame_size = end;
+        return offset;
+    }
+
+    int operand(const Value* V);
+    bool lower(const llvm::Instruction& I);
+    bool lower_binary(const BinaryOperator& I);
+    bool lower_compare(const ICmpInst& I);
+    bool lower_cast(const CastInst& I);
+    bool lower_gep(const GetElementPtrInst& I);
+    bool gep_address(const GetElementPtrInst& I, int& base, int& offset);
+    bool address(const Value* pointer, int& base, int& offset);
+    bool lower_call(const CallInst& I);
+    bool lower_branch(const BranchInst& I);
+    void lower_conditional(const BranchInst& I);
+    const BranchInst* only_branch(const BasicBlock* block);
+    bool lower_switch(const SwitchInst& I);
+    bool memory_op(Type* type, bool store, Op& op);
+    bool aggregate_offset(Type* type, ArrayRef<unsigned> indices,
+        uint64_t& offset, Type*& element);
+    bool fused_compare(const ICmpInst& I);
+    bool folded_index(const BinaryOperator& I);
+    bool folded_address(const GetElementPtrInst& I);
+
+    void branch_to(Fixup::Kind kind, size_t index, const BasicBlock* from,
+        const BasicBlock* to, size_t case_index = 0)
+    {
+        fixups.push_back({kind, index, case_index, from, to});
+    }
+    void emit_moves(const BasicBlock* from, const BasicBlock* to);
+    int edge_target(const Fixup& fixup);
+};
+
+int FunctionLowering::operand(const Value* V)
+{
+    auto found = registers.find(V);
+    if (found != registers.end()) return found->second;
+
+    const Constant* C = dyn_cast<Constant>(V);
+    if (!C)
+    {
+        fail("The VM can't use the value: " + describe(*V));
+        return 0;
+    }
+    auto constant = constant_registers.find(C);
+    if (constant != constant_registers.end()) return constant->second;
+
+    Slot value;
+    value.i = 0;
+    if (!vm.constant_value(C, value, error)) return 0;
+    int reg = next_register++;
+    constant_registers[C] = reg;
+    out.constants.push_back({reg, value});
+    return reg;
+}
+
+bool FunctionLowering::memory_op(Type* type, bool store, Op& op)
+{
+    if (type->isIntegerTy())
+    {
+        switch (type->getIntegerBitWidth())
+        {
+        case 1: op = store ? OP_STORE_I8 : OP_LOAD_I1; return true;
+        case 8: op = store ? OP_STORE_I8 : OP_LOAD_I8; return true;
+        case 16: op = store ? OP_STORE_I16 : OP_LOAD_I16; return true;
+        case 32: op = store ? OP_STORE_I32 : OP_LOAD_I32; return true;
+        case 64: op = store ? OP_STORE_I64 : OP_LOAD_I64; return true;
+        default: return false;
+        }
+    }
+    if (type->isFloatTy()) op = store ? OP_STORE_F32 : OP_LOAD_F32;
+    else if (type->isDoubleTy()) op = store ? OP_STORE_F64 : OP_LOAD_F64;
+    else if (type->isPointerTy()) op = store ? OP_STORE_I64 : OP_LOAD_I64;
+    else return false;
+    return true;
+}
+
+bool FunctionLowering::aggregate_offset(Type* type,
+    ArrayRef<unsigned> indices, uint64_t& offset, Type*& element)
+{
+    offset = 0;
+    for (unsigned index : indices)
+    {
+        if (StructType* ST = dyn_cast<StructType>(type))
+        {
+            offset += layout.getStructLayout(ST)->getElementOffset(index);
+            type = ST->getElementType(index);
+        }
+        else if (ArrayType* AT = dyn_cast<ArrayType>(type))
+        {
+            type = AT->getElementType();
+            offset += index * layout.getTypeAllocSize(type);
+        }
+        else return false;
+    }
+    element = type;
+    return offset <= (uint64_t)std::numeric_limits<int32_t>::max();
+}
+
+// A compare that's only used by the branch after it is done by the branch
+bool FunctionLowering::fused_compare(const ICmpInst& I)
+{
+    if (!I.hasOneUse()) return false;
+    const BranchInst* branch = dyn_cast<BranchInst>(*I.user_begin());
+    if (!branch || branch->getParent() != I.getParent()) return false;
+
+    Type* type = I.getOperand(0)->getType();
+    if (type->isIntegerTy(1) || type->isVectorTy()) return false;
+    switch (I.getPredicate())
+    {
+    case CmpInst::ICMP_EQ: case CmpInst::ICMP_NE:
+    case CmpInst::ICMP_SLT: case CmpInst::ICMP_SLE:
+    case CmpInst::ICMP_SGT: case CmpInst::ICMP_SGE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Adding a constant to (or subtracting it from) an index, as for an 
+//  array's lower bound, is done by the GEP that uses it
+bool FunctionLowering::folded_index(const BinaryOperator& I)
+{
+    if ((I.getOpcode() != llvm::Instruction::Add 
+        && I.getOpcode() != llvm::Instruction::Sub)
+        || !isa<ConstantInt>(I.getOperand(1)) || !I.hasOneUse())
+        return false;
+    const GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(
+        *I.user_begin());
+    return gep && gep->getParent() == I.getParent() 
+        && gep->getPointerOperand() != &I && !gep->getType()->isVectorTy();
+}
+
+// A GEP that's only the address of a load or store after it is done by 
+//  the load or store (with its constant offset)
+bool FunctionLowering::folded_address(const GetElementPtrInst& I)
+{
+    if (!I.hasOneUse() || I.getType()->isVectorTy()) return false;
+    const llvm::Instruction* user = dyn_cast<llvm::Instruction>(
+        *I.user_begin());
+    if (!user || user->getParent() != I.getParent()) return false;
+    if (const LoadInst* load = dyn_cast<LoadInst>(user))
+        return !load->getType()->isAggregateType();
+    if (const StoreInst* store = dyn_cast<StoreInst>(user))
+    {
+        return store->getPointerOperand() == &I 
+            && !store->getValueOperand()->getType()->isAggregateType();
+    }
+    return false;
+}
+
+bool FunctionLowering::lower_binary(const BinaryOperator& I)
+{
+    // (done by the GEP)
+    if (folded_index(I)) return true;
+
+    int a = registers[&I];
+    int b = operand(I.getOperand(0));
+    int c = operand(I.getOperand(1));
+
+    if (I.getType()->isFloatTy())
+    {
+        switch (I.getOpcode())
+        {
+        case llvm::Instruction::FAdd: emit(OP_FADD, a, b, c); return true;
+        case llvm::Instruction::FSub: emit(OP_FSUB, a, b, c); return true;
+        case llvm::Instruction::FMul: emit(OP_FMUL, a, b, c); return true;
+        case llvm::Instruction::FDiv: emit(OP_FDIV, a, b, c); return true;
+        default: return unsupported(I);
+        }
+    }
+    if (!I.getType()->isIntegerTy()
+        || I.getType()->getIntegerBitWidth() > MAX_WIDTH)
+        return unsupported(I);
+
+    unsigned width = I.getType()->getIntegerBitWidth();
+    bool i32 = width == 32;
+    Op op;
+    switch (I.getOpcode())
+    {
+    case llvm::Instruction::Add: op = i32 ? OP_ADD_I32 : OP_ADD; break;
+    case llvm::Instruction::Sub: op = i32 ? OP_SUB_I32 : OP_SUB; break;
+    case llvm::Instruction::Mul: op = i32 ? OP_MUL_I32 : OP_MUL; break;
+    case llvm::Instruction::SDiv: op = i32 ? OP_SDIV_I32 : OP_SDIV; break;
+    case llvm::Instruction::SRem: op = i32 ? OP_SREM_I32 : OP_SREM; break;
+    case llvm::Instruction::UDiv: op = OP_UDIV; break;
+    case llvm::Instruction::URem: op = OP_UREM; break;
+    case llvm::Instruction::And: op = OP_AND; break;
+    case llvm::Instruction::Or: op = OP_OR; break;
+    case llvm::Instruction::Xor: op = OP_XOR; break;
+    case llvm::Instruction::Shl: op = OP_SHL; break;
+    case llvm::Instruction::LShr: op = OP_LSHR; break;
+    case llvm::Instruction::AShr: op = OP_ASHR; break;
+    default: return unsupported(I);
+    }
+    emit(op, a, b, c, width);
+    return true;
+}
+
+bool FunctionLowering::lower_compare(const ICmpInst& I)
+{
+    // (done by the branch)
+    if (fused_compare(I)) return true;
+
+    Type* type = I.getOperand(0)->getType();
+    if (type->isVectorTy()
+        || (type->isIntegerTy() && type->getIntegerBitWidth() > MAX_WIDTH))
+        return unsupported(I);
+    unsigned width = type->isIntegerTy() ? type->getIntegerBitWidth() : 64;
+
+    CmpInst::Predicate predicate = I.getPredicate();
+    // An i1 true is -1 when it's signed, but 1 in a register
+    if (width == 1 && I.isSigned())
+        predicate = CmpInst::getSwappedPredicate(
+            CmpInst::getUnsignedPredicate(predicate));
+
+    Op op;
+    switch (predicate)
+    {
+    case CmpInst::ICMP_EQ: op = OP_ICMP_EQ; break;
+    case CmpInst::ICMP_NE: op = OP_ICMP_NE; break;
+    case CmpInst::ICMP_SLT: op = OP_ICMP_SLT; break;
+    case CmpInst::ICMP_SLE: op = OP_ICMP_SLE; break;
+    case CmpInst::ICMP_SGT: op = OP_ICMP_SGT; break;
+    case CmpInst::ICMP_SGE: op = OP_ICMP_SGE; break;
+    case CmpInst::ICMP_ULT: op = OP_ICMP_ULT; break;
+    case CmpInst::ICMP_ULE: op = OP_ICMP_ULE; break;
+    case CmpInst::ICMP_UGT: op = OP_ICMP_UGT; break;
+    case CmpInst::ICMP_UGE: op = OP_ICMP_UGE; break;
+    default: return unsupported(I);
+    }
+    emit(op, registers[&I], operand(I.getOperand(0)),
+        operand(I.getOperand(1)), width);
+    return true;
+}
+
+bool FunctionLowering::lower_cast(const CastInst& I)
+{
+    Type* from = I.getSrcTy();
+    Type* to = I.getDestTy();
+    if (from->isVectorTy() || to->isVectorTy()) return unsupported(I);
+    int a = registers[&I];
+    int b = operand(I.getOperand(0));
+
+    switch (I.getOpcode())
+    {
+    case llvm::Instruction::ZExt:
+        emit(OP_ZEXT, a, b, 0, from->getIntegerBitWidth());
+        return true;
+    case llvm::Instruction::SExt:
+        // (everything else is sign extended already)
+        if (from->isIntegerTy(1)) emit(OP_SEXT_I1, a, b);
+        else emit(OP_MOV, a, b);
+        return true;
+    case llvm::Instruction::Trunc:
+        emit(OP_TRUNC, a, b, 0, to->getIntegerBitWidth());
+        return true;
+    case llvm::Instruction::SIToFP:
+        if (!to->isFloatTy()) return unsupported(I);
+        emit(OP_SITOFP, a, b);
+        return true;
+    case llvm::Instruction::FPToSI:
+        if (!from->isFloatTy()) return unsupported(I);
+        emit(OP_FPTOSI, a, b, 0, to->getIntegerBitWidth());
+        return true;
+    case llvm::Instruction::PtrToInt:
+        emit(OP_TRUNC, a, b, 0, to->getIntegerBitWidth());
+        return true;
+    case llvm::Instruction::IntToPtr:
+        emit(OP_ZEXT, a, b, 0, from->getIntegerBitWidth());
+        return true;
+    case llvm::Instruction::BitCast:
+        if (!from->isPointerTy() || !to->isPointerTy()) return unsupported(I);
+        emit(OP_MOV, a, b);
+        return true;
+    default:
+        return unsupported(I);
+    }
+}
+
+// The address I computes is base's register plus offset (base is I's
+//  own register if it has any variable indices)
+bool FunctionLowering::gep_address(const GetElementPtrInst& I, int& base,
+    int& offset)
+{
+    int a = registers[&I];
+    base = operand(I.getPointerOperand());
+
+    // Constant indices are added up; each variable one is scaled
+    //  and added to what's been computed so far
+    int64_t total = 0;
+    for (gep_type_iterator it = gep_type_begin(I), end = gep_type_end(I);
+        it != end; ++it)
+    {
+        const Value* index = it.getOperand();
+        if (StructType* ST = it.getStructTypeOrNull())
+        {
+            unsigned field = cast<ConstantInt>(index)->getZExtValue();
+            total += layout.getStructLayout(ST)->getElementOffset(field);
+            continue;
+        }
+        int64_t size = layout.getTypeAllocSize(it.getIndexedType());
+        if (const ConstantInt* CI = dyn_cast<ConstantInt>(index))
+        {
+            total += CI->getSExtValue() * size;
+            continue;
+        }
+        if (size > std::numeric_limits<int32_t>::max())
+            return unsupported(I);
+
+        const BinaryOperator* sum = dyn_cast<BinaryOperator>(index);
+        if (sum && folded_index(*sum))
+        {
+            int64_t constant = cast<ConstantInt>(
+                sum->getOperand(1))->getSExtValue();
+            if (sum->getOpcode() == llvm::Instruction::Sub) 
+                constant = -constant;
+            total += constant * size;
+            index = sum->getOperand(0);
+        }
+        emit(OP_GEP_INDEX, a, base, operand(index), size);
+        base = a;
+    }
+
+    if (total < std::numeric_limits<int32_t>::min()
+        || total > std::numeric_limits<int32_t>::max())
+        return unsupported(I);
+    offset = total;
+    return true;
+}
+
+bool FunctionLowering::lower_gep(const GetElementPtrInst& I)
+{
+    if (I.getType()->isVectorTy()) return unsupported(I);
+    // (done by the load or store)
+    if (folded_address(I)) return true;
+
+    int a = registers[&I];
+    int base, offset;
+    if (!gep_address(I, base, offset)) return false;
+    if (offset != 0) emit(OP_PTR_ADD, a, base, offset);
+    else if (base != a) emit(OP_MOV, a, base);
+    return true;
+}
+
+// A load or store's address: a register, and an offset from it
+bool FunctionLowering::address(const Value* pointer, int& base, int& offset)
+{
+    const GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(pointer);
+    if (gep && folded_address(*gep)) return gep_address(*gep, base, offset);
+    base = operand(pointer);
+    offset = 0;
+    return true;
+}
+
+bool FunctionLowering::lower_call(const CallInst& I)
+{
+    const llvm::Function* callee = I.getCalledFunction();
+    if (!callee) return unsupported(I);
+
+    if (callee->isIntrinsic())
+    {
+        // Nothing to do: the frame's memory is there for the whole call, 
+        //  and debug info (-g) is only for debuggers
+        if (callee->getIntrinsicID() == Intrinsic::lifetime_start
+            || callee->getIntrinsicID() == Intrinsic::lifetime_end
+            || isa<DbgInfoIntrinsic>(I))
+            return true;
+        return unsupported(I);
+    }
+
+    std::vector<int> args;
+    for (unsigned k = 0; k < callee->arg_size(); k++)
+        args.push_back(operand(I.getArgOperand(k)));
+
+    auto found = vm.function_indices.find(callee);
+    if (found == vm.function_indices.end())
+    {
+        auto native = native_functions.find(callee->getName().str());
+        if (native == native_functions.end())
+            return fail("The VM can't call " + callee->getName().str()
+                + " (it isn't defined in the program)");
+        out.natives.push_back({native->second, args});
+        emit(OP_NATIVE, 0, out.natives.size() - 1);
+        return true;
+    }
+
+    BytecodeVM::CallSite site;
+    site.function = found->second;
+    site.result = -1;
+    site.result_offset = 0;
+    site.result_size = 0;
+    site.args = args;
+    if (!I.getType()->isVoidTy() && !I.use_empty())
+    {
+        site.result = registers[&I];
+        if (I.getType()->isAggregateType())
+        {
+            site.result_size = layout.getTypeAllocSize(I.getType());
+            site.result_offset = allocate(site.result_size);
+        }
+    }
+    out.calls.push_back(site);
+    emit(OP_CALL, 0, out.calls.size() - 1);
+    return true;
+}
+
+void FunctionLowering::emit_moves(const BasicBlock* from,
+    const BasicBlock* to)
+{
+    std::vector<std::pair<int, int>> moves;
+    for (const llvm::Instruction& I : *to)
+    {
+        const PHINode* phi = dyn_cast<PHINode>(&I);
+        if (!phi) break;
+        int source = operand(phi->getIncomingValueForBlock(from));
+        int destination = registers[phi];
+        if (source != destination) moves.push_back({destination, source});
+    }
+
+    // When one phi's value is another's (a swap), they're all copied
+    //  out of the way first
+    bool overlap = false;
+    for (auto& move : moves)
+    {
+        for (auto& other : moves)
+        {
+            if (&move != &other && other.second == move.first) overlap = true;
+        }
+    }
+    if (!overlap)
+    {
+        for (auto& move : moves) emit(OP_MOV, move.first, move.second);
+        return;
+    }
+    while (temporaries.size() < moves.size())
+        temporaries.push_back(next_register++);
+    for (size_t k = 0; k < moves.size(); k++)
+        emit(OP_MOV, temporaries[k], moves[k].second);
+    for (size_t k = 0; k < moves.size(); k++)
+        emit(OP_MOV, moves[k].first, temporaries[k]);
+}
+
+// Where a branch along the edge goes: the block, or a trampoline with
+//  its phis' moves
+int FunctionLowering::edge_target(const Fixup& fixup)
+{
+    if (!fixup.from || !isa<PHINode>(fixup.to->front()))
+        return block_starts[fixup.to];
+
+    auto edge = std::make_pair(fixup.from, fixup.to);
+    auto found = edges.find(edge);
+    if (found != edges.end()) return found->second;
+
+    int start = out.code.size();
+    emit_moves(fixup.from, fixup.to);
+    emit(OP_JMP, 0, block_starts[fixup.to]);
+    edges[edge] = start;
+    return start;
+}
+
+// A conditional branch out of I's block
+void FunctionLowering::lower_conditional(const BranchInst& I)
+{
+    const BasicBlock* from = I.getParent();
+    const Value* condition = I.getCondition();
+    const ICmpInst* compare = dyn_cast<ICmpInst>(condition);
+    size_t index = out.code.size();
+    if (compare && fused_compare(*compare))
+    {
+        Op op;
+        switch (compare->getPredicate())
+        {
+        case CmpInst::ICMP_EQ: op = OP_BR_EQ; break;
+        case CmpInst::ICMP_NE: op = OP_BR_NE; break;
+        case CmpInst::ICMP_SLT: op = OP_BR_SLT; break;
+        case CmpInst::ICMP_SLE: op = OP_BR_SLE; break;
+        case CmpInst::ICMP_SGT: op = OP_BR_SGT; break;
+        default: op = OP_BR_SGE; break;
+        }
+        emit(op, operand(compare->getOperand(0)),
+            operand(compare->getOperand(1)));
+        branch_to(Fixup::FIELD_C, index, from, I.getSuccessor(0));
+        branch_to(Fixup::FIELD_D, index, from, I.getSuccessor(1));
+        return;
+    }
+
+    emit(OP_BR_IF, operand(condition));
+    branch_to(Fixup::FIELD_B, index, from, I.getSuccessor(0));
+    branch_to(Fixup::FIELD_C, index, from, I.getSuccessor(1));
+}
+
+// The conditional branch that's all block does besides its phis (and 
+//  the compare the branch does itself), or null
+const BranchInst* FunctionLowering::only_branch(const BasicBlock* block)
+{
+    const BranchInst* branch = dyn_cast<BranchInst>(block->getTerminator());
+    if (!branch || branch->isUnconditional()) return nullptr;
+    const ICmpInst* compare = dyn_cast<ICmpInst>(branch->getCondition());
+    for (const llvm::Instruction& I : *block)
+    {
+        if (&I == branch || isa<PHINode>(I)) continue;
+        if (&I != compare || !fused_compare(*compare)) return nullptr;
+    }
+    return branch;
+}
+
+bool FunctionLowering::lower_branch(const BranchInst& I)
+{
+    if (!I.isUnconditional())
+    {
+        lower_conditional(I);
+        return true;
+    }
+
+    const BasicBlock* to = I.getSuccessor(0);
+    emit_moves(I.getParent(), to);
+    // (falls through to the next block)
+    if (to == next_block) return true;
+
+    // A jump to a loop's test is the test itself
+    if (const BranchInst* test = only_branch(to))
+    {
+        lower_conditional(*test);
+        return true;
+    }
+    emit(OP_JMP);
+    branch_to(Fixup::FIELD_B, out.code.size() - 1, nullptr, to);
+    return true;
+}
+
+bool FunctionLowering::lower_switch(const SwitchInst& I)
+{
+    Type* type = I.getCondition()->getType();
+    if (!type->isIntegerTy() || type->getIntegerBitWidth() > MAX_WIDTH)
+        return unsupported(I);
+    unsigned width = type->getIntegerBitWidth();
+
+    size_t table = out.switches.size();
+    out.switches.push_back(BytecodeVM::SwitchTable());
+    const BasicBlock* from = I.getParent();
+    for (auto& case_ : I.cases())
+    {
+        int64_t value = canonical(
+            case_.getCaseValue()->getZExtValue(), width);
+        branch_to(Fixup::CASE, table, from, case_.getCaseSuccessor(),
+            out.switches[table].cases.size());
+        out.switches[table].cases.push_back({value, 0});
+    }
+    branch_to(Fixup::DEFAULT, table, from, I.getDefaultDest());
+    emit(OP_SWITCH, operand(I.getCondition()), table);
+    return true;
+}
+
+bool FunctionLowering::lower(const llvm::Instruction& I)
+{
+    if (const BinaryOperator* binary = dyn_cast<BinaryOperator>(&I))
+        return lower_binary(*binary);
+    if (const CastInst* cast = dyn_cast<CastInst>(&I))
+        return lower_cast(*cast);
+    if (const ICmpInst* compare = dyn_cast<ICmpInst>(&I))
+        return lower_compare(*compare);
+
+    int a = registers.count(&I) ? registers[&I] : 0;
+    switch (I.getOpcode())
+    {
+#if LLVM_VERSION_MAJOR >= 8
+    case llvm::Instruction::FNeg:
+        if (!I.getType()->isFloatTy()) return unsupported(I);
+        emit(OP_FNEG, a, operand(I.getOperand(0)));
+        return true;
+#endif
+    case llvm::Instruction::FCmp:
+    {
+        const FCmpInst& compare = cast<FCmpInst>(I);
+        if (!compare.getOperand(0)->getType()->isFloatTy())
+            return unsupported(I);
+        emit(OP_FCMP, a, operand(compare.getOperand(0)),
+            operand(compare.getOperand(1)), compare.getPredicate());
+        return true;
+    }
+    case llvm::Instruction::Alloca:
+    {
+        const AllocaInst& alloca = cast<AllocaInst>(I);
+        const ConstantInt* count = dyn_cast<ConstantInt>(
+            alloca.getArraySize());
+        if (!count) return unsupported(I);
+        uint64_t size = layout.getTypeAllocSize(alloca.getAllocatedType())
+            * count->getZExtValue();
+        emit(OP_ALLOCA, a, 0, allocate(size));
+        return true;
+    }
+    case llvm::Instruction::Load:
+    {
+        const LoadInst& load = cast<LoadInst>(I);
+        if (load.getType()->isAggregateType())
+        {
+            int pointer = operand(load.getPointerOperand());
+            // Copied, in case the memory changes while it's in use
+            uint64_t size = layout.getTypeAllocSize(load.getType());
+            emit(OP_AGG_COPY, a, pointer, allocate(size), size);
+            return true;
+        }
+        Op op;
+        int pointer, offset;
+        if (!memory_op(load.getType(), false, op)) return unsupported(I);
+        if (!address(load.getPointerOperand(), pointer, offset)) return false;
+        emit(op, a, pointer, offset);
+        return true;
+    }
+    case llvm::Instruction::Store:
+    {
+        const StoreInst& store = cast<StoreInst>(I);
+        Type* type = store.getValueOperand()->getType();
+        int value = operand(store.getValueOperand());
+        if (type->isAggregateType())
+        {
+            emit(OP_AGG_STORE, value, operand(store.getPointerOperand()), 0,
+                layout.getTypeAllocSize(type));
+            return true;
+        }
+        Op op;
+        int pointer, offset;
+        if (!memory_op(type, true, op)) return unsupported(I);
+        if (!address(store.getPointerOperand(), pointer, offset)) 
+            return false;
+        emit(op, value, pointer, offset);
+        return true;
+    }
+    case llvm::Instruction::GetElementPtr:
+        return lower_gep(cast<GetElementPtrInst>(I));
+    case llvm::Instruction::InsertValue:
+    {
+        // A copy of the aggregate, with the value stored into it
+        const InsertValueInst& insert = cast<InsertValueInst>(I);
+        uint64_t size = layout.getTypeAllocSize(I.getType());
+        uint64_t offset;
+        Type* element;
+        if (!aggregate_offset(I.getType(), insert.getIndices(), offset,
+            element))
+            return unsupported(I);
+        int value = operand(insert.getInsertedValueOperand());
+        emit(OP_AGG_COPY, a, operand(insert.getAggregateOperand()),
+            allocate(size), size);
+
+        Op op;
+        if (element->isAggregateType())
+        {
+            int field = next_register++;
+            emit(OP_PTR_ADD, field, a, offset);
+            emit(OP_AGG_STORE, value, field, 0,
+                layout.getTypeAllocSize(element));
+        }
+        else if (memory_op(element, true, op)) emit(op, value, a, offset);
+        else return unsupported(I);
+        return true;
+    }
+    case llvm::Instruction::ExtractValue:
+    {
+        const ExtractValueInst& extract = cast<ExtractValueInst>(I);
+        uint64_t offset;
+        Type* element;
+        if (!aggregate_offset(extract.getAggregateOperand()->getType(),
+            extract.getIndices(), offset, element))
+            return unsupported(I);
+        int aggregate = operand(extract.getAggregateOperand());
+
+        Op op;
+        if (element->isAggregateType())
+            emit(OP_PTR_ADD, a, aggregate, offset);
+        else if (memory_op(element, false, op)) emit(op, a, aggregate, offset);
+        else return unsupported(I);
+        return true;
+    }
+    case llvm::Instruction::Select:
+    {
+        const SelectInst& select = cast<SelectInst>(I);
+        if (select.getCondition()->getType()->isVectorTy())
+            return unsupported(I);
+        emit(OP_SELECT, a, operand(select.getCondition()),
+            operand(select.getTrueValue()), operand(select.getFalseValue()));
+        return true;
+    }
+    case llvm::Instruction::PHI:
+        // (set by the branches to its block)
+        return true;
+    case llvm::Instruction::Call:
+        return lower_call(cast<CallInst>(I));
+    case llvm::Instruction::Br:
+        return lower_branch(cast<BranchInst>(I));
+    case llvm::Instruction::Switch:
+        return lower_switch(cast<SwitchInst>(I));
+    case llvm::Instruction::Ret:
+    {
+        const ReturnInst& ret = cast<ReturnInst>(I);
+        if (ret.getReturnValue()) emit(OP_RET, operand(ret.getReturnValue()));
+        else emit(OP_RET_VOID);
+        return true;
+    }
+    case llvm::Instruction::Unreachable:
+        emit(OP_UNREACHABLE);
+        return true;
+    default:
+        return unsupported(I);
+    }
+}
+
+bool FunctionLowering::lower(Function& F)
+{
+    // The arguments come first, where the caller puts them
+    for (const Argument& arg : F.args()) registers[&arg] = next_register++;
+    out.param_count = next_register;
+    for (const BasicBlock& BB : F)
+    {
+        for (const llvm::Instruction& I : BB)
+        {
+            if (!I.getType()->isVoidTy()) registers[&I] = next_register++;
+        }
+    }
+
+    for (auto it = F.begin(); it != F.end(); ++it)
+    {
+        auto next = std::next(it);
+        next_block = next == F.end() ? nullptr : &*next;
+        block_starts[&*it] = out.code.size();
+        for (const llvm::Instruction& I : *it)
+        {
+            if (!lower(I) || !error.empty()) return false;
+        }
+    }
+
+    for (const Fixup& fixup : fixups)
+    {
+        int target = edge_target(fixup);
+        switch (fixup.kind)
+        {
+        case Fixup::FIELD_B: out.code[fixup.index].b = target; break;
+        case Fixup::FIELD_C: out.code[fixup.index].c = target; break;
+        case Fixup::FIELD_D: out.code[fixup.index].d = target; break;
+        case Fixup::CASE:
+            out.switches[fixup.index].cases[fixup.case_index].second = target;
+            break;
+        case Fixup::DEFAULT:
+            out.switches[fixup.index].default_target = target;
+            break;
+        }
+    }
+    for (BytecodeVM::SwitchTable& table : out.switches)
+    {
+        if (table.cases.empty()) continue;
+        int64_t low = table.cases[0].first, high = low;
+        for (auto& case_ : table.cases)
+        {
+            low = std::min(low, case_.first);
+            high = std::max(high, case_.first);
+        }
+        if ((uint64_t)high - (uint64_t)low > 2 * table.cases.size() + 8)
+            continue;
+        table.first = low;
+        table.dense.assign(high - low + 1, table.default_target);
+        for (auto& case_ : table.cases)
+            table.dense[case_.first - low] = case_.second;
+    }
+    out.register_count = next_register;
+    return error.empty();
+}
+
+uint8_t* BytecodeVM::allocate_static(uint64_t size)
+{
+    // (zeroed, like a linked program's globals)
+    static_memory.emplace_back(new uint8_t[size ? size : 1]());
+    return static_memory.back().get();
+}
+
+bool BytecodeVM::constant_value(const Constant* C, Slot& value,
+    std::string& error)
+{
+    Type* type = C->getType();
+    if (const ConstantInt* CI = dyn_cast<ConstantInt>(C))
+    {
+        if (CI->getBitWidth() > MAX_WIDTH) goto unsupported;
+        value.i = canonical(CI->getZExtValue(), CI->getBitWidth());
+        return true;
+    }
+    if (const ConstantFP* FP = dyn_cast<ConstantFP>(C))
+    {
+        if (type->isFloatTy()) value.f = FP->getValueAPF().convertToFloat();
+        else if (type->isDoubleTy())
+            value.d = FP->getValueAPF().convertToDouble();
+        else goto unsupported;
+        return true;
+    }
+    if (const GlobalVariable* GV = dyn_cast<GlobalVariable>(C))
+    {
+        auto found = globals.find(GV);
+        if (found == globals.end()) goto unsupported;
+        value.p = found->second;
+        return true;
+    }
+    if (type->isAggregateType())
+    {
+        // A pointer to its own copy, like any other aggregate value
+        uint8_t* memory = allocate_static(layout->getTypeAllocSize(type));
+        if (!write_constant(C, memory, error)) return false;
+        value.p = memory;
+        return true;
+    }
+    if (isa<ConstantPointerNull>(C) || isa<UndefValue>(C)
+        || isa<ConstantAggregateZero>(C))
+    {
+        value.i = 0;
+        return true;
+    }
+    if (const ConstantExpr* CE = dyn_cast<ConstantExpr>(C))
+    {
+        switch (CE->getOpcode())
+        {
+        case llvm::Instruction::GetElementPtr:
+        {
+            APInt offset(layout->getPointerSizeInBits(), 0);
+            if (!cast<GEPOperator>(CE)->accumulateConstantOffset(
+                *layout, offset))
+                goto unsupported;
+            if (!constant_value(CE->getOperand(0), value, error))
+                return false;
+            value.p += offset.getSExtValue();
+            return true;
+        }
+        case llvm::Instruction::BitCast:
+        case llvm::Instruction::AddrSpaceCast:
+        case llvm::Instruction::PtrToInt:
+        case llvm::Instruction::IntToPtr:
+            return constant_value(CE->getOperand(0), value, error);
+        default:
+            break;
+        }
+    }
+
+unsupported:
+    error = "The VM can't use the constant: " + describe(*C);
+    return false;
+}
+
+bool BytecodeVM::write_constant(const Constant* C, uint8_t* at,
+    std::string& error)
+{
+    Type* type = C->getType();
+    if (isa<ConstantAggregateZero>(C) || isa<UndefValue>(C)
+        || isa<ConstantPointerNull>(C))
+    {
+        std::memset(at, 0, layout->getTypeAllocSize(type));
+        return true;
+    }
+    if (const ConstantDataSequential* data
+        = dyn_cast<ConstantDataSequential>(C))
+    {
+        uint64_t size = layout->getTypeAllocSize(data->getElementType());
+        for (unsigned k = 0; k < data->getNumElements(); k++)
+        {
+            if (!write_constant(data->getElementAsConstant(k),
+                at + k * size, error))
+                return false;
+        }
+        return true;
+    }
+    if (const ConstantArray* array = dyn_cast<ConstantArray>(C))
+    {
+        uint64_t size = layout->getTypeAllocSize(
+            array->getType()->getElementType());
+        for (unsigned k = 0; k < array->getNumOperands(); k++)
+        {
+            if (!write_constant(array->getOperand(k), at + k * size, error))
+                return false;
+        }
+        return true;
+    }
+    if (const ConstantStruct* structure = dyn_cast<ConstantStruct>(C))
+    {
+        const StructLayout* fields = layout->getStructLayout(
+            structure->getType());
+        for (unsigned k = 0; k < structure->getNumOperands(); k++)
+        {
+            if (!write_constant(structure->getOperand(k),
+                at + fields->getElementOffset(k), error))
+                return false;
+        }
+        return true;
+    }
+
+    Slot value;
+    if (!constant_value(C, value, error)) return false;
+    if (type->isIntegerTy(1) || type->isIntegerTy(8))
+    {
+        int8_t byte = value.i;
+        std::memcpy(at, &byte, 1);
+    }
+    else if (type->isIntegerTy(16))
+    {
+        int16_t half = value.i;
+        std::memcpy(at, &half, 2);
+    }
+    else if (type->isIntegerTy(32))
+    {
+        int32_t word = value.i;
+        std::memcpy(at, &word, 4);
+    }
+    else if (type->isFloatTy()) std::memcpy(at, &value.f, 4);
+    else if (type->isIntegerTy(64) || type->isDoubleTy()
+        || type->isPointerTy())
+        std::memcpy(at, &value.i, 8);
+    else
+    {
+        error = "The VM can't use the constant: " + describe(*C);
+        return false;
+    }
+    return true;
+}
+
+bool BytecodeVM::load(Module& module, std::string& error)
+{
+    Clock::time_point start = Clock::now();
+    layout = &module.getDataLayout();
+    if (layout->getPointerSize() != sizeof(void*))
+    {
+        error = "The VM can only run programs for "
+            + std::to_string(sizeof(void*) * 8) + " bit pointers";
+        return false;
+    }
+
+    // Every global's memory, then what's in it
+    //  (initializers can point to other globals)
+    for (const GlobalVariable& GV : module.globals())
+    {
+        if (!GV.hasInitializer())
+        {
+            error = "The VM can't run " + module.getModuleIdentifier()
+                + ": " + GV.getName().str() + " isn't defined in it";
+            return false;
+        }
+        globals[&GV] = allocate_static(
+            layout->getTypeAllocSize(GV.getValueType()));
+    }
+    for (const GlobalVariable& GV : module.globals())
+    {
+        if (!write_constant(GV.getInitializer(), globals[&GV], error))
+            return false;
+    }
+
+    for (const llvm::Function& F : module)
+    {
+        if (F.isDeclaration()) continue;
+        function_indices[&F] = functions.size();
+        functions.emplace_back();
+        functions.back().name = F.getName().str();
+        if (F.getName() == "main") main_function = functions.size() - 1;
+    }
+    if (main_function < 0)
+    {
+        error = "The VM can't run a program without a main";
+        return false;
+    }
+    for (llvm::Function& F : module)
+    {
+        if (F.isDeclaration()) continue;
+        FunctionLowering lowering(*this, functions[function_indices[&F]],
+            error);
+        if (!lowering.lower(F)) return false;
+    }
+
+    // The module (and its globals) aren't needed now
+    function_indices.clear();
+    globals.clear();
+    if (trace_categories & TRACE_VM)
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3) << "vm: lowered "
+            << functions.size() << " function(s) to " << instruction_count()
+            << " instructions in " << std::chrono::duration<double, 
+                std::milli>(Clock::now() - start).count() << "ms";
+        trace_line(out.str());
+    }
+    return true;
+}
+
+size_t BytecodeVM::instruction_count() const
+{
+    size_t count = 0;
+    for (const Function& function : functions) count += function.code.size();
+    return count;
+}
+
+int BytecodeVM::run(std::string& error)
+{
+    Clock::time_point start = Clock::now();
+    int result = execute(error);
+    // (before anything the compiler prints after it)
+    std::fflush(stdout);
+    if (trace_categories & TRACE_VM)
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3) << "vm: ran in "
+            << std::chrono::duration<double, std::milli>(
+                Clock::now() - start).count() << "ms";
+        trace_line(out.str());
+    }
+    return result;
+}
+
+int BytecodeVM::execute(std::string& error)
+{
+#ifdef VM_THREADED
+    static const void* const handlers[] = {
+#define OP_LABEL(name) &&op_##name,
+        VM_OPS(OP_LABEL)
+#undef OP_LABEL
+    };
+    if (!threaded)
+    {
+        for (Function& function : functions)
+        {
+            for (Instruction& instruction : function.code)
+                instruction.label = handlers[instruction.op];
+        }
+        threaded = true;
+    }
+#define OP(name) op_##name:
+#define DISPATCH() goto *pc->label
+#else
+#define OP(name) case OP_##name:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT() do { ++pc; DISPATCH(); } while (false)
+#define JUMP(target) do { pc = code + (target); DISPATCH(); } while (false)
+#define R(field) regs[pc->field]
+
+    // What a call returns to
+    struct Return
+    {
+        const Function* function;
+        const Instruction* pc;
+        Slot* regs;
+        uint8_t* frame;
+        const CallSite* site;
+    };
+    std::vector<Return> returns;
+
+    // (only the pages that are used are ever touched)
+    std::unique_ptr<Slot[]> register_stack(new Slot[REGISTER_STACK_SLOTS]);
+    std::unique_ptr<uint8_t[]> frame_stack(new uint8_t[FRAME_STACK_BYTES]);
+    const Slot* regs_end = register_stack.get() + REGISTER_STACK_SLOTS;
+    const uint8_t* frame_end = frame_stack.get() + FRAME_STACK_BYTES;
+
+    const Function* function = &functions[main_function];
+    const Instruction* code = function->code.data();
+    const Instruction* pc = code;
+    Slot* regs = register_stack.get();
+    uint8_t* frame = frame_stack.get();
+    // What RET returns
+    Slot returned;
+    if (function->register_count > REGISTER_STACK_SLOTS
+        || function->frame_size > FRAME_STACK_BYTES)
+        goto stack_overflow;
+    for (auto& constant : function->constants)
+        regs[constant.first] = constant.second;
+
+#ifdef VM_THREADED
+    DISPATCH();
+#else
+dispatch:
+    switch (pc->op)
+#endif
+    {
+    OP(MOV) R(a) = R(b); NEXT();
+
+    OP(ADD_I32)
+        R(a).i = (int32_t)((uint32_t)R(b).i + (uint32_t)R(c).i); NEXT();
+    OP(SUB_I32)
+        R(a).i = (int32_t)((uint32_t)R(b).i - (uint32_t)R(c).i); NEXT();
+    OP(MUL_I32)
+        R(a).i = (int32_t)((uint32_t)R(b).i * (uint32_t)R(c).i); NEXT();
+    OP(SDIV_I32)
+    {
+        int32_t x = R(b).i, y = R(c).i;
+        if (y == 0) goto division_by_zero;
+        R(a).i = y == -1 ? (int32_t)(0u - (uint32_t)x) : x / y;
+        NEXT();
+    }
+    OP(SREM_I32)
+    {
+        int32_t x = R(b).i, y = R(c).i;
+        if (y == 0) goto division_by_zero;
+        R(a).i = y == -1 ? 0 : x % y;
+        NEXT();
+    }
+
+    OP(ADD)
+        R(a).i = canonical((uint64_t)R(b).i + (uint64_t)R(c).i, pc->d);
+        NEXT();
+    OP(SUB)
+        R(a).i = canonical((uint64_t)R(b).i - (uint64_t)R(c).i, pc->d);
+        NEXT();
+    OP(MUL)
+        R(a).i = canonical((uint64_t)R(b).i * (uint64_t)R(c).i, pc->d);
+        NEXT();
+    OP(SDIV)
+    {
+        int64_t x = R(b).i, y = R(c).i;
+        if (y == 0) goto division_by_zero;
+        R(a).i = canonical(y == -1 ? 0 - (uint64_t)x : x / y, pc->d);
+        NEXT();
+    }
+    OP(SREM)
+    {
+        int64_t x = R(b).i, y = R(c).i;
+        if (y == 0) goto division_by_zero;
+        R(a).i = y == -1 ? 0 : x % y;
+        NEXT();
+    }
+    OP(UDIV)
+    {
+        uint64_t x = zero_extend(R(b).i, pc->d), y = zero_extend(R(c).i, pc->d);
+        if (y == 0) goto division_by_zero;
+        R(a).i = canonical(x / y, pc->d);
+        NEXT();
+    }
+    OP(UREM)
+    {
+        uint64_t x = zero_extend(R(b).i, pc->d), y = zero_extend(R(c).i, pc->d);
+        if (y == 0) goto division_by_zero;
+        R(a).i = canonical(x % y, pc->d);
+        NEXT();
+    }
+
+    // (canonical in, canonical out)
+    OP(AND) R(a).i = R(b).i & R(c).i; NEXT();
+    OP(OR) R(a).i = R(b).i | R(c).i; NEXT();
+    OP(XOR) R(a).i = R(b).i ^ R(c).i; NEXT();
+    OP(SHL)
+        R(a).i = canonical((uint64_t)R(b).i << (R(c).i & 63), pc->d);
+        NEXT();
+    OP(LSHR)
+        R(a).i = canonical(zero_extend(R(b).i, pc->d) >> (R(c).i & 63),
+            pc->d);
+        NEXT();
+    OP(ASHR) R(a).i = R(b).i >> (R(c).i & 63); NEXT();
+
+    OP(ICMP_EQ) R(a).i = R(b).i == R(c).i; NEXT();
+    OP(ICMP_NE) R(a).i = R(b).i != R(c).i; NEXT();
+    OP(ICMP_SLT) R(a).i = R(b).i < R(c).i; NEXT();
+    OP(ICMP_SLE) R(a).i = R(b).i <= R(c).i; NEXT();
+    OP(ICMP_SGT) R(a).i = R(b).i > R(c).i; NEXT();
+    OP(ICMP_SGE) R(a).i = R(b).i >= R(c).i; NEXT();
+    OP(ICMP_ULT)
+        R(a).i = zero_extend(R(b).i, pc->d) < zero_extend(R(c).i, pc->d);
+        NEXT();
+    OP(ICMP_ULE)
+        R(a).i = zero_extend(R(b).i, pc->d) <= zero_extend(R(c).i, pc->d);
+        NEXT();
+    OP(ICMP_UGT)
+        R(a).i = zero_extend(R(b).i, pc->d) > zero_extend(R(c).i, pc->d);
+        NEXT();
+    OP(ICMP_UGE)
+        R(a).i = zero_extend(R(b).i, pc->d) >= zero_extend(R(c).i, pc->d);
+        NEXT();
+
+    OP(FADD) R(a).f = R(b).f + R(c).f; NEXT();
+    OP(FSUB) R(a).f = R(b).f - R(c).f; NEXT();
+    OP(FMUL) R(a).f = R(b).f * R(c).f; NEXT();
+    OP(FDIV) R(a).f = R(b).f / R(c).f; NEXT();
+    OP(FNEG) R(a).f = -R(b).f; NEXT();
+    OP(FCMP)
+    {
+        float x = R(b).f, y = R(c).f;
+        bool unordered = x != x || y != y;
+        bool result;
+        switch ((CmpInst::Predicate)pc->d)
+        {
+        case CmpInst::FCMP_FALSE: result = false; break;
+        case CmpInst::FCMP_OEQ: result = !unordered && x == y; break;
+        case CmpInst::FCMP_OGT: result = !unordered && x > y; break;
+        case CmpInst::FCMP_OGE: result = !unordered && x >= y; break;
+        case CmpInst::FCMP_OLT: result = !unordered && x < y; break;
+        case CmpInst::FCMP_OLE: result = !unordered && x <= y; break;
+        case CmpInst::FCMP_ONE: result = !unordered && x != y; break;
+        case CmpInst::FCMP_ORD: result = !unordered; break;
+        case CmpInst::FCMP_UNO: result = unordered; break;
+        case CmpInst::FCMP_UEQ: result = unordered || x == y; break;
+        case CmpInst::FCMP_UGT: result = unordered || x > y; break;
+        case CmpInst::FCMP_UGE: result = unordered || x >= y; break;
+        case CmpInst::FCMP_ULT: result = unordered || x < y; break;
+        case CmpInst::FCMP_ULE: result = unordered || x <= y; break;
+        case CmpInst::FCMP_UNE: result = unordered || x != y; break;
+        default: result = true; break;
+        }
+        R(a).i = result;
+        NEXT();
+    }
+
+    OP(ZEXT) R(a).i = zero_extend(R(b).i, pc->d); NEXT();
+    OP(SEXT_I1) R(a).i = -R(b).i; NEXT();
+    OP(TRUNC) R(a).i = canonical(R(b).i, pc->d); NEXT();
+    OP(SITOFP) R(a).f = (float)R(b).i; NEXT();
+    OP(FPTOSI) R(a).i = canonical((int64_t)R(b).f, pc->d); NEXT();
+
+    OP(LOAD_I1) R(a).i = *(R(b).p + pc->c) & 1; NEXT();
+    OP(LOAD_I8) R(a).i = *(int8_t*)(R(b).p + pc->c); NEXT();
+    OP(LOAD_I16)
+    {
+        int16_t value;
+        std::memcpy(&value, R(b).p + pc->c, 2);
+        R(a).i = value;
+        NEXT();
+    }
+    OP(LOAD_I32)
+    {
+        int32_t value;
+        std::memcpy(&value, R(b).p + pc->c, 4);
+        R(a).i = value;
+        NEXT();
+    }
+    OP(LOAD_I64) std::memcpy(&R(a).i, R(b).p + pc->c, 8); NEXT();
+    OP(LOAD_F32) std::memcpy(&R(a).f, R(b).p + pc->c, 4); NEXT();
+    OP(LOAD_F64) std::memcpy(&R(a).d, R(b).p + pc->c, 8); NEXT();
+
+    OP(STORE_I8) *(int8_t*)(R(b).p + pc->c) = R(a).i; NEXT();
+    OP(STORE_I16)
+    {
+        int16_t value = R(a).i;
+        std::memcpy(R(b).p + pc->c, &value, 2);
+        NEXT();
+    }
+    OP(STORE_I32)
+    {
+        int32_t value = R(a).i;
+        std::memcpy(R(b).p + pc->c, &value, 4);
+        NEXT();
+    }
+    OP(STORE_I64) std::memcpy(R(b).p + pc->c, &R(a).i, 8); NEXT();
+    OP(STORE_F32) std::memcpy(R(b).p + pc->c, &R(a).f, 4); NEXT();
+    OP(STORE_F64) std::memcpy(R(b).p + pc->c, &R(a).d, 8); NEXT();
+
+    OP(PTR_ADD) R(a).p = R(b).p + pc->c; NEXT();
+    OP(GEP_INDEX) R(a).p = R(b).p + R(c).i * pc->d; NEXT();
+    OP(ALLOCA) R(a).p = frame + pc->c; NEXT();
+    OP(AGG_COPY)
+    {
+        uint8_t* copy = frame + pc->c;
+        std::memmove(copy, R(b).p, pc->d);
+        R(a).p = copy;
+        NEXT();
+    }
+    OP(AGG_STORE) std::memmove(R(b).p, R(a).p, pc->d); NEXT();
+    OP(SELECT) R(a) = R(b).i ? R(c) : R(d); NEXT();
+
+    OP(JMP) JUMP(pc->b);
+    OP(BR_IF) JUMP(R(a).i ? pc->b : pc->c);
+    OP(BR_EQ) JUMP(R(a).i == R(b).i ? pc->c : pc->d);
+    OP(BR_NE) JUMP(R(a).i != R(b).i ? pc->c : pc->d);
+    OP(BR_SLT) JUMP(R(a).i < R(b).i ? pc->c : pc->d);
+    OP(BR_SLE) JUMP(R(a).i <= R(b).i ? pc->c : pc->d);
+    OP(BR_SGT) JUMP(R(a).i > R(b).i ? pc->c : pc->d);
+    OP(BR_SGE) JUMP(R(a).i >= R(b).i ? pc->c : pc->d);
+    OP(SWITCH)
+    {
+        const SwitchTable& table = function->switches[pc->b];
+        int64_t value = R(a).i;
+        if (!table.dense.empty())
+        {
+            uint64_t k = (uint64_t)value - (uint64_t)table.first;
+            JUMP(k < table.dense.size() ? table.dense[k] 
+                : table.default_target);
+        }
+        for (auto& case_ : table.cases)
+        {
+            if (case_.first == value) JUMP(case_.second);
+        }
+        JUMP(table.default_target);
+    }
+
+    OP(CALL)
+    {
+        const CallSite& site = function->calls[pc->b];
+        const Function& callee = functions[site.function];
+        Slot* callee_regs = regs + function->register_count;
+        uint8_t* callee_frame = frame + function->frame_size;
+        if (callee.register_count > regs_end - callee_regs
+            || callee.frame_size > frame_end - callee_frame)
+            goto stack_overflow;
+
+        for (size_t k = 0; k < site.args.size(); k++)
+            callee_regs[k] = regs[site.args[k]];
+        for (auto& constant : callee.constants)
+            callee_regs[constant.first] = constant.second;
+        returns.push_back({function, pc, regs, frame, &site});
+
+        function = &callee;
+        code = pc = callee.code.data();
+        regs = callee_regs;
+        frame = callee_frame;
+        DISPATCH();
+    }
+    OP(NATIVE)
+    {
+        const NativeCall& call = function->natives[pc->b];
+        call.thunk(regs, call.args.data());
+        NEXT();
+    }
+    OP(RET)
+        returned = R(a);
+        goto return_;
+    OP(RET_VOID)
+        returned.i = 0;
+        goto return_;
+    OP(UNREACHABLE)
+        error = "Reached an unreachable instruction in " + function->name;
+        return -1;
+    }
+
+return_:
+    {
+        if (returns.empty()) return returned.i;
+
+        const Return& back = returns.back();
+        const CallSite& site = *back.site;
+        function = back.function;
+        code = function->code.data();
+        pc = back.pc;
+        regs = back.regs;
+        frame = back.frame;
+        returns.pop_back();
+        if (site.result >= 0)
+        {
+            if (site.result_size)
+            {
+                // (out of the callee's frame, before it's reused)
+                uint8_t* copy = frame + site.result_offset;
+                std::memcpy(copy, returned.p, site.result_size);
+                regs[site.result].p = copy;
+            }
+            else regs[site.result] = returned;
+        }
+        NEXT();
+    }
+
+division_by_zero:
+    error = "Division by zero in " + function->name;
+    return -1;
+stack_overflow:
+    error = "Stack overflow (" + std::to_string(returns.size())
+        + " calls deep) in " + function->name;
+    return -1;
+
+#undef OP
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef R
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Runs a program without compiling it to machine code (--vm): the
+//  parser's module is lowered to a compact register-based bytecode,
+//  which is run by a threaded-dispatch interpreter (computed goto, with
+//  gcc and clang). Nothing of llvm's code generator is started, so a
+//  program starts running as soon as it's parsed.
+// Each function's instructions and arguments get one 64 bit register
+//  in its frame; locals (allocas) and aggregate values (arrays, the
+//  OUT results procedures return) live in its frame's memory. The
+//  builtins (GET*, PUT*) are the runtime's, linked into the compiler.
+class BytecodeVM
+{
+public:
+    // A register: canonical integers are sign extended to 64 bits,
+    //  except i1 (0 or 1); pointers are the machine's
+    union Slot
+    {
+        int64_t i;
+        float f;
+        double d;
+        uint8_t* p;
+    };
+
+    // Lower module to bytecode (it isn't needed after this).
+    // False, with error set, if it uses something the VM can't run.
+    bool load(llvm::Module& module, std::string& error);
+
+    // Run main. Returns what it returned, or -1 with error set if the
+    //  program couldn't go on (dividing by zero, running out of stack).
+    int run(std::string& error);
+
+    // The bytecode's size, for --trace=vm
+    size_t instruction_count() const;
+
+private:
+    // op is replaced by the address of its handler before the program
+    //  runs (with computed goto)
+    struct Instruction
+    {
+        union
+        {
+            intptr_t op;
+            const void* label;
+        };
+        int32_t a, b, c, d;
+    };
+
+    struct CallSite
+    {
+        int function;
+        // Register for the result (-1 if it isn't used)
+        int result;
+        // An aggregate result is copied to this offset in the
+        //  caller's frame (size 0 for anything else)
+        int result_offset;
+        int result_size;
+        std::vector<int> args;
+    };
+
+    typedef void (*NativeThunk)(Slot* regs, const int* args);
+    struct NativeCall
+    {
+        NativeThunk thunk;
+        std::vector<int> args;
+    };
+
+    struct SwitchTable
+    {
+        std::vector<std::pair<int64_t, int>> cases;
+        int default_target;
+        // When the values are close together: the target for each one 
+        //  from first on (the default's for the gaps), instead of a search
+        int64_t first = 0;
+        std::vector<int> dense;
+    };
+
+    struct Function
+    {
+        std::string name;
+        int param_count = 0;
+        int register_count = 0;
+        // Bytes of allocas and aggregate values
+        int frame_size = 0;
+        std::vector<Instruction> code;
+        // Registers set when the function is called
+        std::vector<std::pair<int, Slot>> constants;
+        std::vector<CallSite> calls;
+        std::vector<NativeCall> natives;
+        std::vector<SwitchTable> switches;
+    };
+
+    std::vector<Function> functions;
+    int main_function = -1;
+    std::unordered_map<const llvm::Function*, int> function_indices;
+
+    // Globals and constant aggregates
+    std::vector<std::unique_ptr<uint8_t[]>> static_memory;
+    std::unordered_map<const llvm::GlobalVariable*, uint8_t*> globals;
+    const llvm::DataLayout* layout = nullptr;
+
+    bool threaded = false;
+
+    friend class FunctionLowering;
+
+    uint8_t* allocate_static(uint64_t size);
+    bool write_constant(const llvm::Constant* C, uint8_t* at,
+        std::string& error);
+    bool constant_value(const llvm::Constant* C, Slot& value,
+        std::string& error);
+
+    // Run (from the first time) labels the instructions with their
+    //  handlers
+    int execute(std::string& error);
+};
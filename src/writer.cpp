@@ -0,0 +1,64 @@
+#include "writer.h"
+#include "llvm_helper.h"
+
+OutputWriter::OutputWriter(const CompilerOptions& options, size_t queue_size)
+    : options(options), queue_size(queue_size), 
+    worker(&OutputWriter::work, this) {}
+
+OutputWriter::~OutputWriter()
+{
+    finish();
+}
+
+void OutputWriter::add(std::unique_ptr<llvm::LLVMContext> context,
+    std::unique_ptr<llvm::Module> module, const std::string& filename)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return queue.size() < queue_size; });
+
+    OutputJob job;
+    job.context = std::move(context);
+    job.module = std::move(module);
+    job.filename = filename;
+    queue.push_back(std::move(job));
+    changed.notify_all();
+}
+
+std::vector<std::string> OutputWriter::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finishing = true;
+    }
+    changed.notify_all();
+    if (worker.joinable()) worker.join();
+
+    return errors;
+}
+
+void OutputWriter::work()
+{
+    while (true)
+    {
+        OutputJob job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return !queue.empty() || finishing; });
+            // Only stops once everything's written
+            if (queue.empty()) return;
+
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        // There's room in the queue again
+        changed.notify_all();
+
+        std::string error;
+        if (!compile_to_file(*job.module, job.filename, options, error))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            errors.push_back(error);
+        }
+        // job's module, then its context, are freed here
+    }
+}
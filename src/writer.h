@@ -0,0 +1,62 @@
+#pragma once
+
+#include "options.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Finished modules that can be waiting to be written (besides the one
+//  being written) before the next compile has to wait for them.
+//  Each one is a whole program's IR, so it's kept small.
+const size_t OUTPUT_QUEUE_SIZE = 2;
+
+// A module to print to a .ll file, along with the context it's in
+struct OutputJob
+{
+    std::unique_ptr<llvm::LLVMContext> context;
+    std::unique_ptr<llvm::Module> module;
+    std::string filename;
+};
+
+// Writes .ll files on a background thread (see compile_to_file), so the
+//  next input file can be parsed while the last one's output is optimized,
+//  printed and written. Freeing each module happens there too.
+class OutputWriter
+{
+public:
+    // options - for the passes to run before writing (-O, --passes)
+    OutputWriter(const CompilerOptions& options, 
+        size_t queue_size=OUTPUT_QUEUE_SIZE);
+    ~OutputWriter();
+
+    // Queue a module to be written; waits while the queue is full.
+    //  Nothing else can use its context after this.
+    void add(std::unique_ptr<llvm::LLVMContext> context,
+        std::unique_ptr<llvm::Module> module, const std::string& filename);
+
+    // Wait for everything queued to be written. Returns an error
+    //  message for each file that couldn't be.
+    std::vector<std::string> finish();
+
+private:
+    CompilerOptions options;
+    size_t queue_size;
+    std::deque<OutputJob> queue;
+    bool finishing = false;
+    std::vector<std::string> errors;
+
+    std::mutex mutex;
+    // Signalled when a job is added or taken, or on finish()
+    std::condition_variable changed;
+    std::thread worker;
+
+    void work();
+};